@@ -292,6 +292,85 @@ int32_t NAU7802::getAverage(uint8_t averageAmount, unsigned long timeout_ms)
   return (total);
 }
 
+//Reads Cycle Ready and, only if it's set, the conversion result. Each read sets the register
+//pointer and reads back under a repeated start, so nothing else gets the bus in between.
+//The ADCO registers are 18 on from PU_CTRL, and a single burst through all the registers in
+//between (21 bytes rather than 1 + 3) costs more bus time than the second transaction saves
+//(see test/ScaleBusBench.cpp in RoboGaggia).
+//Returns false if the Cycle Ready bit wasn't set, in which case reading is untouched
+bool NAU7802::getReadingIfAvailable(int32_t *reading)
+{
+  uint8_t status;
+  if (!readRegisters(NAU7802_PU_CTRL, &status, 1))
+    return (false); //Sensor did not ACK
+
+  if ((status & (1 << NAU7802_PU_CTRL_CR)) == 0)
+    return (false); //No new conversion
+
+  uint8_t adco[3];
+  if (!readRegisters(NAU7802_ADCO_B2, adco, 3))
+    return (false);
+
+  union
+  {
+    uint32_t unsigned32;
+    int32_t signed32;
+  } signedUnsigned32; // Avoid ambiguity
+
+  signedUnsigned32.unsigned32 = (uint32_t)adco[0] << 16; //MSB
+  signedUnsigned32.unsigned32 |= (uint32_t)adco[1] << 8; //MidSB
+  signedUnsigned32.unsigned32 |= (uint32_t)adco[2];      //LSB
+
+  if ((signedUnsigned32.unsigned32 & 0x00800000) == 0x00800000)
+    signedUnsigned32.unsigned32 |= 0xFF000000; // Preserve 2's complement
+
+  *reading = signedUnsigned32.signed32;
+  return (true);
+}
+
+//Reads length registers from registerAddress on, in one repeated start transaction.
+//Returns false if the sensor didn't ACK or sent back less than we asked for
+bool NAU7802::readRegisters(uint8_t registerAddress, uint8_t *values, uint8_t length)
+{
+  unsigned long startMicros = micros();
+
+  _i2cPort->beginTransmission(_deviceAddress);
+  _i2cPort->write(registerAddress);
+  if (_i2cPort->endTransmission(false) != 0) //Repeated start, keep the bus
+  {
+    recordTransaction(startMicros);
+    return (false);
+  }
+
+  if (_i2cPort->requestFrom((uint8_t)_deviceAddress, length) != length)
+  {
+    recordTransaction(startMicros);
+    return (false);
+  }
+
+  for (uint8_t i = 0; i < length; i++)
+    values[i] = _i2cPort->read();
+
+  recordTransaction(startMicros);
+  return (true);
+}
+
+//Bus profiling. Only the sampling path is counted as that's what runs continuously
+void NAU7802::recordTransaction(unsigned long startMicros)
+{
+  _transactionCount++;
+  _busTimeMicros += micros() - startMicros;
+}
+
+uint32_t NAU7802::getTransactionCount() { return _transactionCount; }
+uint32_t NAU7802::getBusTimeMicros() { return _busTimeMicros; }
+
+void NAU7802::resetBusStats()
+{
+  _transactionCount = 0;
+  _busTimeMicros = 0;
+}
+
 //Call when scale is setup, level, at running temperature, with nothing on it
 void NAU7802::calculateZeroOffset(uint8_t averageAmount, unsigned long timeout_ms)
 {
@@ -386,12 +465,18 @@ bool NAU7802::getBit(uint8_t bitNumber, uint8_t registerAddress)
 //Get contents of a register
 uint8_t NAU7802::getRegister(uint8_t registerAddress)
 {
+  unsigned long startMicros = micros();
+
   _i2cPort->beginTransmission(_deviceAddress);
   _i2cPort->write(registerAddress);
   if (_i2cPort->endTransmission() != 0)
+  {
+    recordTransaction(startMicros);
     return (-1); //Sensor did not ACK
+  }
 
   _i2cPort->requestFrom((uint8_t)_deviceAddress, (uint8_t)1);
+  recordTransaction(startMicros);
 
   if (_i2cPort->available())
     return (_i2cPort->read());
@@ -414,12 +499,18 @@ bool NAU7802::setRegister(uint8_t registerAddress, uint8_t value)
 //Get contents of a 24-bit signed register (conversion result and offsets)
 int32_t NAU7802::get24BitRegister(uint8_t registerAddress)
 {
+  unsigned long startMicros = micros();
+
   _i2cPort->beginTransmission(_deviceAddress);
   _i2cPort->write(registerAddress);
   if (_i2cPort->endTransmission() != 0)
+  {
+    recordTransaction(startMicros);
     return (false); //Sensor did not ACK
+  }
 
   _i2cPort->requestFrom((uint8_t)_deviceAddress, (uint8_t)3);
+  recordTransaction(startMicros);
 
   if (_i2cPort->available())
   {
@@ -179,6 +179,7 @@ public:
   bool available();                          //Returns true if Cycle Ready bit is set (conversion is complete)
   int32_t getReading();                      //Returns 24-bit reading. Assumes CR Cycle Ready bit (ADC conversion complete) has been checked by .available()
   int32_t getAverage(uint8_t samplesToTake, unsigned long timeout_ms = 1000); //Return the average of a given number of readings
+  bool getReadingIfAvailable(int32_t *reading); //Reads Cycle Ready, and the conversion result if it's set, holding the bus throughout. Returns true and fills reading if a conversion was ready
 
   void calculateZeroOffset(uint8_t averageAmount = 8, unsigned long timeout_ms = 1000); //Also called taring. Call this with nothing on the scale
   void setZeroOffset(int32_t newZeroOffset);           //Sets the internal variable. Useful for users who are loading values from NVM.
@@ -229,6 +230,10 @@ public:
   uint32_t getChannel1Gain();       //Get contents of a 32-bit register (gains)
   bool setChannel1Gain(uint32_t value); //Send a given value to be written to given address. Return true if successful
 
+  uint32_t getTransactionCount(); //Number of I2C transactions issued while sampling (available(), getReading(), getReadingIfAvailable() and single register reads)
+  uint32_t getBusTimeMicros();    //Time spent in those transactions
+  void resetBusStats();
+
 private:
   TwoWire *_i2cPort;                   //This stores the user's requested i2c port
   const uint8_t _deviceAddress = 0x2A; //Default unshifted 7-bit address of the NAU7802
@@ -238,5 +243,10 @@ private:
   float _calibrationFactor = 1.0; //This is m. User provides this number so that we can output y when requested
 
   unsigned long _ldoRampDelay = 250; //During begin, wait this many millis after configuring the LDO before performing calibrateAFE
+
+  uint32_t _transactionCount = 0;
+  uint32_t _busTimeMicros = 0;
+  void recordTransaction(unsigned long startMicros);
+  bool readRegisters(uint8_t registerAddress, uint8_t *values, uint8_t length); //Repeated start read of consecutive registers
 };
 #endif
@@ -21,22 +21,23 @@
  *    The parameters specified here are those for for which we can't set up
  *    reliable defaults, so we need to have the user set them.
  ***************************************************************************/
-PID::PID(double* Input, double* Output, double* Setpoint,
-        double Kp, double Ki, double Kd, action_t POn, direction_t ControllerDirection)
+template <typename Real>
+BasicPID<Real>::BasicPID(Real* Input, Real* Output, Real* Setpoint,
+        Real Kp, Real Ki, Real Kd, action_t POn, direction_t ControllerDirection)
 {
     myOutput = Output;
     myInput = Input;
     mySetpoint = Setpoint;
     inAuto = false;
 
-    PID::SetOutputLimits(0, 255);				//default output limit corresponds to
+    BasicPID::SetOutputLimits(0, 255);				//default output limit corresponds to
 												//the arduino pwm limits
 
     SampleTime = 100;							//default Controller Sample Time is 0.1 seconds
 
-    PID::SetControllerDirection(ControllerDirection);
-    PID::SetTunings(Kp, Ki, Kd);
-    PID::SetAction(POn);
+    BasicPID::SetControllerDirection(ControllerDirection);
+    BasicPID::SetTunings(Kp, Ki, Kd);
+    BasicPID::SetAction(POn);
 
     lastTime = millis()-SampleTime;
 }
@@ -46,9 +47,10 @@ PID::PID(double* Input, double* Output, double* Setpoint,
  *    to use Proportional on Error without explicitly saying so
  ***************************************************************************/
 
-PID::PID(double* Input, double* Output, double* Setpoint,
-        double Kp, double Ki, double Kd, direction_t ControllerDirection)
-    :PID::PID(Input, Output, Setpoint, Kp, Ki, Kd, P_ON_E, ControllerDirection)
+template <typename Real>
+BasicPID<Real>::BasicPID(Real* Input, Real* Output, Real* Setpoint,
+        Real Kp, Real Ki, Real Kd, direction_t ControllerDirection)
+    :BasicPID(Input, Output, Setpoint, Kp, Ki, Kd, P_ON_E, ControllerDirection)
 {
 
 }
@@ -60,18 +62,47 @@ PID::PID(double* Input, double* Output, double* Setpoint,
  *   pid Output needs to be computed.  returns true when the output is computed,
  *   false when nothing has been done.
  **********************************************************************************/
-bool PID::Compute()
+template <typename Real>
+bool BasicPID<Real>::Compute()
 {
    if(!inAuto) return false;
    unsigned long now = millis();
    unsigned long timeChange = (now - lastTime);
    if(timeChange>=SampleTime)
    {
+      BasicPID::Step(1);
+      lastTime = now;
+	    return true;
+   }
+   else return false;
+}
+
+/* Compute(dt) ********************************************************************
+ *     Same as Compute(), but runs unconditionally and scales the integral and
+ *   derivative terms by the real time since the last calculation.  ki and kd
+ *   are stored pre-multiplied by SampleTime, so we just need the ratio.
+ **********************************************************************************/
+template <typename Real>
+bool BasicPID<Real>::Compute(Real dtSeconds)
+{
+   if(!inAuto || dtSeconds <= 0) return false;
+   BasicPID::Step(dtSeconds * 1000 / (Real)SampleTime);
+   lastTime = millis();
+   return true;
+}
+
+/* Step(...) **********************************************************************
+ *     The PID calculation itself.  intervalRatio is the time since the last
+ *   calculation divided by SampleTime.
+ **********************************************************************************/
+template <typename Real>
+void BasicPID<Real>::Step(Real intervalRatio)
+{
       /*Compute all the working error variables*/
-      double input = *myInput;
-      double error = *mySetpoint - input;
-      double dInput = (input - lastInput);
-      outputSum+= (ki * error);
+      Real input = *myInput;
+      Real error = *mySetpoint - input;
+      Real dInput = (input - lastInput);
+      outputSum+= (ki * intervalRatio * error);
 
       /*Add Proportional on Measurement, if P_ON_M is specified*/
       if(!pOnE) outputSum-= kp * dInput;
@@ -80,12 +111,12 @@ bool PID::Compute()
       else if(outputSum < outMin) outputSum= outMin;
 
       /*Add Proportional on Error, if P_ON_E is specified*/
-	    double output;
+	    Real output;
       if(pOnE) output = kp * error;
       else output = 0;
 
       /*Compute Rest of PID Output*/
-      output += outputSum - kd * dInput;
+      output += outputSum - kd / intervalRatio * dInput;
 
 	    if(output > outMax) output = outMax;
       else if(output < outMin) output = outMin;
@@ -93,10 +124,6 @@ bool PID::Compute()
 
       /*Remember some variables for next time*/
       lastInput = input;
-      lastTime = now;
-	    return true;
-   }
-   else return false;
 }
 
 /* SetTunings(...)*************************************************************
@@ -104,13 +131,14 @@ bool PID::Compute()
  * it's called automatically from the constructor, but tunings can also
  * be adjusted on the fly during normal operation
  ******************************************************************************/
-void PID::SetTunings(double Kp, double Ki, double Kd)
+template <typename Real>
+void BasicPID<Real>::SetTunings(Real Kp, Real Ki, Real Kd)
 {
    if (Kp<0 || Ki<0 || Kd<0) return;
 
    dispKp = Kp; dispKi = Ki; dispKd = Kd;
 
-   double SampleTimeInSec = ((double)SampleTime)/1000;
+   Real SampleTimeInSec = ((Real)SampleTime)/1000;
    kp = Kp;
    ki = Ki * SampleTimeInSec;
    kd = Kd / SampleTimeInSec;
@@ -126,7 +154,8 @@ void PID::SetTunings(double Kp, double Ki, double Kd)
 /* SetAction(...)*************************************************************
  * Set PID Action P on Error or P on Measurement
  ******************************************************************************/
-void PID::SetAction(action_t POn)
+template <typename Real>
+void BasicPID<Real>::SetAction(action_t POn)
 {
    pOn = POn;
    pOnE = POn == P_ON_E;
@@ -135,12 +164,13 @@ void PID::SetAction(action_t POn)
 /* SetSampleTime(...) *********************************************************
  * sets the period, in Milliseconds, at which the calculation is performed
  ******************************************************************************/
-void PID::SetSampleTime(int NewSampleTime)
+template <typename Real>
+void BasicPID<Real>::SetSampleTime(int NewSampleTime)
 {
    if (NewSampleTime > 0)
    {
-      double ratio  = (double)NewSampleTime
-                      / (double)SampleTime;
+      Real ratio  = (Real)NewSampleTime
+                      / (Real)SampleTime;
       ki *= ratio;
       kd /= ratio;
       SampleTime = (unsigned long)NewSampleTime;
@@ -153,11 +183,12 @@ void PID::SetSampleTime(int NewSampleTime)
  *  the default already,)  the output will be a little different.  maybe they'll
  *  be doing a time window and will need 0-8000 or something.  or maybe they'll
  *  want to clamp it from 0-125.  who knows.  at any rate, that can all be done
- *  here.
+ *  here.  Min == Max is allowed, and pins the output to that value.
  **************************************************************************/
-void PID::SetOutputLimits(double Min, double Max)
+template <typename Real>
+void BasicPID<Real>::SetOutputLimits(Real Min, Real Max)
 {
-   if(Min >= Max) return;
+   if(Min > Max) return;
    outMin = Min;
    outMax = Max;
 
@@ -176,23 +207,28 @@ void PID::SetOutputLimits(double Min, double Max)
  * when the transition from manual to auto occurs, the controller is
  * automatically initialized
  ******************************************************************************/
-void PID::SetMode(mode_t Mode)
+template <typename Real>
+void BasicPID<Real>::SetMode(mode_t Mode)
 {
     bool newAuto = (Mode == AUTOMATIC);
     if(newAuto && !inAuto)
     {  /*we just went from manual to auto*/
-        PID::Initialize();
+        BasicPID::Initialize();
     }
     inAuto = newAuto;
 }
 
 /* Initialize()****************************************************************
  *	does all the things that need to happen to ensure a bumpless transfer
- *  from manual to automatic mode.
+ *  from manual to automatic mode.  with Proportional on Error, the next Output
+ *  includes kp * error, so we take that back out of the sum to land on the
+ *  current Output.
  ******************************************************************************/
-void PID::Initialize()
+template <typename Real>
+void BasicPID<Real>::Initialize()
 {
    outputSum = *myOutput;
+   if(pOnE) outputSum -= kp * (*mySetpoint - *myInput);
    lastInput = *myInput;
    if(outputSum > outMax) outputSum = outMax;
    else if(outputSum < outMin) outputSum = outMin;
@@ -204,7 +240,8 @@ void PID::Initialize()
  * know which one, because otherwise we may increase the output when we should
  * be decreasing.  This is called from the constructor.
  ******************************************************************************/
-void PID::SetControllerDirection(direction_t Direction)
+template <typename Real>
+void BasicPID<Real>::SetControllerDirection(direction_t Direction)
 {
    if(inAuto && Direction != controllerDirection)
    {
@@ -220,9 +257,16 @@ void PID::SetControllerDirection(direction_t Direction)
  * functions query the internal state of the PID.  they're here for display
  * purposes.  this are the functions the PID Front-end uses for example
  ******************************************************************************/
-double PID::GetKp(){ return  dispKp; }
-double PID::GetKi(){ return  dispKi; }
-double PID::GetKd(){ return  dispKd; }
-int PID::GetMode(){ return  inAuto ? AUTOMATIC : MANUAL; }
-int PID::GetDirection(){ return controllerDirection; }
-int PID::GetAction(){ return pOn; }
+template <typename Real> Real BasicPID<Real>::GetKp(){ return  dispKp; }
+template <typename Real> Real BasicPID<Real>::GetKi(){ return  dispKi; }
+template <typename Real> Real BasicPID<Real>::GetKd(){ return  dispKd; }
+template <typename Real> int BasicPID<Real>::GetMode(){ return  inAuto ? AUTOMATIC : MANUAL; }
+template <typename Real> int BasicPID<Real>::GetDirection(){ return controllerDirection; }
+template <typename Real> int BasicPID<Real>::GetAction(){ return pOn; }
+
+/* Instantiations ***************************************************************
+ * The implementation stays in this file, so every numeric type we support has
+ * to be instantiated here.
+ ******************************************************************************/
+template class BasicPID<double>;
+template class BasicPID<float>;
@@ -2,23 +2,32 @@
 #define PID_h
 #define LIBRARY_VERSION	1.2.1
 
-class PID
+//Parameter types for some of the functions below.  These live outside the template
+//so PID::DIRECT and PIDf::DIRECT are the same thing.
+class PIDTypes
 {
   public:
-
-  //Parameter types for some of the functions below
   enum mode_t      { AUTOMATIC = 1, MANUAL  = 0 };
   enum direction_t { DIRECT    = 0, REVERSE = 1 };
   enum action_t    { P_ON_M    = 0, P_ON_E  = 1 };
+};
+
+//The controller is templated on its numeric type.  PID (double) is the original
+//library.  PIDf (float) is for Cortex-M4F parts like the Argon, where the FPU only
+//does single precision and every double operation is emulated in software.
+template <typename Real>
+class BasicPID : public PIDTypes
+{
+  public:
 
   //commonly used functions **************************************************************************
-  PID(double*, double*, double*,              // * constructor.  links the PID to the Input, Output, and
-      double, double, double,                 //   Setpoint.  Initial tuning parameters are also set here.
+  BasicPID(Real*, Real*, Real*,               // * constructor.  links the PID to the Input, Output, and
+      Real, Real, Real,                       //   Setpoint.  Initial tuning parameters are also set here.
       action_t, direction_t);                 //   (overload for specifying proportional mode)
 
 
-  PID(double*, double*, double*,              // * constructor.  links the PID to the Input, Output, and
-      double, double, double, direction_t);   //   Setpoint.  Initial tuning parameters are also set here
+  BasicPID(Real*, Real*, Real*,               // * constructor.  links the PID to the Input, Output, and
+      Real, Real, Real, direction_t);         //   Setpoint.  Initial tuning parameters are also set here
 
   void SetMode(mode_t);                       // * sets PID to either Manual (0) or Auto (non-0)
 
@@ -27,15 +36,20 @@ class PID
                                               //   calculation frequency can be set using SetMode
                                               //   SetSampleTime respectively
 
-  void SetOutputLimits(double, double);       // * clamps the output to a specific range. 0-255 by default, but
+  bool Compute(Real);                         // * performs the PID calculation right now, using the
+                                              //   given time (in seconds) since the last calculation
+                                              //   instead of the sample time.  for callers that
+                                              //   schedule the PID themselves (e.g. from a timer)
+
+  void SetOutputLimits(Real, Real);           // * clamps the output to a specific range. 0-255 by default, but
 										                          //   it's likely the user will want to change this depending on
 										                          //   the application
 
 
 
   //available but not commonly used functions ********************************************************
-  void SetTunings(double, double,             // * While most users will set the tunings once in the
-                    double);         	        //   constructor, this function gives the user the option
+  void SetTunings(Real, Real,                 // * While most users will set the tunings once in the
+                    Real);           	        //   constructor, this function gives the user the option
                                               //   of changing tunings during runtime for Adaptive control
   void SetAction(action_t);
 
@@ -49,37 +63,42 @@ class PID
 
 
   //Display functions ****************************************************************
-	double GetKp();						  // These functions query the pid for interal values.
-	double GetKi();						  //  they were created mainly for the pid front-end,
-	double GetKd();						  // where it's important to know what is actually
+	Real GetKp();						  // These functions query the pid for interal values.
+	Real GetKi();						  //  they were created mainly for the pid front-end,
+	Real GetKd();						  // where it's important to know what is actually
 	int GetMode();						  //  inside the PID.
 	int GetDirection();
   int GetAction();
 
   private:
 	void Initialize();
+	void Step(Real);
 
-	double dispKp;				       // * we'll hold on to the tuning parameters in user-entered
-	double dispKi;				       //   format for display purposes
-	double dispKd;
+	Real dispKp;				       // * we'll hold on to the tuning parameters in user-entered
+	Real dispKi;				       //   format for display purposes
+	Real dispKd;
 
-	double kp;                   // * (P)roportional Tuning Parameter
-  double ki;                   // * (I)ntegral Tuning Parameter
-  double kd;                   // * (D)erivative Tuning Parameter
+	Real kp;                     // * (P)roportional Tuning Parameter
+  Real ki;                     // * (I)ntegral Tuning Parameter
+  Real kd;                     // * (D)erivative Tuning Parameter
 
 	int controllerDirection;
 	int pOn;
 
-  double *myInput;              // * Pointers to the Input, Output, and Setpoint variables
-  double *myOutput;             //   This creates a hard link between the variables and the
-  double *mySetpoint;           //   PID, freeing the user from having to constantly tell us
+  Real *myInput;                // * Pointers to the Input, Output, and Setpoint variables
+  Real *myOutput;               //   This creates a hard link between the variables and the
+  Real *mySetpoint;             //   PID, freeing the user from having to constantly tell us
                                 //   what these values are.  with pointers we'll just know.
 
 	unsigned long lastTime;
-	double outputSum, lastInput;
+	Real outputSum, lastInput;
 
 	unsigned long SampleTime;
-	double outMin, outMax;
+	Real outMin, outMax;
 	bool inAuto, pOnE;
 };
+
+typedef BasicPID<double> PID;
+typedef BasicPID<float> PIDf;
+
 #endif
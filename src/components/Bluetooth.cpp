@@ -26,7 +26,7 @@ void onDataReceived(const uint8_t* data, size_t len, const BlePeerDevice& peer,
 
 char* checkForBLECommand() {
   if (receivedBLEMessage != NULL) {
-    Log.error("BLE Message found:" + String(receivedBLEMessage));
+    GAGGIA_LOG_ERROR("ble", "BLE Message found: %s", receivedBLEMessage);
     char* _receivedBLEMessage = receivedBLEMessage;
     receivedBLEMessage = NULL;
 
@@ -38,8 +38,13 @@ char* checkForBLECommand() {
 
 void sendMessageOverBLE(const char* message) {
   if (BLE.connected()) {
-    String messageString = String(message);
-    txCharacteristic.setValue(messageString);
+    txCharacteristic.setValue(message);
+  }
+}
+
+void sendBytesOverBLE(const uint8_t* data, size_t length) {
+  if (BLE.connected()) {
+    txCharacteristic.setValue(data, length);
   }
 }
 
@@ -9,6 +9,8 @@ const BleUuid txUUID("6E400003-B5A3-F393-E0A9-E50E24DCCA9E");
 
 void sendMessageOverBLE(const char* message);
 
+void sendBytesOverBLE(const uint8_t* data, size_t length);
+
 void bluetoothInit();
 
 char* checkForBLECommand();
@@ -1,8 +1,17 @@
 #include "Common.h"
+#include <stdarg.h>
 
+// The brew counts are uint16_t.. they used to be written as int, which is why
+// there's a gap after each one
 int BACKFLUSH_BREW_COUNT_EEPROM_ADDRESS = 1;
 int TOTAL_BREW_COUNT_EEPROM_ADDRESS = 5;
-int SETTINGS_EEPROM_ADDRESS = 6;
+
+// Settings used to live at 6, on top of the top half of the total brew count, so
+// every shot clobbered the settings version (see loadSettings())
+int LEGACY_SETTINGS_EEPROM_ADDRESS = 6;
+int SETTINGS_EEPROM_ADDRESS = 16;
+
+int SCALE_CALIBRATION_EEPROM_ADDRESS = 32;
 
 // Slows down the main loop interval so we can monitor certain behaviors.. also allows
 // for loop-level debug logs to be sent to Particle Cloud
@@ -13,30 +22,73 @@ void publishParticleLogNow(String group, String message) {
     Log.error(message);
 }
 
-void publishParticleLog(String group, String message) {
-    if (PLATFORM_ID == PLATFORM_ARGON && isInTestMode) {
+// See GAGGIA_LOG_LEVEL in Common.h.. test mode turns this all the way up.
+int logLevel = GAGGIA_LOG_LEVEL_ERROR;
+
+void gaggiaLog(int level, const char *group, const char *format, ...) {
+    char message[GAGGIA_LOG_BUFFER_SIZE];
+
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+
+    if (level > GAGGIA_LOG_LEVEL_ERROR && PLATFORM_ID == PLATFORM_ARGON) {
         Particle.publish(group, message, 60, PUBLIC);
-        Log.error(message);
     }
+
+    // The serial log handler lets everything through (see roboGaggia.ino),
+    // logLevel has already decided what gets this far
+    switch (level) {
+        case GAGGIA_LOG_LEVEL_ERROR:
+            Log.error("%s: %s", group, message);
+            break;
+        case GAGGIA_LOG_LEVEL_INFO:
+            Log.info("%s: %s", group, message);
+            break;
+        default:
+            Log.trace("%s: %s", group, message);
+            break;
+    }
+}
+
+int setLogLevel(String level) {
+    logLevel = constrain(level.toInt(), GAGGIA_LOG_LEVEL_NONE, GAGGIA_LOG_LEVEL_TRACE);
+
+    return logLevel;
 }
 
-int turnOnTestMode(String _na) {
+// The I2C bus can only run as fast as its slowest device, so each device
+// tells us the fastest clock it can handle and we run at the slowest of those.
+uint32_t i2cClockHz = I2C_MAX_CLOCK_HZ;
+
+void requestI2CClock(uint32_t maxClockHz) {
+  if (maxClockHz < i2cClockHz) {
+    i2cClockHz = maxClockHz;
+  }
+
+  Wire.setClock(i2cClockHz);
+}
+
+int turnOnTestMode(String) {
 
     Particle.publish("config", "testMode turned ON", 60, PUBLIC);
     isInTestMode = true;
+    logLevel = GAGGIA_LOG_LEVEL_TRACE;
 
     return 1;
 }
 
-int turnOffTestMode(String _na) {
+int turnOffTestMode(String) {
 
     Particle.publish("config", "testMode turned OFF", 60, PUBLIC);
     isInTestMode = false;
+    logLevel = GAGGIA_LOG_LEVEL_ERROR;
 
     return 1;
 }
 
-int enterDFUMode(String _na) {
+int enterDFUMode(String) {
 
     Particle.publish("config", "entering DFU mode...", 60, PUBLIC);
 
@@ -45,9 +97,28 @@ int enterDFUMode(String _na) {
     return 1;
 }
 
+// How much heap we have left, and the biggest single allocation we could
+// make out of it.  When the second is much smaller than the first, the heap
+// is fragmented.
+int getFreeMemory() {
+  return System.freeMemory();
+}
+
+int getLargestFreeBlock() {
+  runtime_info_t info = {};
+  info.size = sizeof(info);
+  HAL_Core_Runtime_Info(&info, NULL);
+
+  return info.largest_free_block_heap;
+}
+
 void commonInit() {
   Particle.variable("isInTestMode",  isInTestMode);
+  Particle.variable("freeMemory", getFreeMemory);
+  Particle.variable("largestFreeBlock", getLargestFreeBlock);
+  Particle.variable("logLevel", logLevel);
   Particle.function("turnOnTestMode", turnOnTestMode);
   Particle.function("turnOffTestMode", turnOffTestMode);
   Particle.function("enterDFUMode", enterDFUMode);
+  Particle.function("setLogLevel", setLogLevel);
 }
\ No newline at end of file
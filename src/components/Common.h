@@ -74,26 +74,82 @@ struct GaggiaState {
 // as close to a second as possible for accuracy)
 struct Telemetry {  
   int id;
-  String stateName;
-  double measuredWeightGrams = 0;
-  double measuredPressureBars = 0.0;
-  double pumpDutyCycle = 0.0;
-  double flowRateGPS = 0.0;
-  double brewTempC = 0.0;
+  const char *stateName;
+  float measuredWeightGrams = 0;
+  float measuredPressureBars = 0.0;
+  float pumpDutyCycle = 0.0;
+  float flowRateGPS = 0.0;
+  float brewTempC = 0.0;
   int shotsUntilBackflush = 0;
   int totalShots = 0;
   int boilerState = 0;    
+
+  // 0-100 while the scale is calibrating, otherwise -1
+  int scaleCalibrationProgress = -1;
+
+  // Every thermocouple, -1 if it isn't fitted.  brewTempC is whichever
+  // of these the heater is currently regulating on.
+  float boilerTempC = -1;
+  float groupHeadTempC = -1;
+  float steamTempC = -1;
+
+  // While heating up, how long until we're at temperature.  Otherwise -1
+  int secondsToTargetTemp = -1;
 };
 
 extern int BACKFLUSH_BREW_COUNT_EEPROM_ADDRESS;
 extern int TOTAL_BREW_COUNT_EEPROM_ADDRESS;
+extern int LEGACY_SETTINGS_EEPROM_ADDRESS;
 extern int SETTINGS_EEPROM_ADDRESS;
+extern int SCALE_CALIBRATION_EEPROM_ADDRESS;
+
+// Fastest the Argon's I2C peripheral will go
+#define I2C_MAX_CLOCK_HZ 400000
 
 void commonInit();
 
+// Each I2C device calls this with the fastest clock it supports, before
+// talking on the bus.
+void requestI2CClock(uint32_t maxClockHz);
+
 void publishParticleLogNow(String group, String message);
 
-void publishParticleLog(String group, String message);
+// Logging levels.  GAGGIA_LOG_LEVEL is the most verbose level that gets
+// compiled in at all.. anything above it compiles away to nothing, arguments 
+// and all.  Production builds leave it at INFO so the per-loop TRACE logs cost 
+// nothing; define GAGGIA_LOG_LEVEL=3 in the build to get them back.
+//
+// 'logLevel' then turns things down further at runtime.  It's ERROR unless we're 
+// in test mode, and the arguments aren't evaluated unless the level is on.
+#define GAGGIA_LOG_LEVEL_NONE  0
+#define GAGGIA_LOG_LEVEL_ERROR 1 // always goes to the serial log
+#define GAGGIA_LOG_LEVEL_INFO  2 // state changes.. published to Particle Cloud
+#define GAGGIA_LOG_LEVEL_TRACE 3 // per-loop values.. published to Particle Cloud
+
+#ifndef GAGGIA_LOG_LEVEL
+#define GAGGIA_LOG_LEVEL GAGGIA_LOG_LEVEL_INFO
+#endif
+
+// Longest message we'll format, anything longer is truncated.
+#define GAGGIA_LOG_BUFFER_SIZE 128
+
+extern int logLevel;
+
+// printf-style formatting into a fixed buffer on the stack, no String or heap involved.
+// Use the macros below rather than calling this directly.
+void gaggiaLog(int level, const char *group, const char *format, ...) 
+  __attribute__((format(printf, 3, 4)));
+
+#define GAGGIA_LOG(level, group, ...)                              \
+  do {                                                             \
+    if ((level) <= GAGGIA_LOG_LEVEL && (level) <= logLevel) {      \
+      gaggiaLog((level), (group), __VA_ARGS__);                    \
+    }                                                              \
+  } while (0)
+
+#define GAGGIA_LOG_ERROR(group, ...) GAGGIA_LOG(GAGGIA_LOG_LEVEL_ERROR, group, __VA_ARGS__)
+#define GAGGIA_LOG_INFO(group, ...)  GAGGIA_LOG(GAGGIA_LOG_LEVEL_INFO, group, __VA_ARGS__)
+#define GAGGIA_LOG_TRACE(group, ...) GAGGIA_LOG(GAGGIA_LOG_LEVEL_TRACE, group, __VA_ARGS__)
 
 int turnOnTestMode(String _na);
 
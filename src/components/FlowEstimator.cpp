@@ -0,0 +1,84 @@
+#include "FlowEstimator.h"
+
+FlowEstimatorState flowEstimatorState;
+
+// We model the shot as weight increasing at a flow rate that itself wanders around
+// slowly.  These were chosen for a 40Hz filtered scale reading and should be revisited
+// if the scale filtering changes.
+//
+// How far we believe a single scale reading is from the truth (grams, std deviation)
+float FLOW_ESTIMATOR_WEIGHT_NOISE_GRAMS = 0.15;
+
+// How quickly we believe flow can change (grams/second per sqrt(second))..
+// Bigger means we trust new readings more and track changes in flow faster, at
+// the cost of a noisier flow estimate.  Chosen with test/FlowEstimatorBench.cpp..
+// this is as quiet as the 500ms averaged difference we used to use while the flow
+// is steady, and still sees changes in flow well before it did.
+float FLOW_ESTIMATOR_FLOW_NOISE_GPS = 0.25;
+
+// If we haven't heard from the scale in this long, what we knew about flow is
+// no longer useful.
+unsigned long FLOW_ESTIMATOR_MAX_GAP_MILLIS = 1000;
+
+void resetFlowEstimate() {
+  flowEstimatorState.initialized = false;
+  flowEstimatorState.flowRateGPS = 0.0;
+}
+
+void startFlowEstimate(float measuredWeight, unsigned long timeMillis) {
+  flowEstimatorState.weight = measuredWeight;
+  flowEstimatorState.flowRateGPS = 0.0;
+
+  // We know the weight about as well as one reading, but we know nothing about flow.
+  flowEstimatorState.p00 = FLOW_ESTIMATOR_WEIGHT_NOISE_GRAMS * FLOW_ESTIMATOR_WEIGHT_NOISE_GRAMS;
+  flowEstimatorState.p01 = 0.0;
+  flowEstimatorState.p11 = 25.0;
+
+  flowEstimatorState.lastUpdateTimeMillis = timeMillis;
+  flowEstimatorState.initialized = true;
+}
+
+void updateFlowEstimate(float measuredWeight, unsigned long timeMillis) {
+
+  unsigned long gapMillis = timeMillis - flowEstimatorState.lastUpdateTimeMillis;
+
+  if (!flowEstimatorState.initialized || gapMillis > FLOW_ESTIMATOR_MAX_GAP_MILLIS) {
+    startFlowEstimate(measuredWeight, timeMillis);
+    return;
+  }
+
+  float dt = gapMillis / 1000.0f;
+  if (dt <= 0.0f) {
+    return;
+  }
+
+  // Predict - weight moves along at the current flow rate..
+  float q = FLOW_ESTIMATOR_FLOW_NOISE_GPS * FLOW_ESTIMATOR_FLOW_NOISE_GPS;
+
+  float p00 = flowEstimatorState.p00;
+  float p01 = flowEstimatorState.p01;
+  float p11 = flowEstimatorState.p11;
+
+  flowEstimatorState.weight += flowEstimatorState.flowRateGPS * dt;
+
+  p00 = p00 + 2.0f * dt * p01 + dt * dt * p11 + q * dt * dt * dt / 3.0f;
+  p01 = p01 + dt * p11 + q * dt * dt / 2.0f;
+  p11 = p11 + q * dt;
+
+  // Correct - blend in the new reading based on how much we trust it vs. our prediction
+  float r = FLOW_ESTIMATOR_WEIGHT_NOISE_GRAMS * FLOW_ESTIMATOR_WEIGHT_NOISE_GRAMS;
+  float s = p00 + r;
+  float k0 = p00 / s;
+  float k1 = p01 / s;
+
+  float innovation = measuredWeight - flowEstimatorState.weight;
+
+  flowEstimatorState.weight += k0 * innovation;
+  flowEstimatorState.flowRateGPS += k1 * innovation;
+
+  flowEstimatorState.p00 = (1.0f - k0) * p00;
+  flowEstimatorState.p01 = (1.0f - k0) * p01;
+  flowEstimatorState.p11 = p11 - k1 * p01;
+
+  flowEstimatorState.lastUpdateTimeMillis = timeMillis;
+}
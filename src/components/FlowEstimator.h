@@ -0,0 +1,36 @@
+#ifndef FLOW_ESTIMATOR_H
+#define FLOW_ESTIMATOR_H
+
+#include "Common.h"
+
+// Tracks weight and flow rate with a small Kalman filter that is updated
+// on every filtered scale reading.  This replaces taking the difference between
+// two averaged weights every 500ms, which was both noisy and late.
+struct FlowEstimatorState {
+
+  // estimated weight on the scale, in grams
+  float weight = 0.0;
+
+  // estimated rate weight is changing, in grams per second
+  float flowRateGPS = 0.0;
+
+  // 2x2 estimate covariance
+  float p00 = 0.0;
+  float p01 = 0.0;
+  float p11 = 0.0;
+
+  unsigned long lastUpdateTimeMillis = 0;
+
+  boolean initialized = false;
+};
+
+extern FlowEstimatorState flowEstimatorState;
+
+// Feed every new scale reading in here
+void updateFlowEstimate(float measuredWeight, unsigned long timeMillis);
+
+// Call when the weight on the scale jumps for reasons other than flow (e.g.
+// the scale was zero'd) or before a new shot.
+void resetFlowEstimate();
+
+#endif
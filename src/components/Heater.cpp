@@ -1,35 +1,55 @@
 #include "Heater.h"
 #include <pid.h>
+#include "Trace.h"
 
 #define HEATER D8
 
 HeaterState heaterState;
 
-// Chip Select! - tie low to turn on MAX6675 and 
-// get a temperature reading
-#define MAX6675_CS_steam  D5
-
 // Serial Clock - when brought high, shifts
 // another byte from the MAX6675.
-// shared between both brew and steam MAX6675 chips
+// shared between all MAX6675 chips
 // as we don't meaure simultaneously
 #define MAX6675_SCK D3
 
 // Serial Data Out
-#define MAX6675_SO_steam  D6
+// also shared, a MAX6675 lets go of it when it isn't selected
+#define MAX6675_SO  D6
 
 // CS, SCK, and SO together are used to read serial data
 // from the MAX6675 
 
+// Each thermocouple has its own MAX6675, and each MAX6675 has its own
+// Chip Select! - tie low to turn on MAX6675 and get a temperature reading
+//
+// To add a thermocouple, wire its MAX6675 to the shared SCK and SO above and 
+// put its chip select pin here.  -1 means there isn't one fitted.
+TemperatureSensor temperatureSensors[TEMP_SENSOR_COUNT] = {
+  // BOILER_TEMP_SENSOR - this is where the steam thermostat used to be
+  { D5 },
+
+  // GROUP_HEAD_TEMP_SENSOR
+  { -1 },
+
+  // STEAM_TEMP_SENSOR
+  { -1 },
+};
+
+// Which sensor each heater PID regulates on.  If a sensor isn't fitted, we
+// fall back to the boiler sensor.
+int BREW_HEATER_TEMP_SENSOR = BOILER_TEMP_SENSOR;
+int STEAM_HEATER_TEMP_SENSOR = STEAM_TEMP_SENSOR;
+int HOT_WATER_DISPENSE_HEATER_TEMP_SENSOR = BOILER_TEMP_SENSOR;
+
 // This measured temperature assures that the extracted temp
 // at the group is around 93C/200F
-double TARGET_BREW_TEMP = 120; 
-double TOO_HOT_TO_BREW_TEMP = 130; 
+float TARGET_BREW_TEMP = 120; 
+float TOO_HOT_TO_BREW_TEMP = 130; 
 
-double TARGET_HOT_WATER_DISPENSE_TEMP = 120; 
+float TARGET_HOT_WATER_DISPENSE_TEMP = 120; 
 
 // This will trigger the COOLING feature
-double TARGET_STEAM_TEMP = 140; 
+float TARGET_STEAM_TEMP = 140; 
 
 // These were emperically derived.  They are highly dependent on the actual system , but should now work
 // for any RoboGaggia.
@@ -45,71 +65,295 @@ double TARGET_STEAM_TEMP = 140;
 // double heater_PID_kI = 0.08;
 // double heater_PID_kD = 0.0;
 
-double heater_PID_kP = 4.0;  
-double heater_PID_kI = 8.0;
-double heater_PID_kD = 0.0;
+// bang-bang (output clamped to 0-1, on whenever > 0)
+// double heater_PID_kP = 4.0;  
+// double heater_PID_kI = 8.0;
+// double heater_PID_kD = 0.0;
+
+// Output is heater duty cycle (-100-100%), so kP is % per degree C below target
+// and kI is % per degree C per second.  This is added to what the thermal model
+// says it takes to hold the target temperature (feed-forward), so the PID only 
+// needs to correct for what the model gets wrong.
+float heater_PID_kP = 5.0;  
+float heater_PID_kI = 0.05;
+float heater_PID_kD = 0.0;
+
+// The control system for determining how hard to run
+// the heater in order to achieve target temp.  We only ever need the one, so
+// it's allocated up front and we just move its target around as states change.
+PIDf heaterPID(&heaterState.measuredTemp, 
+               &heaterState.pidDutyCycle, 
+               &heaterState.targetTemp, 
+               heater_PID_kP, heater_PID_kI, heater_PID_kD, PIDf::DIRECT);
+
+// The heater is switched by an SSR, so it's either on or off.. We get a duty cycle 
+// out of it by turning it on for that percentage of every window ('time proportioning').
+// The boiler is so slow that it doesn't see the difference between this and
+// running at partial power.
+int HEATER_WINDOW_MILLIS = 1000;
+
+// How often the heater timer runs.. this is the resolution of the on time within 
+// a window (the SSR only switches at zero crossings anyway, so there's no point 
+// going below a mains half cycle).
+#define HEATER_TICK_MILLIS 10
+
+Timer *heaterTimer;
+
+// Set while a state wants the heater regulated (see regulateHeater())
+volatile boolean heaterRegulating = false;
+
+int heaterWindowTick = 0;
+int heaterOnTicks = 0;
+
+// Runs on the timer thread every HEATER_TICK_MILLIS, so the SSR switches on time 
+// no matter what loop() is up to.
+void runHeaterWindow() {
+
+  int ticksInWindow = HEATER_WINDOW_MILLIS / HEATER_TICK_MILLIS;
+
+  if (heaterWindowTick >= ticksInWindow) {
+    heaterWindowTick = 0;
+  }
+
+  // We pick up the duty cycle at the start of each window, so a change part way
+  // through doesn't cut short or double up the on time.
+  if (heaterWindowTick == 0) {
+    heaterOnTicks = (int)(heaterState.heaterDutyCycle * ticksInWindow / 100.0f);
+
+    traceEvent(TRACE_HEATER_WINDOW, heaterRegulating, heaterOnTicks * HEATER_TICK_MILLIS);
+  }
+
+  if (heaterRegulating && heaterWindowTick < heaterOnTicks) {
+    pinSetFast(HEATER);
+  } else {
+    pinResetFast(HEATER);
+  }
+
+  heaterWindowTick++;
+}
+
 
 
 
+// The MAX6675 takes this long to do a conversion, and reading it part way through
+// aborts the conversion.. so we never read it more often than this, and hand out the
+// last reading in between.
+int MAX6675_CONVERSION_MILLIS = 220;
 
-void readHeaterState(int CHIP_SELECT_PIN, int SERIAL_OUT_PIN, int SERIAL_CLOCK_PIN) {
+// Reads the raw 16 bits out of the MAX6675.  
+//
+// The thermocouple boards aren't on the Argon's hardware SPI pins (SCK is D3, which is
+// SPI1's MOSI), so we still bit bang it.. but with the fast pin functions rather than
+// shiftIn(), which is built on digitalWrite()/digitalRead().  The MAX6675 only needs
+// 100ns either side of each clock edge, so a microsecond is plenty.
+uint16_t readMAX6675(int CHIP_SELECT_PIN, int SERIAL_OUT_PIN, int SERIAL_CLOCK_PIN) {
 
-  uint16_t measuredValue;
+  uint16_t measuredValue = 0;
 
   // enable MAX6675
-  digitalWrite(CHIP_SELECT_PIN, LOW);
-  delay(5);
+  pinResetFast(CHIP_SELECT_PIN);
+  delayMicroseconds(1);
+
+  // MSB first
+  for (int bit = 15; bit >= 0; bit--) {
+    pinSetFast(SERIAL_CLOCK_PIN);
+    delayMicroseconds(1);
+
+    if (pinReadFast(SERIAL_OUT_PIN)) {
+      measuredValue |= (1 << bit);
+    }
+
+    pinResetFast(SERIAL_CLOCK_PIN);
+    delayMicroseconds(1);
+  }
+
+  // disable MAX6675.. this also starts the next conversion
+  pinSetFast(CHIP_SELECT_PIN);
+
+  return measuredValue;
+}
+
+void readTemperatureSensor(TemperatureSensor *sensor) {
+
+  sensor->measuredTempMillis = millis();
 
   // Read in 16 bits,
   //  15    = 0 always
   //  14..2 = 0.25 degree counts MSB First
   //  2     = 1 if thermocouple is open circuit  
   //  1..0  = uninteresting status
-  
-  measuredValue = shiftIn(SERIAL_OUT_PIN, SERIAL_CLOCK_PIN, MSBFIRST);
-  measuredValue <<= 8;
-  measuredValue |= shiftIn(SERIAL_OUT_PIN, SERIAL_CLOCK_PIN, MSBFIRST);
-  
-  // disable MAX6675
-  digitalWrite(CHIP_SELECT_PIN, HIGH);
+  uint16_t measuredValue = readMAX6675(sensor->chipSelectPin, MAX6675_SO, MAX6675_SCK);
 
   if (measuredValue & 0x4) {    
     // Bit 2 indicates if the thermocouple is disconnected
-    Log.error("Thermocouple is disconnected!");
-    heaterState.thermocoupleError = true;
+    GAGGIA_LOG_ERROR("heater", "Thermocouple is disconnected!");
+    sensor->thermocoupleError = true;
 
   } else {
     
-    heaterState.thermocoupleError = false;
+    sensor->thermocoupleError = false;
 
     // The lower three bits (0,1,2) are discarded status bits
     measuredValue >>= 3;
 
-    publishParticleLog("renderHeaterState", "measuredInC:" + String(measuredValue*0.25));
+    GAGGIA_LOG_TRACE("renderHeaterState", "measuredInC: %.2f", measuredValue*0.25);
 
     // The remaining bits are the number of 0.25 degree (C) counts
-    heaterState.measuredTemp = measuredValue*0.25;
+    sensor->measuredTemp = measuredValue*0.25f;
   }
 }
 
-void readSteamHeaterState() {
-  readHeaterState(MAX6675_CS_steam, MAX6675_SO_steam, MAX6675_SCK);
+TemperatureSensor *temperatureSensorForRole(int role) {
+  if (role < 0 || role >= TEMP_SENSOR_COUNT || temperatureSensors[role].chipSelectPin < 0) {
+    return &temperatureSensors[BOILER_TEMP_SENSOR];
+  }
+
+  return &temperatureSensors[role];
 }
 
-boolean shouldTurnOnHeater() {
-                        
-  heaterState.heaterPID->Compute();
+// We read one sensor at a time, in turn.  Each gets read once per conversion,
+// and the reads are spread out so we're only ever doing one per loop.
+int fittedTemperatureSensorCount = 0;
+int nextTemperatureSensor = 0;
+unsigned long nextTemperatureReadMillis = 0;
 
-  if (heaterState.heaterShouldBeOn > 0 ) {
-    return true;
-  } else {
-    return false;
+void readTemperatureSensors() {
+
+  if (fittedTemperatureSensorCount > 0 && (long)(millis() - nextTemperatureReadMillis) >= 0) {
+
+    for (int i = 0; i < TEMP_SENSOR_COUNT; i++) {
+      int role = (nextTemperatureSensor + i) % TEMP_SENSOR_COUNT;
+
+      if (temperatureSensors[role].chipSelectPin >= 0) {
+        readTemperatureSensor(&temperatureSensors[role]);
+        nextTemperatureSensor = role + 1;
+        break;
+      }
+    }
+
+    nextTemperatureReadMillis = millis() + MAX6675_CONVERSION_MILLIS / fittedTemperatureSensorCount;
+  }
+
+  // What the heater PID (and everyone else) sees
+  TemperatureSensor *feedbackSensor = temperatureSensorForRole(heaterState.feedbackSensor);
+  heaterState.measuredTemp = feedbackSensor->measuredTemp;
+  heaterState.thermocoupleError = feedbackSensor->thermocoupleError;
+
+  // The thermal model is of the boiler itself
+  TemperatureSensor *boilerSensor = &temperatureSensors[BOILER_TEMP_SENSOR];
+  if (boilerSensor->measuredTempMillis != 0 && !boilerSensor->thermocoupleError) {
+    float heaterPower = heaterRegulating ? heaterState.heaterDutyCycle / 100.0f : 0.0f;
+    updateThermalModel(boilerSensor->measuredTemp, heaterPower, millis());
   }
 }
 
-void turnHeaterOn() {
-  publishParticleLog("heater", "on");
-  digitalWrite(HEATER, HIGH);
+// When we're this far below target, we run the heater flat out (see regulateHeater())
+float HEATER_BOOST_MIN_ERROR_C = 5.0;
+
+// Back to the PID after a boost.  Whatever we'd have been short by is on its way,
+// so the PID starts with nothing in its integral (P_ON_E, so its output is just
+// the proportional part).
+void finishHeaterBoost(float errorC) {
+  heaterState.boosting = false;
+  heaterState.coasting = false;
+
+  heaterState.pidDutyCycle = heater_PID_kP * errorC;
+  heaterPID.SetMode(PIDf::AUTOMATIC);
+}
+
+// Whether we're adding the thermal model's holding power to the PID's output
+boolean heaterFeedForward = false;
+
+// What the thermal model says it takes to hold target (0-100).  Until it's seen
+// enough of the boiler to be trusted (see isThermalModelTrusted()), its guess is
+// no better than the defaults, so the PID does it all on its own.
+//
+// When the model does come to be trusted, the PID has already wound up to about
+// what it takes to hold target, so we take the holding power back out of it
+// rather than heat with both.
+float heaterHoldingDutyCycle() {
+  if (!isThermalModelTrusted()) {
+    heaterFeedForward = false;
+    return 0;
+  }
+
+  float holdingDutyCycle = 100.0f * thermalModelHoldingPower(heaterState.targetTemp);
+
+  if (!heaterFeedForward) {
+    heaterFeedForward = true;
+
+    if (!heaterState.boosting && !heaterState.coasting) {
+      heaterPID.SetMode(PIDf::MANUAL);
+      heaterState.pidDutyCycle -= holdingDutyCycle;
+      heaterPID.SetMode(PIDf::AUTOMATIC);
+    }
+  }
+
+  return holdingDutyCycle;
+}
+
+void regulateHeater() {
+
+  float errorC = heaterState.targetTemp - heaterState.measuredTemp;
+
+  // Warming up..  rather than wait for the PID to wind up, we go flat out until the 
+  // thermal model says the heat that's already on its way will get us to target.
+  // This is where the PID used to overshoot.
+  //
+  // Once we stop, we're still well short of target until that heat shows up, so we
+  // don't boost again until we're asked to heat up again.  Likewise, once we're
+  // close to target, dips (e.g. pulling a shot) are the PID's to deal with.
+  if (heaterState.boostArmed && errorC <= HEATER_BOOST_MIN_ERROR_C) {
+    heaterState.boostArmed = false;
+  }
+
+  if (heaterState.boostArmed && isThermalModelTrusted()) {
+    GAGGIA_LOG_INFO("heater", "boosting");
+
+    heaterState.boostArmed = false;
+    heaterState.boosting = true;
+    heaterPID.SetMode(PIDf::MANUAL);
+  }
+
+  // Then we coast on what it takes to hold target for a dead time, while that heat
+  // arrives.  If the PID took over straight away it would only see how far short we
+  // still are, and wind up against heat that's already in the boiler.
+  if (heaterState.boosting && thermalModelPendingRiseC() >= errorC) {
+    GAGGIA_LOG_INFO("heater", "boost done");
+
+    heaterState.boosting = false;
+    heaterState.coasting = true;
+    heaterState.coastEndMillis = millis() + THERMAL_MODEL_DEAD_TIME_MILLIS;
+  }
+
+  if (heaterState.coasting && (long)(millis() - heaterState.coastEndMillis) >= 0) {
+    finishHeaterBoost(errorC);
+  }
+
+  if (heaterState.boosting) {
+    heaterState.heaterDutyCycle = 100;
+
+  } else if (heaterState.coasting) {
+    heaterState.heaterDutyCycle = heaterHoldingDutyCycle();
+
+  } else {
+    // This throttles itself to once per window.. the heater timer
+    // picks up the new duty cycle at the start of the next window.
+    float holdingDutyCycle = heaterHoldingDutyCycle();
+
+    if (heaterPID.Compute()) {
+
+      heaterState.heaterDutyCycle = constrain(heaterState.pidDutyCycle + holdingDutyCycle, 0.0f, 100.0f);
+
+      GAGGIA_LOG_TRACE("heater", "dutyCycle: %.2f", heaterState.heaterDutyCycle);
+
+      traceEvent(TRACE_HEATER_PID, 
+                 (int16_t) (heaterState.measuredTemp * 10), 
+                 (int32_t) (heaterState.heaterDutyCycle * 100));
+    }
+  }
+
+  heaterRegulating = true;
 }
 
 boolean isHeaterOn() {
@@ -117,49 +361,86 @@ boolean isHeaterOn() {
 }
 
 void turnHeaterOff() {
-  publishParticleLog("heater", "off");
-  digitalWrite(HEATER, LOW);
-}
+  if (heaterRegulating) {
+    GAGGIA_LOG_INFO("heater", "off");
+  }
+
+  heaterRegulating = false;
+  pinResetFast(HEATER);
+
+  // Whenever it comes back on, it'll be heating up from wherever we've cooled to
+  heaterState.boostArmed = true;
 
-void configureHeater(double *heaterTemp) {
-    PID *thisHeaterPID = new PID(&heaterState.measuredTemp, 
-                                 &heaterState.heaterShouldBeOn, 
-                                 heaterTemp, 
-                                 heater_PID_kP, heater_PID_kI, heater_PID_kD, PID::DIRECT);
-    // The heater is either on or off, there's no need making this more complicated..
-    // So the PID either turns the heater on or off.
-    thisHeaterPID->SetOutputLimits(0, 1);
-    thisHeaterPID->SetMode(PID::AUTOMATIC);
-    thisHeaterPID->SetSampleTime(10);
+  if (heaterState.boosting || heaterState.coasting) {
+    finishHeaterBoost(heaterState.targetTemp - heaterState.measuredTemp);
+  }
+}
 
-    heaterState.targetTemp = *heaterTemp;
+// The PID follows heaterState.targetTemp, so changing target is just a matter of
+// changing that.. the PID carries on from where it was.
+void configureHeater(float heaterTemp, int feedbackSensor) {
+    if (heaterTemp != heaterState.targetTemp) {
+      heaterState.boostArmed = true;
+    }
 
-    delete heaterState.heaterPID;
-    heaterState.heaterPID = thisHeaterPID;
+    heaterState.targetTemp = heaterTemp;
+    heaterState.feedbackSensor = feedbackSensor;
 }
 
 void configureBrewHeater() {
-    configureHeater(&TARGET_BREW_TEMP);
+    configureHeater(TARGET_BREW_TEMP, BREW_HEATER_TEMP_SENSOR);
 }
 
 void configureSteamHeater() {
-    configureHeater(&TARGET_STEAM_TEMP);
+    configureHeater(TARGET_STEAM_TEMP, STEAM_HEATER_TEMP_SENSOR);
 }
 
 void configureHotWaterDispenseHeater() {
-    configureHeater(&TARGET_HOT_WATER_DISPENSE_TEMP);
+    configureHeater(TARGET_HOT_WATER_DISPENSE_TEMP, HOT_WATER_DISPENSE_HEATER_TEMP_SENSOR);
+}
+
+// Particle variables can't be floats
+double getTargetBrewTemp() {
+  return TARGET_BREW_TEMP;
+}
+
+double getCurrentBrewTemp() {
+  return heaterState.measuredTemp;
+}
+
+double getHeaterDutyCycle() {
+  return heaterState.heaterDutyCycle;
 }
 
 void heaterInit() {
   
   // setup MAX6675 to read the temperature from thermocouple
-  pinMode(MAX6675_CS_steam, OUTPUT);
-  pinMode(MAX6675_SO_steam, INPUT);
+  pinMode(MAX6675_SO, INPUT);
   pinMode(MAX6675_SCK, OUTPUT);
+  digitalWrite(MAX6675_SCK, LOW);
+
+  for (int role = 0; role < TEMP_SENSOR_COUNT; role++) {
+    int chipSelectPin = temperatureSensors[role].chipSelectPin;
+    if (chipSelectPin >= 0) {
+      pinMode(chipSelectPin, OUTPUT);
+      digitalWrite(chipSelectPin, HIGH);
+      fittedTemperatureSensorCount++;
+    }
+  }
   
   // external heater elements
   pinMode(HEATER, OUTPUT);
 
-  Particle.variable("targetBrewTempC", TARGET_BREW_TEMP);
-  Particle.variable("currentBrewTempC", heaterState.measuredTemp);
+  heaterPID.SetOutputLimits(-100, 100);
+  heaterPID.SetSampleTime(HEATER_WINDOW_MILLIS);
+  heaterPID.SetMode(PIDf::AUTOMATIC);
+
+  thermalModelInit();
+
+  heaterTimer = new Timer(HEATER_TICK_MILLIS, runHeaterWindow);
+  heaterTimer->start();
+
+  Particle.variable("targetBrewTempC", getTargetBrewTemp);
+  Particle.variable("currentBrewTempC", getCurrentBrewTemp);
+  Particle.variable("heaterDutyCycle", getHeaterDutyCycle);
 }
\ No newline at end of file
@@ -3,43 +3,88 @@
 
 #include <pid.h>
 #include "Common.h"
+#include "ThermalModel.h"
 
-extern double TARGET_BREW_TEMP; 
+extern float TARGET_BREW_TEMP; 
 
-extern double TARGET_STEAM_TEMP; 
+extern float TARGET_STEAM_TEMP; 
 
-extern double TARGET_HOT_WATER_DISPENSE_TEMP; 
+extern float TARGET_HOT_WATER_DISPENSE_TEMP; 
+
+// Where each thermocouple is
+#define BOILER_TEMP_SENSOR 0
+#define GROUP_HEAD_TEMP_SENSOR 1
+#define STEAM_TEMP_SENSOR 2
+#define TEMP_SENSOR_COUNT 3
+
+struct TemperatureSensor {
+  // Chip select for this sensor's MAX6675, or -1 if there isn't one fitted
+  int chipSelectPin;
+
+  float measuredTemp = 0.0;
+
+  // When measuredTemp was read.  A MAX6675 is only read
+  // once per conversion, see readTemperatureSensors()
+  unsigned long measuredTempMillis = 0;
+
+  boolean thermocoupleError = false;  
+};
+
+extern TemperatureSensor temperatureSensors[TEMP_SENSOR_COUNT];
 
 
 struct HeaterState {
   boolean thermocoupleError = false;  
 
   // current temp
-  // this is  updated as we read thermocouple sensor
-  double measuredTemp;
+  // this is  updated from feedbackSensor as we read thermocouple sensors
+  float measuredTemp;
+
+  // Which sensor the heater is regulating on, changes with state
+  int feedbackSensor = BOILER_TEMP_SENSOR;
 
   // current target is updated as we change states
-  double targetTemp;
+  float targetTemp;
   
+  // How much of the time the heater is on, 0-100%
+  // This is the PID's correction on top of what the thermal model says 
+  // it takes to hold temperature.. or 100% while boosting, or just what it
+  // takes to hold temperature while coasting
+  float heaterDutyCycle;
+
   // This is calculated and updated by the PID
-  double heaterShouldBeOn;
+  float pidDutyCycle;
 
-  // Used to track ongoing heat cycles...
-  float heaterStarTime = -1;
+  // Running the heater flat out to get up to temperature
+  boolean boosting = false;
+
+  // After a boost, we wait for the heat that's on its way to show up before
+  // handing back to the PID (see regulateHeater())
+  boolean coasting = false;
+  unsigned long coastEndMillis = 0;
 
-  // The control system for determining when to turn on
-  // the heater in order to achieve target temp
-  PID *heaterPID;
+  // We only boost once per heat up.. this is set again when the target changes
+  // or the heater is turned off (see regulateHeater())
+  boolean boostArmed = true;
 
+  // Used to track ongoing heat cycles...
+  float heaterStarTime = -1;
 };
 
 extern HeaterState heaterState;
 
 void heaterInit();
 
-void readSteamHeaterState();
+// Safe to call as often as you like, it reads at most one thermocouple, and
+// only when there's a new reading to be had.
+void readTemperatureSensors();
 
-boolean shouldTurnOnHeater();
+// The sensor for this role, or the boiler sensor if this one isn't fitted.
+TemperatureSensor *temperatureSensorForRole(int role);
+
+// Call this every time around the loop while a state wants the heater on.  The heater 
+// PID works out a duty cycle and a timer switches the heater on and off to match.
+void regulateHeater();
 
 void configureBrewHeater();
 void configureSteamHeater();
@@ -47,8 +92,6 @@ void configureHotWaterDispenseHeater();
 
 boolean isHeaterOn();
 
-void turnHeaterOn();
-
 void turnHeaterOff();
 
 #endif
\ No newline at end of file
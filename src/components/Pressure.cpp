@@ -0,0 +1,123 @@
+#include "Pressure.h"
+
+PressureState pressureState;
+
+#define PRESSURE_SENSOR_ANALOG_IN A0
+
+// see https://docs.google.com/spreadsheets/d/1_15rEy-WI82vABUwQZRAxucncsh84hbYKb2WIA9cnOU/edit?usp=sharing
+// as shown in shart above, the following values were derived by hooking up a bicycle pump w/ guage to the
+// pressure sensor and measuring a series of values vs bar pressure. 
+float PRESSURE_SENSOR_SCALE_FACTOR = 319.0;
+int PRESSURE_SENSOR_OFFSET = 515; 
+
+// How many ADC conversions we take back to back each time we're called.  These only
+// take out the ADC's own noise, not the pump's ripple, so there's no point in many.
+#define PRESSURE_SAMPLES_PER_TICK 8
+
+// How many of the most recent bursts we average.  The pressure control task calls us
+// every 10ms, so 4 is two mains cycles at 50Hz (and 2.4 at 60Hz), which averages out
+// most of the ripple while only putting the reading ~20ms behind.  Whatever ripple is
+// at a multiple of 100Hz can't be averaged out this way (we'd always catch it at the
+// same point), but the timer drifting against the mains moves that around slowly.
+#define PRESSURE_MAX_WINDOW_TICKS 8
+int PRESSURE_WINDOW_TICKS = 4;
+
+// How much each new noise estimate moves the reported noise floor
+float PRESSURE_NOISE_SMOOTHING = 0.1;
+
+// The sum of each burst in the window, oldest first from pressureTickIndex
+uint32_t pressureTickSums[PRESSURE_MAX_WINDOW_TICKS];
+int pressureWindowTicks = 0;
+int pressureTickIndex = 0;
+int pressureTickCount = 0;
+
+// For working out the sample rate
+unsigned long pressureRateWindowStartMillis = 0;
+unsigned long pressureRateWindowSampleCount = 0;
+
+void updatePressureSampleRate(int newSamples) {
+  pressureRateWindowSampleCount += newSamples;
+
+  unsigned long elapsedMillis = millis() - pressureRateWindowStartMillis;
+  if (elapsedMillis >= 1000) {
+    pressureState.sampleRateHz = pressureRateWindowSampleCount * 1000.0f / elapsedMillis;
+
+    pressureRateWindowStartMillis = millis();
+    pressureRateWindowSampleCount = 0;
+  }
+}
+
+float rawToBars(float raw) {
+  return (raw - PRESSURE_SENSOR_OFFSET) / PRESSURE_SENSOR_SCALE_FACTOR;
+}
+
+void readPressureState() {
+
+  uint32_t tickSum = 0;
+  for (int i = 0; i < PRESSURE_SAMPLES_PER_TICK; i++) {
+    tickSum += analogRead(PRESSURE_SENSOR_ANALOG_IN);
+  }
+
+  // PRESSURE_WINDOW_TICKS may have been changed, in which case we start over
+  int windowTicks = constrain(PRESSURE_WINDOW_TICKS, 1, PRESSURE_MAX_WINDOW_TICKS);
+  if (windowTicks != pressureWindowTicks) {
+    pressureWindowTicks = windowTicks;
+    pressureTickCount = 0;
+    pressureTickIndex = 0;
+  }
+
+  pressureTickSums[pressureTickIndex] = tickSum;
+  pressureTickIndex = (pressureTickIndex + 1) % windowTicks;
+  if (pressureTickCount < windowTicks) {
+    pressureTickCount += 1;
+  }
+
+  // The ADC is 12 bits, so the sum of 8 x 8 samples comfortably fits in 32 bits.
+  uint32_t windowSum = 0;
+  for (int i = 0; i < pressureTickCount; i++) {
+    windowSum += pressureTickSums[i];
+  }
+
+  // Averaging keeps the fractional part of the ADC count, which is what gets us
+  // below a tenth of a bar (one count is ~ 0.003 bar).
+  float averageRaw = (float)windowSum / (pressureTickCount * PRESSURE_SAMPLES_PER_TICK);
+  pressureState.measuredPressureInBars = rawToBars(averageRaw);
+
+  // How far each burst is from the window average tells us how noisy a burst is..
+  // the average of pressureTickCount of them is sqrt(pressureTickCount) better than that.
+  if (pressureTickCount > 1) {
+    float sumOfSquares = 0.0;
+    for (int i = 0; i < pressureTickCount; i++) {
+      float difference = (float)pressureTickSums[i] / PRESSURE_SAMPLES_PER_TICK - averageRaw;
+      sumOfSquares += difference * difference;
+    }
+    float variance = sumOfSquares / (pressureTickCount - 1);
+    float noiseBars = sqrtf(variance / pressureTickCount) / PRESSURE_SENSOR_SCALE_FACTOR;
+
+    if (pressureState.noiseFloorBars == 0.0) {
+      pressureState.noiseFloorBars = noiseBars;
+    } else {
+      pressureState.noiseFloorBars += PRESSURE_NOISE_SMOOTHING * (noiseBars - pressureState.noiseFloorBars);
+    }
+  }
+
+  pressureState.lastReadingTimeMillis = millis();
+
+  updatePressureSampleRate(PRESSURE_SAMPLES_PER_TICK);
+}
+
+// Particle variables can't be floats
+double getPressureSampleRateHz() {
+  return pressureState.sampleRateHz;
+}
+
+double getPressureNoiseFloorBars() {
+  return pressureState.noiseFloorBars;
+}
+
+void pressureInit() {
+  pressureRateWindowStartMillis = millis();
+
+  Particle.variable("pressureSampleRateHz", getPressureSampleRateHz);
+  Particle.variable("pressureNoiseFloorBars", getPressureNoiseFloorBars);
+}
@@ -0,0 +1,39 @@
+#ifndef PRESSURE_H
+#define PRESSURE_H
+
+#include "Common.h"
+
+// Reads the pressure transducer on the water pump side.  A single analogRead()
+// is only good to a few tenths of a bar once the pump is running (the vibe pump
+// makes the line pressure ripple at mains frequency).  A burst of back to back
+// samples doesn't help with that, it's over in well under a millisecond so it
+// just catches wherever the ripple happens to be.  So every call takes a short
+// burst, and the reading is the average of the bursts over the last mains cycle
+// or two (see PRESSURE_WINDOW_TICKS).
+struct PressureState {
+
+  // Latest pressure, in bars, averaged over the window
+  float measuredPressureInBars = 0.0;
+
+  // How many raw ADC samples per second we're actually getting
+  float sampleRateHz = 0.0;
+
+  // Standard deviation of measuredPressureInBars, in bars, estimated from how
+  // much the bursts in the window disagree (which is mostly the ripple we didn't
+  // average out).  This is the resolution the pressure PID can actually work with.
+  float noiseFloorBars = 0.0;
+
+  // When measuredPressureInBars was last updated
+  unsigned long lastReadingTimeMillis = 0;
+};
+
+extern PressureState pressureState;
+
+// Takes a burst of ADC samples and updates measuredPressureInBars.  The caller
+// decides the rate (see the pressure control task in WaterPump), which should be
+// every 10ms or so for the window to span a mains cycle.
+void readPressureState();
+
+void pressureInit();
+
+#endif
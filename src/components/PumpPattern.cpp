@@ -0,0 +1,38 @@
+#include "PumpPattern.h"
+
+uint32_t pumpPattern(int dutyCycle, int cyclesInEpoch) {
+
+  if (cyclesInEpoch <= 0) {
+    return 0;
+  }
+
+  if (cyclesInEpoch > PUMP_PATTERN_MAX_CYCLES) {
+    cyclesInEpoch = PUMP_PATTERN_MAX_CYCLES;
+  }
+
+  if (dutyCycle < 0) {
+    dutyCycle = 0;
+  } else if (dutyCycle > 100) {
+    dutyCycle = 100;
+  }
+
+  // Same number of 'on' cycles as we've always had, we just don't put them
+  // all at the front anymore..
+  int onCycles = (cyclesInEpoch * dutyCycle) / 100;
+
+  uint32_t pattern = 0;
+
+  // Starting half way means the 'on' cycles are centered in their slots
+  // (e.g. 1 in 10 is cycle 5, not cycle 0 or 9).
+  int error = cyclesInEpoch / 2;
+
+  for (int cycle = 0; cycle < cyclesInEpoch; cycle++) {
+    error += onCycles;
+    if (error >= cyclesInEpoch) {
+      error -= cyclesInEpoch;
+      pattern |= (1UL << cycle);
+    }
+  }
+
+  return pattern;
+}
@@ -0,0 +1,38 @@
+#ifndef PUMP_PATTERN_H
+#define PUMP_PATTERN_H
+
+#include <stdint.h>
+
+// Works out which AC cycles of an epoch to pass through to the vibe pump
+// (see handleZeroCrossingInterrupt()).  This is plain C++ with no Particle
+// dependencies so it can be built and checked off the device.
+
+// One bit per cycle, so this is the longest epoch we can describe
+#define PUMP_PATTERN_MAX_CYCLES 32
+
+// Returns a pattern where bit i is set if cycle i of the epoch should be 'on'.
+// dutyCycle is 0-100.  The 'on' cycles are spread as evenly as possible through
+// the epoch (Bresenham) rather than bunched up at the start, so the pump gets
+// a steady trickle of power instead of bursts.
+uint32_t pumpPattern(int dutyCycle, int cyclesInEpoch);
+
+// What the control code hands the zero crossing interrupt handlers.. the duty
+// cycle (0-100) in the top byte and its pattern underneath, so a handler gets
+// both from a single load and they can never be from two different duty cycles.
+// That leaves room for a pattern of up to PUMP_COMMAND_MAX_CYCLES.
+#define PUMP_COMMAND_MAX_CYCLES 24
+
+inline uint32_t pumpCommand(int dutyCycle, uint32_t pattern) {
+  return ((uint32_t) dutyCycle << PUMP_COMMAND_MAX_CYCLES) |
+         (pattern & ((1UL << PUMP_COMMAND_MAX_CYCLES) - 1));
+}
+
+inline int pumpCommandDutyCycle(uint32_t command) {
+  return command >> PUMP_COMMAND_MAX_CYCLES;
+}
+
+inline uint32_t pumpCommandPattern(uint32_t command) {
+  return command & ((1UL << PUMP_COMMAND_MAX_CYCLES) - 1);
+}
+
+#endif
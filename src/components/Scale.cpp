@@ -1,4 +1,3 @@
-
 #include "Scale.h"
 
 #include <SparkFun_Qwiic_Scale_NAU7802_Arduino_Library.h>
@@ -10,48 +9,523 @@ NAU7802 myScale; //Create instance of the NAU7802 class
 // The extraction weight which triggers the end of PREINFUSION
 int PREINFUSION_WEIGHT_THRESHOLD_GRAMS = 2;
 
+// If the NAU7802's DRDY (INT) pin is wired to the Argon, define this and we'll
+// only touch the I2C bus once a conversion is actually ready.  Otherwise we
+// poll the Cycle Ready bit every loop, which is cheap compared to the old
+// 500ms blocking average.
+//
+// NOTE: we read the level of DRDY rather than attaching an interrupt to it.  DRDY
+// stays high until the conversion is read, so an edge we missed (e.g. before setup
+// finished) would otherwise stall the scale forever.
+// #define SCALE_DATA_READY_PIN D4
+
+// In high-rate mode we run the NAU7802 at 320 SPS and filter on our side
+// instead of relying on a long box average at 40 SPS:
+//
+//   raw (320 SPS) -> median of SCALE_MEDIAN_WINDOW -> average over SCALE_FILTERED_PERIOD_MICROS -> window
+//
+// The median throws out single-conversion spikes (e.g. the pump vibrating the drip
+// tray) and the decimation stage averages the rest down to 40Hz.  Combined with the
+// short window we use while brewing, this gets us a weight ~50ms behind reality rather than ~250ms, which is
+// what lets us catch preinfusion break-through and the end of the shot sooner.
+//
+// NOTE: the NAU7802 doesn't buffer conversions, so we only see 320 SPS if the main loop
+// comes around faster than every ~3ms.  Conversions we miss are just dropped.  That's why
+// we decimate by time rather than by count.. if the loop is slow (e.g. test mode's 2 second
+// loop) we still get a filtered reading every time round, from however many conversions
+// we got, rather than waiting on 8 of them.
+boolean SCALE_HIGH_RATE_MODE = true;
+
+// Must be odd
+#define SCALE_MEDIAN_WINDOW 3
+
+// 40 filtered readings per second.. normally 8 conversions each at 320 SPS
+unsigned long SCALE_FILTERED_PERIOD_MICROS = 25000;
+
+// Conversions further apart than this are too far apart to be compared for spikes,
+// so we start the median over
+unsigned long SCALE_MEDIAN_MAX_GAP_MICROS = 10000;
+
+int32_t medianReadings[SCALE_MEDIAN_WINDOW];
+int medianReadingIndex = 0;
+int medianReadingCount = 0;
+unsigned long lastMedianReadingMicros = 0;
+
+int64_t decimationSum = 0;
+int decimationCount = 0;
+
+// When the last filtered reading came out
+unsigned long lastFilteredReadingMicros = 0;
+
+int32_t medianOfRecentReadings() {
+  int32_t sorted[SCALE_MEDIAN_WINDOW];
+
+  // insertion sort is plenty for a handful of values
+  for (int i = 0; i < medianReadingCount; i++) {
+    int32_t value = medianReadings[i];
+    int j = i - 1;
+    while (j >= 0 && sorted[j] > value) {
+      sorted[j + 1] = sorted[j];
+      j--;
+    }
+    sorted[j + 1] = value;
+  }
+
+  return sorted[medianReadingCount / 2];
+}
+
+// Runs a raw conversion through the median stage, and returns the median.  Calibration
+// takes its conversions from here too, so a spike can't throw the calibration factor off.
+int32_t despikeScaleReading(int32_t reading, unsigned long readingMicros) {
+  if (!SCALE_HIGH_RATE_MODE) {
+    return reading;
+  }
+
+  if (readingMicros - lastMedianReadingMicros > SCALE_MEDIAN_MAX_GAP_MICROS) {
+    medianReadingIndex = 0;
+    medianReadingCount = 0;
+  }
+  lastMedianReadingMicros = readingMicros;
+
+  medianReadings[medianReadingIndex] = reading;
+  medianReadingIndex = (medianReadingIndex + 1) % SCALE_MEDIAN_WINDOW;
+  if (medianReadingCount < SCALE_MEDIAN_WINDOW) {
+    medianReadingCount += 1;
+  }
+
+  return medianOfRecentReadings();
+}
+
+// Runs a despiked conversion through the decimation stage. Returns true when
+// a new filtered reading comes out the other end.
+boolean decimateScaleReading(int32_t reading, unsigned long readingMicros, int32_t *filteredReading) {
+  if (!SCALE_HIGH_RATE_MODE) {
+    *filteredReading = reading;
+    return true;
+  }
+
+  decimationSum += reading;
+  decimationCount += 1;
+
+  // Half a conversion early, so 8 conversions at 320 SPS make the cut
+  if ((readingMicros - lastFilteredReadingMicros) < SCALE_FILTERED_PERIOD_MICROS - 1500) {
+    return false;
+  }
+  lastFilteredReadingMicros = readingMicros;
+
+  *filteredReading = decimationSum / decimationCount;
+
+  decimationSum = 0;
+  decimationCount = 0;
+
+  return true;
+}
+
+// Rather than spinning inside the NAU7802 library while it averages 20
+// conversions (~500ms at 40 SPS), we pick up each conversion as soon as it
+// is ready and keep a sliding average (scaleState.avgWeights) over the most recent
+// scaleWindowSize of them.  This means scaleState.measuredWeight is
+// refreshed every conversion and the main loop is never held up by the scale.
+//
+// Both modes give us 40 filtered readings a second, so these are in 25ms steps.
+//
+// While brewing we want to see changes in weight quickly..
+int BREWING_SCALE_WINDOW_SIZE = 4;
+// While measuring beans, a tenth of a gram matters more than how long it takes
+int MEASURE_BEANS_SCALE_WINDOW_SIZE = SCALE_SAMPLE_SIZE;
+// Everything else
+int DEFAULT_SCALE_WINDOW_SIZE = 12;
+
+// How many readings we average.  Never more than SCALE_SAMPLE_SIZE
+int scaleWindowSize = DEFAULT_SCALE_WINDOW_SIZE;
+
+int scaleWindowCount = 0;
+float scaleWindowSum = 0.0;
+
+void restartScaleWindow() {
+  scaleState.avgWeightIndex = 0;
+  scaleWindowCount = 0;
+  scaleWindowSum = 0.0;
+}
+
+// Throw away everything in the window.  Needed whenever the NAU7802's own
+// offset register changes, as older readings are no longer comparable.
+void resetScaleReadings() {
+  restartScaleWindow();
+
+  medianReadingIndex = 0;
+  medianReadingCount = 0;
+
+  decimationSum = 0;
+  decimationCount = 0;
+}
+
+void addScaleWeight(float weight) {
+  if (scaleWindowCount == scaleWindowSize) {
+    // window is full, so the oldest weight falls out of the sum
+    scaleWindowSum -= scaleState.avgWeights[scaleState.avgWeightIndex];
+  } else {
+    scaleWindowCount += 1;
+  }
+
+  scaleState.avgWeights[scaleState.avgWeightIndex] = weight;
+  scaleWindowSum += weight;
+
+  scaleState.avgWeightIndex = (scaleState.avgWeightIndex + 1) % scaleWindowSize;
+
+  // Adding and subtracting forever slowly accumulates rounding error, so every
+  // time around the window we start the sum over.
+  if (scaleState.avgWeightIndex == 0 && scaleWindowCount == scaleWindowSize) {
+    scaleWindowSum = 0.0;
+    for (int i = 0; i < scaleWindowCount; i++) {
+      scaleWindowSum += scaleState.avgWeights[i];
+    }
+  }
+}
+
+// Keeps the most recent weights that fit in the new window
+void setScaleWindowSize(int windowSize) {
+  windowSize = constrain(windowSize, 1, SCALE_SAMPLE_SIZE);
+  if (windowSize == scaleWindowSize) {
+    return;
+  }
+
+  int keepCount = min(scaleWindowCount, windowSize);
+
+  // oldest first
+  float keptWeights[SCALE_SAMPLE_SIZE];
+  for (int i = 0; i < keepCount; i++) {
+    int index = (scaleState.avgWeightIndex - keepCount + i + scaleWindowSize) % scaleWindowSize;
+    keptWeights[i] = scaleState.avgWeights[index];
+  }
+
+  scaleWindowSize = windowSize;
+  scaleState.avgWeightIndex = 0;
+  scaleWindowCount = 0;
+  scaleWindowSum = 0.0;
+
+  for (int i = 0; i < keepCount; i++) {
+    addScaleWeight(keptWeights[i]);
+  }
+}
+
+void configureScale(int gaggiaState) {
+  if (gaggiaState == BREWING || gaggiaState == PREINFUSION) {
+    setScaleWindowSize(BREWING_SCALE_WINDOW_SIZE);
+  } else if (gaggiaState == MEASURE_BEANS) {
+    setScaleWindowSize(MEASURE_BEANS_SCALE_WINDOW_SIZE);
+  } else {
+    setScaleWindowSize(DEFAULT_SCALE_WINDOW_SIZE);
+  }
+}
+
+float readingToGrams(int32_t reading) {
+  return (reading - myScale.getZeroOffset()) / myScale.getCalibrationFactor();
+}
+
+// Average of the window.. this can be negative
+float averageWeight() {
+  return scaleWindowSum / scaleWindowCount;
+}
+
+// When the calibration factor changes, everything in the window is in the
+// old units.  Grams are proportional to the calibration factor, so we can
+// just rescale rather than throw the window away.
+void rescaleScaleWindow(float previousCalibrationFactor) {
+  float ratio = previousCalibrationFactor / myScale.getCalibrationFactor();
+
+  for (int i = 0; i < scaleWindowCount; i++) {
+    scaleState.avgWeights[i] *= ratio;
+  }
+  scaleWindowSum *= ratio;
+}
+
+// The I2C clock the NAU7802 can handle.  We'll get this unless something slower
+// shares the bus (see requestI2CClock())
+uint32_t SCALE_MAX_I2C_CLOCK_HZ = 400000;
+
+// Time between conversions at our sample rate, and when we last got one
+unsigned long scaleConversionPeriodMicros = 0;
+unsigned long lastConversionMicros = 0;
+
+// How hard we are working the I2C bus to read the scale.. these are totals since boot
+int getScaleI2CTransactionCount() {
+  return myScale.getTransactionCount();
+}
+
+int getScaleI2CBusMicros() {
+  return myScale.getBusTimeMicros();
+}
+
+// Calibration used to block for ~1.6 seconds while the library averaged 64
+// conversions.  Now we collect those same conversions as they arrive in
+// readScaleState() (after the median, so spikes are already gone) and only swap
+// in the new calibration factor once we have all of them.
+int SCALE_CALIBRATION_SAMPLES = 64;
+
+// If the scale stops giving us conversions, we give up rather than
+// calibrating forever
+unsigned long SCALE_CALIBRATION_TIMEOUT_MILLIS = 3000;
+
+int64_t calibrationReadingSum = 0;
+int calibrationReadingCount = 0;
+int calibrationReferenceWeight = 0;
+unsigned long calibrationStartTimeMillis = 0;
+
+// If the zero drifts by more than this while the scale is meant to be empty, we re-zero
+float ZERO_DRIFT_THRESHOLD_GRAMS = 0.5;
+
+// If the reference cup reads more than this far off, we recalibrate
+float CALIBRATION_TOLERANCE_GRAMS = 1.0;
+
+// The load cell's gain shifts as it warms up.. if the boiler is this much warmer or
+// cooler than when we last calibrated, we recalibrate even if the cup reads right.
+float CALIBRATION_TEMP_THRESHOLD_C = 30.0;
+
+// false until we've either loaded or measured a calibration factor
+boolean hasScaleCalibration = false;
+
+float calibrationTempC = 0.0;
+float calibrationStartTempC = 0.0;
+
+void storeScaleCalibration() {
+  ScaleCalibrationStorage scaleCalibrationStorage;
+
+  scaleCalibrationStorage.zeroOffset = myScale.getChannel1Offset();
+  scaleCalibrationStorage.calibrationFactor = myScale.getCalibrationFactor();
+  scaleCalibrationStorage.calibrationTempC = calibrationTempC;
+
+  saveScaleCalibration(scaleCalibrationStorage);
+}
+
+void finishScaleCalibration() {
+  int32_t averageReading = calibrationReadingSum / calibrationReadingCount;
+
+  // This is what NAU7802::calculateCalibrationFactor() does
+  float newCalibrationFactor = 
+    ((float)(averageReading - myScale.getZeroOffset())) / calibrationReferenceWeight;
+
+  float previousCalibrationFactor = myScale.getCalibrationFactor();
+
+  // Now that this is done, we can make 'getWeight() in grams' calls on the scale instead of
+  // unitless getReading() calls!
+  myScale.setCalibrationFactor(newCalibrationFactor);
+
+  scaleState.calibrationProgress = -1;
+  hasScaleCalibration = true;
+  calibrationTempC = calibrationStartTempC;
+
+  storeScaleCalibration();
+
+  // We can immediately re-express the window in the new units rather than waiting
+  // for the next conversion.
+  if (scaleWindowCount > 0) {
+    rescaleScaleWindow(previousCalibrationFactor);
+
+    scaleState.measuredWeight = max(averageWeight(), 0.0f);
+  }
+
+  // Same goes for the tare, which was most likely taken while we were calibrating
+  scaleState.tareWeight *= previousCalibrationFactor / newCalibrationFactor;
+
+  // the units just changed under the estimator
+  resetFlowEstimate();
+}
+
+void addCalibrationReading(int32_t reading) {
+  calibrationReadingSum += reading;
+  calibrationReadingCount += 1;
+
+  scaleState.calibrationProgress = (calibrationReadingCount * 100) / SCALE_CALIBRATION_SAMPLES;
+
+  if (calibrationReadingCount >= SCALE_CALIBRATION_SAMPLES) {
+    finishScaleCalibration();
+  }
+}
+
+boolean isScaleCalibrating() {
+  return scaleState.calibrationProgress >= 0;
+}
+
 // This assumes the scale has been properly zero'd and calibrated using
 // below functions.
-// At 40 SPS, 20 Samples means it takes about 500ms to take this reading.
+// This never blocks: if no new conversion is ready, we keep the last weight.
 void readScaleState() {
+
+  if (isScaleCalibrating() && 
+      (millis() - calibrationStartTimeMillis) > SCALE_CALIBRATION_TIMEOUT_MILLIS) {
+    Log.error("Scale calibration timed out!");
+
+    // we keep the previous calibration factor, and so the tare is still good
+    scaleState.calibrationProgress = -1;
+  }
+
+  int32_t reading;
+
+#ifdef SCALE_DATA_READY_PIN
+  if (digitalRead(SCALE_DATA_READY_PIN) == LOW) {
+    return;
+  }
+  reading = myScale.getReading();
+#else
+  // No point asking before the next conversion could possibly be done.. this keeps
+  // a fast main loop from flooding the I2C bus.
+  if ((micros() - lastConversionMicros) < scaleConversionPeriodMicros * 9 / 10) {
+    return;
+  }
+
   // sometime the scale is not available so don't update.
-  if (myScale.available() == true) {
-    // don't allow negative values, tell scale to average values over 20 sample periods...
-    scaleState.measuredWeight = myScale.getWeight(false, 20); 
+  if (!myScale.getReadingIfAvailable(&reading)) {
+    return;
   }
+  lastConversionMicros = micros();
+#endif
+
+  unsigned long readingMicros = micros();
+
+  reading = despikeScaleReading(reading, readingMicros);
+
+  if (isScaleCalibrating()) {
+    addCalibrationReading(reading);
+  }
+
+  int32_t filteredReading;
+  if (!decimateScaleReading(reading, readingMicros, &filteredReading)) {
+    return;
+  }
+
+  float filteredWeight = readingToGrams(filteredReading);
+
+  // The window is meant to span scaleWindowSize filtered readings 25ms apart.  If the
+  // loop has been away longer than that (e.g. test mode), what's in it is too old to
+  // average with.
+  if ((millis() - scaleState.lastSampleTimeMillis) * 1000 > scaleWindowSize * SCALE_FILTERED_PERIOD_MICROS) {
+    restartScaleWindow();
+  }
+
+  addScaleWeight(filteredWeight);
+
+  // don't allow negative values
+  scaleState.measuredWeight = max(averageWeight(), 0.0f);
+  scaleState.lastSampleTimeMillis = millis();
+
+  // Unlike measuredWeight, this can go negative.. it's only meaningful while the scale
+  // is meant to be empty.
+  scaleState.zeroDriftGrams = averageWeight();
+
+  // The flow estimator does its own smoothing, so it gets each filtered reading
+  // rather than the windowed average.
+  updateFlowEstimate(filteredWeight, scaleState.lastSampleTimeMillis);
 }
 
-// This assumes the reference weight is on the scale 
-// With current settings this is blocking at takes about 1.6 seconds. (40 SPS/64 samples)
-void calibrateScale()
+// This assumes the reference weight is on the scale.
+// Returns right away.. scaleState.calibrationProgress tracks how far along we are.
+void beginScaleCalibration()
 {
-  int referenceCupWeight = loadSettings().referenceCupWeight;  
+  calibrationReferenceWeight = loadSettings().referenceCupWeight;
+  if (calibrationReferenceWeight <= 0) {
+    Log.error("No reference cup weight, so can't calibrate scale!");
+    return;
+  }
 
-  // Tell the library how much weight is currently on it
-  // We are sampling slowly, so we need to increase the timeout too
-  myScale.calculateCalibrationFactor(referenceCupWeight, 64, 3000); //64 samples at 40SPS. Use a timeout of 3 seconds
+  calibrationReadingSum = 0;
+  calibrationReadingCount = 0;
+  calibrationStartTimeMillis = millis();
+  calibrationStartTempC = heaterState.measuredTemp;
 
-  // Now that this is done, we can make 'getWeight() in grams' calls on the scale instead of
-  // unitless getReading() calls! 
+  scaleState.calibrationProgress = 0;
+}
+
+// This assumes the reference cup is on the scale.  Calibrating used to happen every time
+// we left PREHEAT, now we only do it if the reference cup reads wrong, or the
+// load cell has probably changed temperature.
+void calibrateScaleIfNecessary() {
+  float referenceCupWeight = loadSettings().referenceCupWeight;
+
+  float calibrationErrorGrams = fabsf(scaleState.measuredWeight - referenceCupWeight);
+  float tempChangeC = fabsf(heaterState.measuredTemp - calibrationTempC);
+
+  if (!hasScaleCalibration ||
+      calibrationErrorGrams > CALIBRATION_TOLERANCE_GRAMS ||
+      tempChangeC > CALIBRATION_TEMP_THRESHOLD_C) {
+
+    GAGGIA_LOG_INFO("scale", "recalibrating, error: %.2f, tempChange: %.2f", 
+                    calibrationErrorGrams, tempChangeC);
+    beginScaleCalibration();
+  }
+}
+
+void tareScale() {
+  scaleState.tareWeight = scaleState.measuredWeight;
 }
 
 void zeroScale() {
   //Perform an external offset - this sets the NAU7802's internal offset register
   myScale.calibrateAFE(NAU7802_CALMOD_OFFSET); //Calibrate using external offset
+
+  resetScaleReadings();
+  resetFlowEstimate();
+
+  scaleState.zeroDriftGrams = 0.0;
+
+  storeScaleCalibration();
+}
+
+// This assumes nothing is on the scale.  Zeroing blocks for ~350ms while the NAU7802
+// recalibrates its offset, so we only do it when the zero has actually moved.
+void zeroScaleIfNecessary() {
+
+  // No readings yet, so we have no idea where zero is
+  if (scaleWindowCount == 0 || fabsf(scaleState.zeroDriftGrams) > ZERO_DRIFT_THRESHOLD_GRAMS) {
+    GAGGIA_LOG_INFO("scale", "re-zeroing, drift: %.2f", scaleState.zeroDriftGrams);
+    zeroScale();
+  }
 }
 
 // This assumes nothing is currently on the scale
 void scaleInit() {
+  requestI2CClock(SCALE_MAX_I2C_CLOCK_HZ);
+
   // Scale check
   if (myScale.begin() == false)
   {
     Log.error("Scale not detected!");
   }
 
-  myScale.setSampleRate(NAU7802_SPS_40); //Set sample rate: 10, 20, 40, 80 or 320
+  if (SCALE_HIGH_RATE_MODE) {
+    myScale.setSampleRate(NAU7802_SPS_320);
+    scaleConversionPeriodMicros = 1000000 / 320;
+  } else {
+    myScale.setSampleRate(NAU7802_SPS_40); //Set sample rate: 10, 20, 40, 80 or 320
+    scaleConversionPeriodMicros = 1000000 / 40;
+  }
   myScale.setGain(NAU7802_GAIN_16); //Gain can be set to 1, 2, 4, 8, 16, 32, 64, or 128.
   myScale.setLDO(NAU7802_LDO_3V0); //Set LDO (AVDD) voltage. 3.0V is the best choice for Qwiic
 
-  myScale.setCalibrationFactor(1.0);
-  myScale.setChannel1Offset(0);
-}
\ No newline at end of file
+  // The library recommends re-calibrating the analog front end whenever gain or
+  // sample rate change
+  myScale.calibrateAFE();
+
+  // Pick up where we left off.  The background drift checks will tell us
+  // if this is no longer right.
+  ScaleCalibrationStorage scaleCalibrationStorage;
+  if (loadScaleCalibration(&scaleCalibrationStorage)) {
+    myScale.setCalibrationFactor(scaleCalibrationStorage.calibrationFactor);
+    myScale.setChannel1Offset(scaleCalibrationStorage.zeroOffset);
+    calibrationTempC = scaleCalibrationStorage.calibrationTempC;
+    hasScaleCalibration = true;
+  } else {
+    myScale.setCalibrationFactor(1.0);
+    myScale.setChannel1Offset(0);
+  }
+
+  myScale.resetBusStats();
+  Particle.variable("scaleI2CTransactions", getScaleI2CTransactionCount);
+  Particle.variable("scaleI2CBusMicros", getScaleI2CBusMicros);
+
+#ifdef SCALE_DATA_READY_PIN
+  // DRDY is active high by default
+  myScale.setIntPolarityHigh();
+  pinMode(SCALE_DATA_READY_PIN, INPUT_PULLDOWN);
+#endif
+}
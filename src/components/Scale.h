@@ -5,36 +5,72 @@
 #include "Scale.h"
 #include "WaterPump.h"
 #include "Network.h"
+#include "FlowEstimator.h"
 
-#define SCALE_SAMPLE_SIZE 20 
+// Most filtered readings we'll ever average (see configureScale())
+#define SCALE_SAMPLE_SIZE 32 
 
 extern int PREINFUSION_WEIGHT_THRESHOLD_GRAMS;
 
 struct ScaleState {
 
-  // The current weight measurement is a sliding average
-  double avgWeights[SCALE_SAMPLE_SIZE];
+  // The current weight measurement is a sliding average of the most recent
+  // filtered readings, in grams.  How many depends on the state we're in.
+  float avgWeights[SCALE_SAMPLE_SIZE];
   byte avgWeightIndex = 0;
 
-  double measuredWeight = 0.0;
+  float measuredWeight = 0.0;
+
+  // when measuredWeight last picked up a new conversion from the NAU7802
+  unsigned long lastSampleTimeMillis = 0;
 
   // this will be the measuredWeight - tareWeight * BREW_WEIGHT_TO_BEAN_RATIO
   // at the moment this value is recorded...
-  double targetWeight = 0; 
+  float targetWeight = 0; 
 
   // recorded weight of cup meant be used when
   // measuring the weight of beans or brew  
-  double tareWeight = 0;
+  float tareWeight = 0;
+
+  // How far from zero the scale reads, in grams, including negative values.
+  // Only meaningful while the scale is meant to be empty.
+  float zeroDriftGrams = 0.0;
+
+  // 0-100 while we are calibrating in the background, otherwise -1
+  int calibrationProgress = -1;
 };
 
 extern ScaleState scaleState;
 
 void scaleInit();
 
+// Picks how long a window we average weight over, depending on whether we
+// care more about responsiveness or precision in this state.
+void configureScale(int gaggiaState);
+
 void zeroScale();
 
-void calibrateScale();
+// Re-zeros only if the empty scale has drifted
+void zeroScaleIfNecessary();
+
+// Starts calibrating against the reference cup, which must be on the scale.
+// This doesn't block; the new calibration factor is used once enough
+// readings have come in through readScaleState().
+void beginScaleCalibration();
+
+// Checks the reference cup against our calibration and only starts calibrating
+// if it reads wrong or the load cell has changed temperature
+void calibrateScaleIfNecessary();
+
+boolean isScaleCalibrating();
+
+// Records the current weight as the tare weight, right away.. the next thing on the
+// scale may be the beans.  If we are in the middle of calibrating, the tare is
+// rescaled to the new calibration factor when it's done.
+void tareScale();
 
+// Never blocks.  Picks up the latest conversion, if one is ready, and
+// updates measuredWeight.
 void readScaleState();
 
 #endif
\ No newline at end of file
@@ -1,14 +1,55 @@
 #include "Settings.h"
 
+// A reasonable guess until we've learned from a few shots
+int DEFAULT_DRIP_LAG_MILLIS = 1500;
+
+// A drip lag longer than this is something other than drips (e.g. a hand on the
+// drip tray), so we never learn or store one (see ShotCutoff).
+int MAX_DRIP_LAG_MILLIS = 5000;
+
+// Settings as they were stored at LEGACY_SETTINGS_EEPROM_ADDRESS.  The low byte of
+// the version was overwritten by the total brew count every shot, but the rest
+// of the version is still zero if settings were ever saved there (erased EEPROM
+// is 0xFF).  The drip lag only came in with version 2, so we only keep it if it
+// looks like one we learned.
+boolean loadLegacySettings(SettingsStorage *settingsStorage) {
+    EEPROM.get(LEGACY_SETTINGS_EEPROM_ADDRESS, *settingsStorage);
+
+    if ((settingsStorage->version & 0xFFFFFF00) != 0) {
+        return false;
+    }
+
+    settingsStorage->version = 2;
+    if (settingsStorage->dripLagMillis < 0 || settingsStorage->dripLagMillis > MAX_DRIP_LAG_MILLIS) {
+        settingsStorage->dripLagMillis = DEFAULT_DRIP_LAG_MILLIS;
+    }
+
+    return true;
+}
+
 // Refresh our local working copy of Settings 
 SettingsStorage loadSettings() {
     SettingsStorage settingsStorage;    
 
     EEPROM.get(SETTINGS_EEPROM_ADDRESS, settingsStorage);
+
+    // Never saved since settings moved.. bring the old ones over, once
+    if (settingsStorage.version != 1 && settingsStorage.version != 2 && 
+        loadLegacySettings(&settingsStorage)) {
+        GAGGIA_LOG_INFO("settings", "moved settings from %d to %d", 
+                        LEGACY_SETTINGS_EEPROM_ADDRESS, SETTINGS_EEPROM_ADDRESS);
+        saveSettings(settingsStorage);
+    }
     
+    // version 1 didn't have dripLagMillis, but everything else is still good
+    if (settingsStorage.version == 1) {
+        settingsStorage.version = 2;
+        settingsStorage.dripLagMillis = DEFAULT_DRIP_LAG_MILLIS;
+    }
+
     // the very first value will be garbage and we have to initialize it..
-    if (settingsStorage.version != 1) {
-        SettingsStorage defaultStorage = { 1, 104, 3};
+    if (settingsStorage.version != 2) {
+        SettingsStorage defaultStorage = { 2, 104, 3, DEFAULT_DRIP_LAG_MILLIS};
         settingsStorage = defaultStorage;
     }
     
@@ -19,17 +60,29 @@ void saveSettings(SettingsStorage settingsStorage) {
     EEPROM.put(SETTINGS_EEPROM_ADDRESS, settingsStorage);
 }
 
+boolean loadScaleCalibration(ScaleCalibrationStorage *scaleCalibrationStorage) {
+    EEPROM.get(SCALE_CALIBRATION_EEPROM_ADDRESS, *scaleCalibrationStorage);
+
+    // the very first value will be garbage
+    return scaleCalibrationStorage->version == 1;
+}
+
+void saveScaleCalibration(ScaleCalibrationStorage scaleCalibrationStorage) {
+    scaleCalibrationStorage.version = 1;
+    EEPROM.put(SCALE_CALIBRATION_EEPROM_ADDRESS, scaleCalibrationStorage);
+}
+
 int setReferenceCupWeight(String _referenceCupWeight) {
-  Log.error("setting new weight:" + String(_referenceCupWeight));
+  GAGGIA_LOG_ERROR("settings", "setting new weight: %s", _referenceCupWeight.c_str());
   
   SettingsStorage settingsStorage = loadSettings();
 
   settingsStorage.referenceCupWeight = _referenceCupWeight.toInt();
-  Log.error("new weight:" + String(settingsStorage.referenceCupWeight));
+  GAGGIA_LOG_ERROR("settings", "new weight: %d", settingsStorage.referenceCupWeight);
   
   saveSettings(settingsStorage);
 
-  Log.error("stored weight:" + String(loadSettings().referenceCupWeight));
+  GAGGIA_LOG_ERROR("settings", "stored weight: %d", loadSettings().referenceCupWeight);
 
   return 1;
 }
@@ -52,6 +105,10 @@ int getWeightToBeanRatio() {
   return loadSettings().weightToBeanRatio;
 }
 
+int getDripLagMillis() {
+  return loadSettings().dripLagMillis;
+}
+
 // This assumes nothing is currently on the scale
 void settingsInit() {
   Particle.variable("referenceCupWeight", getReferenceCupWeight); 
@@ -59,4 +116,6 @@ void settingsInit() {
 
   Particle.variable("weightToBeanRatio", getWeightToBeanRatio); 
   Particle.function("setWeightToBeanRatio", setWeightToBeanRatio);
+
+  Particle.variable("dripLagMillis", getDripLagMillis); 
 }
\ No newline at end of file
@@ -9,10 +9,37 @@ struct SettingsStorage {
   int version;
   int referenceCupWeight;
   int weightToBeanRatio;
+
+  // How long the shot keeps dripping into the cup once the pump stops,
+  // expressed as milliseconds of the flow at cutoff.  This is learned
+  // after each shot (see ShotCutoff)
+  int dripLagMillis;
 };
 
+extern int MAX_DRIP_LAG_MILLIS;
+
 SettingsStorage loadSettings();
 
 void saveSettings(SettingsStorage _settingsStorage);
 
+// What we learned the last time we zero'd and calibrated the scale, so we
+// don't have to do it again every time we start up.
+struct ScaleCalibrationStorage {
+  int version;
+
+  // NAU7802 channel 1 offset register, as set by zeroing the scale
+  int32_t zeroOffset;
+
+  float calibrationFactor;
+
+  // boiler temp when calibrationFactor was measured.  The load cell sits right
+  // under the group head so this is the best hint we have that it has warmed up.
+  float calibrationTempC;
+};
+
+// Returns false if we've never stored a calibration
+boolean loadScaleCalibration(ScaleCalibrationStorage *scaleCalibrationStorage);
+
+void saveScaleCalibration(ScaleCalibrationStorage scaleCalibrationStorage);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,107 @@
+#include "ShotCutoff.h"
+#include "State.h"
+
+ShotCutoffState shotCutoffState;
+
+// How long after we stop the pump before we consider the cup weight final
+int DRIP_SETTLE_TIME_SECONDS = 5;
+
+// How much of each new observation we blend into the drip model.  Small enough
+// that one odd shot (e.g. cup bumped) doesn't throw it off.
+float DRIP_LEARNING_RATE = 0.3;
+
+// Below this flow at cutoff, the drip is all noise and there's nothing to learn.
+float MIN_LEARNING_FLOW_RATE_GPS = 0.5;
+
+// The cup only gains weight once the pump stops.  If it falls by more than this
+// (more than the scale's noise) it was lifted or bumped while we were waiting.
+float DRIP_MAX_WEIGHT_FALL_GRAMS = 1.0;
+
+float extractedWeight() {
+  return scaleState.measuredWeight - scaleState.tareWeight;
+}
+
+// Once the pump stops, the cup keeps gaining weight: water still in the puck and
+// the scale catching up with what has already landed.  We model that as
+// 'flow at cutoff * drip lag' and stop the pump that much early.
+boolean shouldStopBrewing() {
+
+  float flowRateGPS = max(flowEstimatorState.flowRateGPS, 0.0f);
+
+  float expectedDripGrams = flowRateGPS * (shotCutoffState.dripLagMillis / 1000.0f);
+
+  return (extractedWeight() + expectedDripGrams) >= scaleState.targetWeight;
+}
+
+void prepareShotCutoff() {
+  // so we aren't reading EEPROM every loop while brewing
+  shotCutoffState.dripLagMillis = loadSettings().dripLagMillis;
+}
+
+void recordShotCutoff() {
+  shotCutoffState.cutoffWeight = extractedWeight();
+  shotCutoffState.cutoffFlowRateGPS = flowEstimatorState.flowRateGPS;
+  shotCutoffState.cutoffMillis = millis();
+  shotCutoffState.yieldWeight = shotCutoffState.cutoffWeight;
+  shotCutoffState.peakWeight = shotCutoffState.cutoffWeight;
+  shotCutoffState.waitingToLearn = true;
+}
+
+void learnFromSettledShotIfNecessary() {
+  if (!shotCutoffState.waitingToLearn) {
+    return;
+  }
+
+  shotCutoffState.peakWeight = max(shotCutoffState.peakWeight, extractedWeight());
+
+  if ((millis() - currentGaggiaState->stateEnterTimeMillis) < DRIP_SETTLE_TIME_SECONDS * 1000UL) {
+    return;
+  }
+  shotCutoffState.waitingToLearn = false;
+
+  float settledWeight = extractedWeight();
+
+  GAGGIA_LOG_INFO("shotCutoff", "target: %.2f, settled: %.2f, overshoot: %.2f", 
+                  scaleState.targetWeight, 
+                  settledWeight, 
+                  settledWeight - scaleState.targetWeight);
+
+  // The cup was taken away (or emptied) before it settled
+  if (settledWeight < shotCutoffState.cutoffWeight) {
+    GAGGIA_LOG_INFO("shotCutoff", "weight fell since cutoff, not learning");
+    return;
+  }
+
+  // .. or lifted and put back, or knocked
+  if (shotCutoffState.peakWeight - settledWeight > DRIP_MAX_WEIGHT_FALL_GRAMS) {
+    GAGGIA_LOG_INFO("shotCutoff", "cup moved while settling (peak: %.2f), not learning", 
+                    shotCutoffState.peakWeight);
+    return;
+  }
+
+  if (shotCutoffState.cutoffFlowRateGPS < MIN_LEARNING_FLOW_RATE_GPS) {
+    // Nothing to learn, but it's still what's in the cup
+    shotCutoffState.yieldWeight = settledWeight;
+    return;
+  }
+
+  float observedDripLagMillis = 
+    (settledWeight - shotCutoffState.cutoffWeight) / shotCutoffState.cutoffFlowRateGPS * 1000.0f;
+
+  // Something other than drips landed on the scale
+  if (observedDripLagMillis > MAX_DRIP_LAG_MILLIS) {
+    GAGGIA_LOG_INFO("shotCutoff", "implausible drip lag: %.0f, not learning", observedDripLagMillis);
+    return;
+  }
+
+  shotCutoffState.yieldWeight = settledWeight;
+
+  SettingsStorage settingsStorage = loadSettings();
+
+  float newDripLagMillis = settingsStorage.dripLagMillis + 
+    DRIP_LEARNING_RATE * (observedDripLagMillis - settingsStorage.dripLagMillis);
+
+  settingsStorage.dripLagMillis = constrain((int)newDripLagMillis, 0, MAX_DRIP_LAG_MILLIS);
+
+  saveSettings(settingsStorage);
+}
@@ -0,0 +1,46 @@
+#ifndef SHOT_CUTOFF_H
+#define SHOT_CUTOFF_H
+
+#include "Common.h"
+
+// Decides when to stop the pump so the cup ends up at the target weight
+// once the group head has stopped dripping, and learns how much it drips.
+struct ShotCutoffState {
+
+  // extracted weight and flow at the moment we stopped the pump
+  float cutoffWeight = 0.0;
+  float cutoffFlowRateGPS = 0.0;
+  unsigned long cutoffMillis = 0;
+
+  // What ended up in the cup.. the weight at cutoff until the cup has settled,
+  // then the settled weight (unless the cup was moved in the meantime)
+  float yieldWeight = 0.0;
+
+  // heaviest the cup has been since we stopped the pump
+  float peakWeight = 0.0;
+
+  // true between stopping the pump and learning from the settled weight
+  boolean waitingToLearn = false;
+
+  // working copy of the learned drip model in Settings
+  int dripLagMillis = 0;
+};
+
+extern ShotCutoffState shotCutoffState;
+
+// Call as we enter BREWING
+void prepareShotCutoff();
+
+// Call while BREWING. True once the weight we expect to end up with
+// reaches the target weight.
+boolean shouldStopBrewing();
+
+// Call as we enter DONE_BREWING
+void recordShotCutoff();
+
+// Call while in DONE_BREWING.  Once the cup has settled, compares the final
+// weight with what we predicted and adjusts the drip model.. unless the cup
+// was moved in the meantime.
+void learnFromSettledShotIfNecessary();
+
+#endif
@@ -0,0 +1,612 @@
+#include "ShotHistory.h"
+#include "Settings.h"
+#include "Scale.h"
+#include "ShotCutoff.h"
+#include "Bluetooth.h"
+#include "Varint.h"
+
+#include <stddef.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <stdio.h>
+
+ShotHistoryState shotHistoryState;
+
+// Where it all lives on the flash file system.. the host tests point this 
+// somewhere else.
+const char *SHOT_HISTORY_DIRECTORY = "/shots";
+
+#define SHOT_HISTORY_INDEX_NAME "index.log"
+#define SHOT_HISTORY_INDEX_TEMP_NAME "index.tmp"
+
+#define SHOT_HISTORY_MAX_PATH 64
+
+// 'GSH1'.. first thing in every shot file
+#define SHOT_FILE_MAGIC 0x31485347
+#define SHOT_FILE_COLUMN_COUNT 6
+#define SHOT_FILE_HEADER_BYTES (8 + 2 * SHOT_FILE_COLUMN_COUNT)
+
+// The file system has about 2MB to share with everything else.  A 30 second
+// shot is about 5K, so we'll run out of shots before we run out of this.
+uint32_t SHOT_HISTORY_MAX_BYTES = 512 * 1024;
+
+// Anything shorter than this was abandoned, not worth keeping
+int SHOT_HISTORY_MIN_SAMPLES = 2 * SHOT_RECORDER_SAMPLE_HZ;
+
+// Once the index log has this many records in it (mostly adds and removes
+// cancelling each other out), we write out a fresh copy.
+int SHOT_HISTORY_COMPACT_RECORD_COUNT = 4 * SHOT_HISTORY_MAX_SHOTS;
+
+// BLE can't keep up with the serial port, so we space out notifications
+unsigned long SHOT_HISTORY_BLE_INTERVAL_MILLIS = 20;
+unsigned long nextShotHistoryListMillis = 0;
+
+int SHOT_HISTORY_SERIAL_LINES_PER_LOOP = 10;
+
+uint8_t shotHistoryChecksum(const ShotHistoryRecord *record) {
+  const uint8_t *bytes = (const uint8_t *) record;
+
+  // Starting somewhere other than zero means a record of all zeros is bad
+  uint8_t checksum = 0xA5;
+  for (size_t i = 0; i < sizeof(ShotHistoryRecord); i++) {
+    if (i != offsetof(ShotHistoryRecord, checksum)) {
+      checksum += bytes[i];
+    }
+  }
+
+  return checksum;
+}
+
+void shotHistoryPath(const char *name, char *path, size_t pathSize) {
+  snprintf(path, pathSize, "%s/%s", SHOT_HISTORY_DIRECTORY, name);
+}
+
+void shotFilePath(uint32_t id, char *path, size_t pathSize) {
+  snprintf(path, pathSize, "%s/%lu.shot", SHOT_HISTORY_DIRECTORY, (unsigned long) id);
+}
+
+// The columns of a shot file, in the order they're stored
+int32_t shotSampleColumn(const ShotSample *sample, int column) {
+  switch (column) {
+    case 0: return sample->weightDecigrams;
+    case 1: return sample->flowRateCentiGPS;
+    case 2: return sample->pressureCentibars;
+    case 3: return sample->tempDeciC;
+    case 4: return sample->pumpDutyCycle;
+    default: return sample->flags;
+  }
+}
+
+void setShotSampleColumn(ShotSample *sample, int column, int32_t value) {
+  switch (column) {
+    case 0: sample->weightDecigrams = value; break;
+    case 1: sample->flowRateCentiGPS = value; break;
+    case 2: sample->pressureCentibars = value; break;
+    case 3: sample->tempDeciC = value; break;
+    case 4: sample->pumpDutyCycle = value; break;
+    default: sample->flags = value; break;
+  }
+}
+
+// How many bytes a column takes in the shot file
+uint32_t shotColumnBytes(const ShotSample *samples, int sampleCount, int column) {
+  uint32_t length = 0;
+  int32_t previous = 0;
+
+  for (int i = 0; i < sampleCount; i++) {
+    int32_t value = shotSampleColumn(&samples[i], column);
+    length += varintLength(zigzagEncode(value - previous));
+    previous = value;
+  }
+
+  return length;
+}
+
+// Buffers writes, so we're not going to the file system a byte at a time
+struct ShotFileWriter {
+  int fd;
+  uint8_t buffer[128];
+  size_t length = 0;
+  boolean ok = true;
+};
+
+void flushShotFileWriter(ShotFileWriter *writer) {
+  if (writer->length > 0 && write(writer->fd, writer->buffer, writer->length) != (ssize_t) writer->length) {
+    writer->ok = false;
+  }
+  writer->length = 0;
+}
+
+void writeShotFileBytes(ShotFileWriter *writer, const uint8_t *bytes, size_t length) {
+  for (size_t i = 0; i < length; i++) {
+    if (writer->length == sizeof(writer->buffer)) {
+      flushShotFileWriter(writer);
+    }
+    writer->buffer[writer->length++] = bytes[i];
+  }
+}
+
+void writeShotFileUint16(ShotFileWriter *writer, uint16_t value) {
+  uint8_t bytes[2] = { (uint8_t) (value & 0xFF), (uint8_t) (value >> 8) };
+  writeShotFileBytes(writer, bytes, 2);
+}
+
+boolean writeShotFile(uint32_t id, const ShotSample *samples, int sampleCount,
+                      const uint32_t columnBytes[SHOT_FILE_COLUMN_COUNT]) {
+  char path[SHOT_HISTORY_MAX_PATH];
+  shotFilePath(id, path, sizeof(path));
+
+  // If we lost power last time before this made it into the index, there could
+  // be a half written file with this id.. it's no use to anyone, so we write over it.
+  ShotFileWriter writer;
+  writer.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if (writer.fd < 0) {
+    return false;
+  }
+
+  uint8_t header[4] = {
+    SHOT_FILE_MAGIC & 0xFF, (SHOT_FILE_MAGIC >> 8) & 0xFF,
+    (SHOT_FILE_MAGIC >> 16) & 0xFF, (SHOT_FILE_MAGIC >> 24) & 0xFF
+  };
+  writeShotFileBytes(&writer, header, 4);
+  writeShotFileUint16(&writer, sampleCount);
+
+  uint8_t layout[2] = { SHOT_RECORDER_SAMPLE_HZ, SHOT_FILE_COLUMN_COUNT };
+  writeShotFileBytes(&writer, layout, 2);
+
+  for (int column = 0; column < SHOT_FILE_COLUMN_COUNT; column++) {
+    writeShotFileUint16(&writer, columnBytes[column]);
+  }
+
+  for (int column = 0; column < SHOT_FILE_COLUMN_COUNT; column++) {
+    int32_t previous = 0;
+
+    for (int i = 0; i < sampleCount; i++) {
+      int32_t value = shotSampleColumn(&samples[i], column);
+
+      uint8_t varint[VARINT_MAX_BYTES];
+      size_t length = writeVarint(zigzagEncode(value - previous), varint);
+      writeShotFileBytes(&writer, varint, length);
+
+      previous = value;
+    }
+  }
+
+  flushShotFileWriter(&writer);
+
+  if (close(writer.fd) != 0) {
+    writer.ok = false;
+  }
+
+  return writer.ok;
+}
+
+// Buffers reads, the other way round from ShotFileWriter
+struct ShotFileReader {
+  int fd;
+  uint8_t buffer[128];
+  size_t length = 0;
+  size_t position = 0;
+};
+
+// -1 at the end of the file
+int readShotFileByte(ShotFileReader *reader) {
+  if (reader->position == reader->length) {
+    ssize_t length = read(reader->fd, reader->buffer, sizeof(reader->buffer));
+    if (length <= 0) {
+      return -1;
+    }
+    reader->length = length;
+    reader->position = 0;
+  }
+
+  return reader->buffer[reader->position++];
+}
+
+boolean readShotFileVarint(ShotFileReader *reader, uint32_t *value) {
+  *value = 0;
+  for (int i = 0; i < VARINT_MAX_BYTES; i++) {
+    int next = readShotFileByte(reader);
+    if (next < 0) {
+      return false;
+    }
+
+    *value |= (uint32_t) (next & 0x7F) << (7 * i);
+    if ((next & 0x80) == 0) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// Returns how many samples were read, or -1 if the file is missing or bad
+int readShotFile(uint32_t id, ShotSample *samples, int maxSamples) {
+  char path[SHOT_HISTORY_MAX_PATH];
+  shotFilePath(id, path, sizeof(path));
+
+  ShotFileReader reader;
+  reader.fd = open(path, O_RDONLY);
+  if (reader.fd < 0) {
+    return -1;
+  }
+
+  uint8_t header[SHOT_FILE_HEADER_BYTES];
+  for (int i = 0; i < SHOT_FILE_HEADER_BYTES; i++) {
+    int next = readShotFileByte(&reader);
+    if (next < 0) {
+      close(reader.fd);
+      return -1;
+    }
+    header[i] = next;
+  }
+
+  uint32_t magic = header[0] | (header[1] << 8) | (header[2] << 16) | ((uint32_t) header[3] << 24);
+  int sampleCount = header[4] | (header[5] << 8);
+
+  if (magic != SHOT_FILE_MAGIC ||
+      header[6] != SHOT_RECORDER_SAMPLE_HZ ||
+      header[7] != SHOT_FILE_COLUMN_COUNT) {
+    close(reader.fd);
+    return -1;
+  }
+
+  // Columns are stored one after the other, so we have to read all of each
+  // one.. we just don't keep the samples that don't fit.
+  for (int column = 0; column < SHOT_FILE_COLUMN_COUNT; column++) {
+    int32_t value = 0;
+
+    for (int i = 0; i < sampleCount; i++) {
+      uint32_t encoded;
+      if (!readShotFileVarint(&reader, &encoded)) {
+        close(reader.fd);
+        return -1;
+      }
+
+      value += zigzagDecode(encoded);
+      if (i < maxSamples) {
+        setShotSampleColumn(&samples[i], column, value);
+      }
+    }
+  }
+
+  close(reader.fd);
+
+  return min(sampleCount, maxSamples);
+}
+
+// Applies a record from the index log to what we have in RAM
+void applyShotHistoryRecord(const ShotHistoryRecord *record) {
+  if (record->id >= shotHistoryState.nextId) {
+    shotHistoryState.nextId = record->id + 1;
+  }
+
+  if (record->type == SHOT_HISTORY_ADD) {
+    if (shotHistoryState.shotCount == SHOT_HISTORY_MAX_SHOTS) {
+      // Shouldn't happen, we evict before we add.. but if it does, the
+      // oldest is the one to lose.
+      shotHistoryState.totalBytes -= shotHistoryState.shots[0].fileBytes;
+      memmove(&shotHistoryState.shots[0], &shotHistoryState.shots[1],
+              (SHOT_HISTORY_MAX_SHOTS - 1) * sizeof(ShotHistoryRecord));
+      shotHistoryState.shotCount--;
+    }
+
+    shotHistoryState.shots[shotHistoryState.shotCount++] = *record;
+    shotHistoryState.totalBytes += record->fileBytes;
+
+  } else if (record->type == SHOT_HISTORY_REMOVE) {
+    for (int i = 0; i < shotHistoryState.shotCount; i++) {
+      if (shotHistoryState.shots[i].id == record->id) {
+        shotHistoryState.totalBytes -= shotHistoryState.shots[i].fileBytes;
+        memmove(&shotHistoryState.shots[i], &shotHistoryState.shots[i + 1],
+                (shotHistoryState.shotCount - i - 1) * sizeof(ShotHistoryRecord));
+        shotHistoryState.shotCount--;
+        break;
+      }
+    }
+  }
+}
+
+boolean appendShotHistoryRecord(ShotHistoryRecord *record) {
+  record->checksum = shotHistoryChecksum(record);
+
+  char path[SHOT_HISTORY_MAX_PATH];
+  shotHistoryPath(SHOT_HISTORY_INDEX_NAME, path, sizeof(path));
+
+  int fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0666);
+  if (fd < 0) {
+    return false;
+  }
+
+  boolean ok = write(fd, record, sizeof(ShotHistoryRecord)) == sizeof(ShotHistoryRecord);
+  if (close(fd) != 0) {
+    ok = false;
+  }
+
+  if (ok) {
+    shotHistoryState.logRecordCount++;
+  }
+
+  return ok;
+}
+
+// Writes a fresh index log with just the shots we have, then renames it over
+// the old one.. the rename either happens or it doesn't, so there's always a
+// good index on flash.
+void compactShotHistoryIndex() {
+  char path[SHOT_HISTORY_MAX_PATH];
+  char tempPath[SHOT_HISTORY_MAX_PATH];
+  shotHistoryPath(SHOT_HISTORY_INDEX_NAME, path, sizeof(path));
+  shotHistoryPath(SHOT_HISTORY_INDEX_TEMP_NAME, tempPath, sizeof(tempPath));
+
+  int fd = open(tempPath, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if (fd < 0) {
+    GAGGIA_LOG_ERROR("shotHistory", "couldn't compact index");
+    return;
+  }
+
+  boolean ok = true;
+  for (int i = 0; i < shotHistoryState.shotCount; i++) {
+    ShotHistoryRecord *record = &shotHistoryState.shots[i];
+    record->type = SHOT_HISTORY_ADD;
+    record->checksum = shotHistoryChecksum(record);
+
+    if (write(fd, record, sizeof(ShotHistoryRecord)) != sizeof(ShotHistoryRecord)) {
+      ok = false;
+      break;
+    }
+  }
+
+  if (close(fd) != 0) {
+    ok = false;
+  }
+
+  if (!ok || rename(tempPath, path) != 0) {
+    GAGGIA_LOG_ERROR("shotHistory", "couldn't compact index");
+    unlink(tempPath);
+    return;
+  }
+
+  shotHistoryState.logRecordCount = shotHistoryState.shotCount;
+}
+
+void readShotHistoryIndex() {
+  char path[SHOT_HISTORY_MAX_PATH];
+  shotHistoryPath(SHOT_HISTORY_INDEX_NAME, path, sizeof(path));
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    // First time, nothing saved yet
+    return;
+  }
+
+  boolean torn = false;
+  ShotHistoryRecord record;
+
+  while (true) {
+    ssize_t length = read(fd, &record, sizeof(record));
+    if (length == 0) {
+      break;
+    }
+
+    if (length != sizeof(record) || record.checksum != shotHistoryChecksum(&record)) {
+      // We lost power part way through an append.. nothing after this can be trusted
+      torn = true;
+      break;
+    }
+
+    applyShotHistoryRecord(&record);
+    shotHistoryState.logRecordCount++;
+  }
+
+  close(fd);
+
+  // Anything we append has to start on a record boundary, so get rid of the torn record now
+  if (torn) {
+    GAGGIA_LOG_ERROR("shotHistory", "index was torn, dropping the end of it");
+    compactShotHistoryIndex();
+  }
+}
+
+// Returns false if we couldn't record the eviction in the index, in which case
+// we still have the shot as far as RAM (and the next restart) is concerned.
+boolean evictOldestShot() {
+  ShotHistoryRecord record = shotHistoryState.shots[0];
+
+  char path[SHOT_HISTORY_MAX_PATH];
+  shotFilePath(record.id, path, sizeof(path));
+
+  // File first.. if we lose power in between, the index just lists a shot we
+  // can't read, rather than there being a file nobody knows about.
+  unlink(path);
+
+  // RAM has to match what's on flash, or the next restart brings the shot back
+  record.type = SHOT_HISTORY_REMOVE;
+  if (!appendShotHistoryRecord(&record)) {
+    GAGGIA_LOG_ERROR("shotHistory", "couldn't remove shot %lu from the index", (unsigned long) record.id);
+    return false;
+  }
+
+  applyShotHistoryRecord(&record);
+
+  return true;
+}
+
+void saveShotToHistory() {
+  int sampleCount = shotRecorderState.sampleCount;
+  if (sampleCount < SHOT_HISTORY_MIN_SAMPLES) {
+    return;
+  }
+
+  const ShotSample *samples = shotRecorderState.samples;
+
+  ShotHistoryRecord record;
+  memset(&record, 0, sizeof(record));
+
+  record.type = SHOT_HISTORY_ADD;
+  record.id = shotHistoryState.nextId;
+  record.sampleCount = sampleCount;
+  record.startTime = Time.isValid() ? Time.now() - (millis() - shotRecorderState.startTimeMillis) / 1000 : 0;
+
+  int weightToBeanRatio = loadSettings().weightToBeanRatio;
+  if (weightToBeanRatio > 0) {
+    record.doseDecigrams = constrain(lroundf(scaleState.targetWeight * 10 / weightToBeanRatio), 0L, (long) UINT16_MAX);
+  }
+
+  // What ended up in the cup, once it stopped dripping (see ShotCutoff).  If the
+  // shot was abandoned before the cutoff, the last weight we saw is all we have.
+  if ((long) (shotCutoffState.cutoffMillis - shotRecorderState.startTimeMillis) >= 0) {
+    record.yieldDecigrams = constrain(lroundf(shotCutoffState.yieldWeight * 10), 0L, (long) UINT16_MAX);
+  } else {
+    record.yieldDecigrams = max((int) samples[sampleCount - 1].weightDecigrams, 0);
+  }
+
+  int32_t tempSum = 0;
+  for (int i = 0; i < sampleCount; i++) {
+    record.peakPressureCentibars = max(record.peakPressureCentibars, samples[i].pressureCentibars);
+    tempSum += samples[i].tempDeciC;
+  }
+  record.meanTempDeciC = tempSum / sampleCount;
+
+  uint32_t columnBytes[SHOT_FILE_COLUMN_COUNT];
+  record.fileBytes = SHOT_FILE_HEADER_BYTES;
+  for (int column = 0; column < SHOT_FILE_COLUMN_COUNT; column++) {
+    columnBytes[column] = shotColumnBytes(samples, sampleCount, column);
+    record.fileBytes += columnBytes[column];
+  }
+
+  // Make room
+  while (shotHistoryState.shotCount > 0 &&
+         (shotHistoryState.shotCount >= SHOT_HISTORY_MAX_SHOTS ||
+          shotHistoryState.totalBytes + record.fileBytes > SHOT_HISTORY_MAX_BYTES)) {
+    if (!evictOldestShot()) {
+      GAGGIA_LOG_ERROR("shotHistory", "no room for shot %lu", (unsigned long) record.id);
+      return;
+    }
+  }
+
+  // The shot file has to be complete before the index says it's there
+  if (!writeShotFile(record.id, samples, sampleCount, columnBytes)) {
+    GAGGIA_LOG_ERROR("shotHistory", "couldn't write shot %lu", (unsigned long) record.id);
+    return;
+  }
+
+  if (!appendShotHistoryRecord(&record)) {
+    GAGGIA_LOG_ERROR("shotHistory", "couldn't add shot %lu to the index", (unsigned long) record.id);
+    return;
+  }
+
+  applyShotHistoryRecord(&record);
+
+  GAGGIA_LOG_INFO("shotHistory", "saved shot %lu, %lu bytes",
+                  (unsigned long) record.id, (unsigned long) record.fileBytes);
+
+  if (shotHistoryState.logRecordCount >= SHOT_HISTORY_COMPACT_RECORD_COUNT) {
+    compactShotHistoryIndex();
+  }
+}
+
+boolean dumpShotFromHistory(uint32_t id, int output) {
+  if (shotRecorderState.recording) {
+    return false;
+  }
+
+  int sampleCount = readShotFile(id, shotRecorderState.samples, SHOT_RECORDER_MAX_SAMPLES);
+  if (sampleCount < 0) {
+    return false;
+  }
+
+  shotRecorderState.sampleCount = sampleCount;
+  dumpShotRecording(output);
+
+  return true;
+}
+
+void listShotHistory(int output) {
+  shotHistoryState.listIndex = 0;
+  shotHistoryState.listOutput = output;
+}
+
+void sendShotHistoryLine(const char *line) {
+  if (shotHistoryState.listOutput == SHOT_DUMP_SERIAL) {
+    // Like sendShotLine(), so a log line can't land in the middle of ours
+    WITH_LOCK(Serial) {
+      Serial.println(line);
+    }
+  } else {
+    sendMessageOverBLE(line);
+  }
+}
+
+// One line per shot, newest first (id, start time, dose g, yield g, seconds,
+// peak pressure bar, mean temp C), then 'H:end'.  Returns false once we're done.
+boolean sendNextShotHistoryLine() {
+  if (shotHistoryState.listIndex >= shotHistoryState.shotCount) {
+    sendShotHistoryLine("H:end");
+    return false;
+  }
+
+  ShotHistoryRecord *record =
+    &shotHistoryState.shots[shotHistoryState.shotCount - 1 - shotHistoryState.listIndex];
+
+  char line[80];
+  snprintf(line, sizeof(line), "H:%lu,%lu,%.1f,%.1f,%.1f,%.2f,%.1f",
+           (unsigned long) record->id,
+           (unsigned long) record->startTime,
+           record->doseDecigrams / 10.0,
+           record->yieldDecigrams / 10.0,
+           record->sampleCount / (double) SHOT_RECORDER_SAMPLE_HZ,
+           record->peakPressureCentibars / 100.0,
+           record->meanTempDeciC / 10.0);
+
+  sendShotHistoryLine(line);
+  shotHistoryState.listIndex++;
+
+  return true;
+}
+
+void sendShotHistoryIfNecessary() {
+  if (shotHistoryState.listOutput == SHOT_DUMP_NONE) {
+    return;
+  }
+
+  int linesToSend = SHOT_HISTORY_SERIAL_LINES_PER_LOOP;
+
+  if (shotHistoryState.listOutput == SHOT_DUMP_BLE) {
+    if (millis() < nextShotHistoryListMillis) {
+      return;
+    }
+    nextShotHistoryListMillis = millis() + SHOT_HISTORY_BLE_INTERVAL_MILLIS;
+    linesToSend = 1;
+  }
+
+  for (int i = 0; i < linesToSend; i++) {
+    if (!sendNextShotHistoryLine()) {
+      shotHistoryState.listOutput = SHOT_DUMP_NONE;
+      return;
+    }
+  }
+}
+
+int listShots(String output) {
+  listShotHistory(output.equals("ble") ? SHOT_DUMP_BLE : SHOT_DUMP_SERIAL);
+
+  return shotHistoryState.shotCount;
+}
+
+// Sends the shot over serial, same as 'dumpShot'
+int dumpHistoryShot(String id) {
+  return dumpShotFromHistory(id.toInt(), SHOT_DUMP_SERIAL) ? 1 : -1;
+}
+
+void shotHistoryInit() {
+  // Fails harmlessly if it's already there
+  mkdir(SHOT_HISTORY_DIRECTORY, 0777);
+
+  readShotHistoryIndex();
+
+  Particle.variable("shotHistoryCount", shotHistoryState.shotCount);
+  Particle.function("listShots", listShots);
+  Particle.function("dumpHistoryShot", dumpHistoryShot);
+}
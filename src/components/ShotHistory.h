@@ -0,0 +1,93 @@
+#ifndef SHOT_HISTORY_H
+#define SHOT_HISTORY_H
+
+#include "Common.h"
+#include "ShotRecorder.h"
+
+// Keeps the last SHOT_HISTORY_MAX_SHOTS shots (see ShotRecorder) on the flash
+// file system, so they survive a restart.
+//
+// /shots/<id>.shot   One file per shot.  Columnar: each column (weight, flow, ...)
+//                    is stored as the change from the sample before, as a zigzag
+//                    varint (see Varint.h).  Shots are smooth, so most samples
+//                    take a byte per column.
+//
+// /shots/index.log   A summary of every shot (ShotHistoryRecord).  We only ever
+//                    append to this.. a record to add a shot, and another to remove
+//                    it when it's evicted.  If we lose power part way through an
+//                    append, the torn record fails its checksum and is dropped
+//                    next time we start, and nothing before it is touched.  Every
+//                    so often we write out a fresh copy and rename it over the top.
+//
+// The index is read into RAM at startup, so listing shots never touches flash.
+// Oldest shots are evicted to stay under SHOT_HISTORY_MAX_SHOTS and
+// SHOT_HISTORY_MAX_BYTES.
+
+#define SHOT_HISTORY_MAX_SHOTS 100
+
+#define SHOT_HISTORY_ADD 1
+#define SHOT_HISTORY_REMOVE 2
+
+// One record of the index log.  24 bytes, and the summary of a shot.
+struct ShotHistoryRecord {
+  uint8_t type;
+
+  // Of every other byte in the record (see shotHistoryChecksum())
+  uint8_t checksum;
+
+  uint16_t sampleCount;
+
+  // Goes up by one every shot
+  uint32_t id;
+
+  // When the shot started, in seconds since 1970.  0 if we didn't know the time.
+  uint32_t startTime;
+
+  // Size of the shot file
+  uint32_t fileBytes;
+
+  uint16_t doseDecigrams;
+  uint16_t yieldDecigrams;
+  uint16_t peakPressureCentibars;
+  int16_t meanTempDeciC;
+};
+
+struct ShotHistoryState {
+
+  // Oldest first
+  ShotHistoryRecord shots[SHOT_HISTORY_MAX_SHOTS];
+  int shotCount = 0;
+
+  // Total size of all the shot files
+  uint32_t totalBytes = 0;
+
+  uint32_t nextId = 1;
+
+  // How many records are in the index log, so we know when to compact it
+  int logRecordCount = 0;
+
+  // Where the shot list is being sent (SHOT_DUMP_*), and how far we've got
+  int listOutput = SHOT_DUMP_NONE;
+  int listIndex = 0;
+};
+
+extern ShotHistoryState shotHistoryState;
+
+// Call after stopShotRecording().  Saves what's in the shot recorder, evicting
+// old shots if need be.
+void saveShotToHistory();
+
+// Reads a shot back into the shot recorder's buffer and starts sending it,
+// like dumpShotRecording().  Returns false if there's no such shot.
+boolean dumpShotFromHistory(uint32_t id, int output);
+
+// Starts sending the shot summaries, newest first, a few every time
+// sendShotHistoryIfNecessary() is called.
+void listShotHistory(int output);
+
+// Call from loop()
+void sendShotHistoryIfNecessary();
+
+void shotHistoryInit();
+
+#endif
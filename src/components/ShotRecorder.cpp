@@ -0,0 +1,171 @@
+#include "ShotRecorder.h"
+#include "State.h"
+
+ShotRecorderState shotRecorderState;
+
+Timer *shotRecorderTimer;
+
+// How many samples go out over serial each time round loop()
+int SHOT_DUMP_SERIAL_SAMPLES_PER_LOOP = 10;
+
+// BLE can't keep up with the serial port, so we space out notifications
+unsigned long SHOT_DUMP_BLE_INTERVAL_MILLIS = 20;
+unsigned long nextShotDumpMillis = 0;
+
+int16_t quantize(float value, float scale) {
+  return (int16_t) constrain(lroundf(value * scale), (long) INT16_MIN, (long) INT16_MAX);
+}
+
+// Runs on the timer thread, which has a higher priority than loop(), so
+// loop() never sees a sample half written.
+void recordShotSample() {
+  if (!shotRecorderState.recording) {
+    return;
+  }
+
+  if (shotRecorderState.sampleCount >= SHOT_RECORDER_MAX_SAMPLES) {
+    // Out of room.. we keep the start of the shot, and the timer keeps 
+    // ticking over until stopShotRecording()
+    return;
+  }
+
+  ShotSample *sample = &shotRecorderState.samples[shotRecorderState.sampleCount];
+
+  sample->weightDecigrams = quantize(scaleState.measuredWeight - scaleState.tareWeight, 10);
+  sample->flowRateCentiGPS = quantize(waterPumpState.flowRateGPS, 100);
+  sample->pressureCentibars = constrain(lroundf(waterPumpState.measuredPressureInBars * 100), 0L, (long) UINT16_MAX);
+  sample->tempDeciC = quantize(heaterState.measuredTemp, 10);
+  sample->pumpDutyCycle = constrain(lroundf(waterPumpState.pumpDutyCycle), 0L, 100L);
+
+  sample->flags = currentGaggiaState->state & SHOT_SAMPLE_STATE_MASK;
+  if (isHeaterOn()) {
+    sample->flags |= SHOT_SAMPLE_HEATER_ON;
+  }
+
+  shotRecorderState.sampleCount++;
+}
+
+void startShotRecording() {
+  GAGGIA_LOG_INFO("shotRecorder", "recording");
+
+  // Don't send half of one shot and half of another
+  shotRecorderState.dumpOutput = SHOT_DUMP_NONE;
+
+  shotRecorderState.sampleCount = 0;
+  shotRecorderState.startTimeMillis = millis();
+  shotRecorderState.recording = true;
+
+  shotRecorderTimer->start();
+}
+
+boolean stopShotRecording() {
+  if (!shotRecorderState.recording) {
+    return false;
+  }
+
+  shotRecorderTimer->stop();
+  shotRecorderState.recording = false;
+
+  GAGGIA_LOG_INFO("shotRecorder", "recorded %d samples", (int) shotRecorderState.sampleCount);
+
+  return true;
+}
+
+void dumpShotRecording(int output) {
+  if (shotRecorderState.recording) {
+    return;
+  }
+
+  shotRecorderState.dumpIndex = -1;
+  shotRecorderState.dumpOutput = output;
+}
+
+void sendShotLine(const char *line) {
+  if (shotRecorderState.dumpOutput == SHOT_DUMP_SERIAL) {
+    // Logging and the trace drain thread write to the port too, from their own
+    // threads, so we hold the lock to keep each line in one piece
+    WITH_LOCK(Serial) {
+      Serial.println(line);
+    }
+  } else {
+    sendMessageOverBLE(line);
+  }
+}
+
+// Sends the next line of the dump.. a header, then one line per sample
+// (index, weight g, flow g/s, pressure bar, pump duty %, temp C, heater on,
+// state), then 'S:end'.  Returns false once we're done.
+boolean sendNextShotLine() {
+  char line[64];
+
+  if (shotRecorderState.dumpIndex < 0) {
+    snprintf(line, sizeof(line), "S:shot,%d,%d",
+             (int) shotRecorderState.sampleCount, SHOT_RECORDER_SAMPLE_HZ);
+
+  } else if (shotRecorderState.dumpIndex < shotRecorderState.sampleCount) {
+    ShotSample *sample = &shotRecorderState.samples[shotRecorderState.dumpIndex];
+
+    snprintf(line, sizeof(line), "S:%d,%.1f,%.2f,%.2f,%d,%.1f,%d,%d",
+             shotRecorderState.dumpIndex,
+             sample->weightDecigrams / 10.0,
+             sample->flowRateCentiGPS / 100.0,
+             sample->pressureCentibars / 100.0,
+             sample->pumpDutyCycle,
+             sample->tempDeciC / 10.0,
+             (sample->flags & SHOT_SAMPLE_HEATER_ON) ? 1 : 0,
+             sample->flags & SHOT_SAMPLE_STATE_MASK);
+
+  } else {
+    sendShotLine("S:end");
+    return false;
+  }
+
+  sendShotLine(line);
+  shotRecorderState.dumpIndex++;
+
+  return true;
+}
+
+void sendShotRecordingIfNecessary() {
+  if (shotRecorderState.dumpOutput == SHOT_DUMP_NONE) {
+    return;
+  }
+
+  int linesToSend = SHOT_DUMP_SERIAL_SAMPLES_PER_LOOP;
+
+  if (shotRecorderState.dumpOutput == SHOT_DUMP_BLE) {
+    if (millis() < nextShotDumpMillis) {
+      return;
+    }
+    nextShotDumpMillis = millis() + SHOT_DUMP_BLE_INTERVAL_MILLIS;
+    linesToSend = 1;
+  }
+
+  for (int i = 0; i < linesToSend; i++) {
+    if (!sendNextShotLine()) {
+      shotRecorderState.dumpOutput = SHOT_DUMP_NONE;
+      return;
+    }
+  }
+}
+
+int dumpShot(String output) {
+  if (output.equals("ble")) {
+    dumpShotRecording(SHOT_DUMP_BLE);
+  } else {
+    dumpShotRecording(SHOT_DUMP_SERIAL);
+  }
+
+  return shotRecorderState.sampleCount;
+}
+
+int getShotSampleCount() {
+  return shotRecorderState.sampleCount;
+}
+
+void shotRecorderInit() {
+  Particle.variable("shotSampleCount", getShotSampleCount);
+  Particle.function("dumpShot", dumpShot);
+
+  shotRecorderTimer = new Timer(1000 / SHOT_RECORDER_SAMPLE_HZ, recordShotSample);
+}
@@ -0,0 +1,72 @@
+#ifndef SHOT_RECORDER_H
+#define SHOT_RECORDER_H
+
+#include "Common.h"
+
+// Records everything about a shot, from PREINFUSION until we leave DONE_BREWING,
+// at SHOT_RECORDER_SAMPLE_HZ.  Telemetry only goes out every 250ms, and only when
+// something changed, so this is the only complete record of a shot.
+//
+// Samples are taken on a timer into a buffer that's allocated up front, so recording
+// never allocates or holds up loop().  Once the buffer is full we stop recording..
+// we keep the first SHOT_RECORDER_MAX_SECONDS of the shot.
+
+#define SHOT_RECORDER_SAMPLE_HZ 25
+#define SHOT_RECORDER_MAX_SECONDS 60
+#define SHOT_RECORDER_MAX_SAMPLES (SHOT_RECORDER_SAMPLE_HZ * SHOT_RECORDER_MAX_SECONDS)
+
+#define SHOT_SAMPLE_HEATER_ON 0x80
+#define SHOT_SAMPLE_STATE_MASK 0x3F
+
+// Everything is quantized to a fixed point integer, so a sample is 10 bytes.
+// Time isn't stored.. sample n was taken n / SHOT_RECORDER_SAMPLE_HZ seconds in.
+struct ShotSample {
+  int16_t weightDecigrams;
+  int16_t flowRateCentiGPS;
+  uint16_t pressureCentibars;
+  int16_t tempDeciC;
+  uint8_t pumpDutyCycle;
+
+  // Gaggia state in the low bits, SHOT_SAMPLE_HEATER_ON on top
+  uint8_t flags;
+};
+
+#define SHOT_DUMP_NONE 0
+#define SHOT_DUMP_SERIAL 1
+#define SHOT_DUMP_BLE 2
+
+struct ShotRecorderState {
+  ShotSample samples[SHOT_RECORDER_MAX_SAMPLES];
+
+  // Only the timer thread changes this while recording
+  volatile int sampleCount = 0;
+
+  volatile boolean recording = false;
+
+  // When the shot started, in millis
+  unsigned long startTimeMillis = 0;
+
+  // Where the last shot is being sent (SHOT_DUMP_*), and how far we've got
+  int dumpOutput = SHOT_DUMP_NONE;
+  int dumpIndex = 0;
+};
+
+extern ShotRecorderState shotRecorderState;
+
+// Call as we enter PREINFUSION.  Throws away the last shot.
+void startShotRecording();
+
+// Call as we leave the brewing states.  Returns true if this ended a shot, false
+// if we weren't recording.
+boolean stopShotRecording();
+
+// Starts sending the last shot over serial or BLE (SHOT_DUMP_*), a few samples
+// every time sendShotRecordingIfNecessary() is called.
+void dumpShotRecording(int output);
+
+// Call from loop()
+void sendShotRecordingIfNecessary();
+
+void shotRecorderInit();
+
+#endif
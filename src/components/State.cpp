@@ -155,8 +155,9 @@ GaggiaState* getNextGaggiaState() {
 
     case BREWING :
 
-      if ((scaleState.measuredWeight - scaleState.tareWeight) >= 
-            scaleState.targetWeight) {
+      // We stop a little early to account for what is still going to drip
+      // into the cup.
+      if (shouldStopBrewing()) {
         return &doneBrewingState;
       }
       if (userInputState.state == LONG_PRESS) {
@@ -457,9 +458,11 @@ char* getStateName(int stateEnum) {
 }
 
 void processIncomingGaggiaState(GaggiaState *nextGaggiaState) {
+
+  configureScale(nextGaggiaState->state);
   
   if (nextGaggiaState->waterThroughGroupHead || nextGaggiaState->waterThroughWand) {
-    publishParticleLog("dispense", "Launching PID");
+    GAGGIA_LOG_INFO("dispense", "Launching PID");
 
     configureWaterPump(nextGaggiaState->state);
   }
@@ -479,6 +482,28 @@ void processIncomingGaggiaState(GaggiaState *nextGaggiaState) {
   if (nextGaggiaState->state == PREHEAT) {
       scaleState.tareWeight = 0.0;
   }
+
+  if (nextGaggiaState->state == BREWING) {
+      prepareShotCutoff();
+  }
+
+  if (nextGaggiaState->state == DONE_BREWING) {
+      recordShotCutoff();
+  }
+
+  if (nextGaggiaState->state == PREINFUSION) {
+      // Whatever the scale was doing before (e.g. cup being placed) has
+      // nothing to do with this shot's flow
+      resetFlowEstimate();
+
+      startShotRecording();
+  } else 
+  if (nextGaggiaState->state != BREWING && nextGaggiaState->state != DONE_BREWING) {
+      // Shot's over, whether it finished or was abandoned
+      if (stopShotRecording()) {
+        saveShotToHistory();
+      }
+  }
 }
 
 void processCurrentGaggiaState() { 
@@ -488,34 +513,19 @@ void processCurrentGaggiaState() {
   // Process Heaters
   //
   // Even though a heater may be 'on' during this state, the control system
-  // for the heater turns it off and on intermittently in an attempt to regulate
-  // the temperature around the target temp.
+  // for the heater turns it off and on intermittently (see regulateHeater()) in an 
+  // attempt to regulate the temperature around the target temp.
   if (currentGaggiaState->brewHeaterOn) {
-    readSteamHeaterState();  
-
-    if (shouldTurnOnHeater()) {
-      turnHeaterOn();
-    } else {
-      turnHeaterOff();
-    } 
+    readTemperatureSensors();  
+    regulateHeater();
   }
   if (currentGaggiaState->steamHeaterOn) {
-    readSteamHeaterState(); 
-
-    if (shouldTurnOnHeater()) {
-      turnHeaterOn();
-    } else {
-      turnHeaterOff();
-    } 
+    readTemperatureSensors(); 
+    regulateHeater();
   }
   if (currentGaggiaState->hotWaterDispenseHeaterOn) {
-    readSteamHeaterState(); 
-
-    if (shouldTurnOnHeater()) {
-      turnHeaterOn();
-    } else {
-      turnHeaterOff();
-    } 
+    readTemperatureSensors(); 
+    regulateHeater();
   }
   if (!currentGaggiaState->brewHeaterOn && !currentGaggiaState->steamHeaterOn && !currentGaggiaState->hotWaterDispenseHeaterOn) {
       turnHeaterOff();
@@ -536,7 +546,7 @@ void processCurrentGaggiaState() {
   }
 
   if (currentGaggiaState->measureTemp) {
-    readSteamHeaterState();
+    readTemperatureSensors();
   }
 
   if (currentGaggiaState->waterThroughGroupHead || currentGaggiaState->waterThroughWand) {
@@ -601,6 +611,10 @@ void processCurrentGaggiaState() {
     updateFlowRateMetricIfNecessary();
   }
 
+  if (currentGaggiaState->state == DONE_BREWING) {
+    learnFromSettledShotIfNecessary();
+  }
+
   if (currentGaggiaState->state == SLEEP) {
     if (networkState.connected) {
       // recall the system returns to hello after 15 minutes of inactivity.
@@ -631,20 +645,20 @@ void processOutgoingGaggiaState() {
     if (currentGaggiaState->state == JOINING_NETWORK || 
         currentGaggiaState->state == IGNORING_NETWORK || 
         currentGaggiaState->state == SLEEP) {
-      zeroScale();
+      zeroScaleIfNecessary();
     }
   
-  // WARNING! This has to happen before we tare the scale for PREHEAT
   if (currentGaggiaState->state == PREHEAT) {
     // we know the scale has just the cup on it with a known weight.
-    calibrateScale();
-    delay(50);
-    readScaleState();
+    // If we do need to calibrate, this carries on in the background while we move on 
+    // to the next state.
+    calibrateScaleIfNecessary();
   }
 
-  // WARNING! This has to happen after we calibrate for PREHEAT 
+  // We tare right away, before the beans go on.  If we're calibrating, the tare is
+  // brought over to the new calibration when it's done.
   if (currentGaggiaState->tareScale) {
-    scaleState.tareWeight = scaleState.measuredWeight;
+    tareScale();
   }
 
   // Process Record Weight 
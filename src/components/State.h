@@ -11,6 +11,9 @@
 #include "WaterReservoir.h"
 #include "UserInput.h"
 #include "Statistics.h"
+#include "ShotCutoff.h"
+#include "ShotRecorder.h"
+#include "ShotHistory.h"
 
 
 extern GaggiaState  sleepState,
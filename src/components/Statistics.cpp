@@ -35,16 +35,19 @@ int shotsUntilBackflush() {
   return max(MAX_BREW_COUNT_BEFORE_CLEANING - readBackflushBrewCount(), 0);
 }
 
+// Written back the same size we read them, so they stay out of the way of
+// whatever is stored after them
 void increaseBrewCount() {
-  int backflushBrewCount = readBackflushBrewCount();  
-  EEPROM.put(BACKFLUSH_BREW_COUNT_EEPROM_ADDRESS, backflushBrewCount + 1);
+  uint16_t backflushBrewCount = readBackflushBrewCount() + 1;  
+  EEPROM.put(BACKFLUSH_BREW_COUNT_EEPROM_ADDRESS, backflushBrewCount);
 
-  int totalBrewCount = readTotalBrewCount();  
-  EEPROM.put(TOTAL_BREW_COUNT_EEPROM_ADDRESS, totalBrewCount + 1);
+  uint16_t totalBrewCount = readTotalBrewCount() + 1;  
+  EEPROM.put(TOTAL_BREW_COUNT_EEPROM_ADDRESS, totalBrewCount);
 }
 
 void clearBackflushBrewCount() {
-  EEPROM.put(BACKFLUSH_BREW_COUNT_EEPROM_ADDRESS, 0);
+  uint16_t backflushBrewCount = 0;
+  EEPROM.put(BACKFLUSH_BREW_COUNT_EEPROM_ADDRESS, backflushBrewCount);
 }
 
 
@@ -6,10 +6,123 @@ using namespace tc; // Import tc::* into the global namespace
 // other proceses in gaggia, so track it separately...
 float nextTelemetrySendMillis = -1;
 
-String lastMessageSentToCloud = "";
-
 int SEND_TELEMETRY_INTERVAL_MILLIS = 250; 
 
+// Text until the mobile app asks for binary (see setTelemetryFormat())
+int TELEMETRY_FORMAT = TELEMETRY_FORMAT_TEXT;
+
+// Longest text line we'll send.. a full line is a bit over 100 characters
+#define TELEMETRY_TEXT_MAX_LENGTH 192
+
+// So we only send the text line when something has changed
+char lastTextTelemetry[TELEMETRY_TEXT_MAX_LENGTH] = "";
+
+// Binary frames are mostly differences against the last frame.. every so 
+// often we send everything, so a receiver that missed a frame catches up.
+unsigned long TELEMETRY_KEYFRAME_INTERVAL_MILLIS = 5000;
+
+TelemetryFrameEncoder telemetryFrameEncoder;
+unsigned long lastKeyframeMillis = 0;
+
+int setTelemetryFormat(String format) {
+  if (format.startsWith("binary")) {
+    // Start with a keyframe, the receiver has nothing to apply differences to
+    telemetryFrameEncoder.hasKeyframe = false;
+    TELEMETRY_FORMAT = TELEMETRY_FORMAT_BINARY;
+  } else {
+    // Make sure the next text line goes out even if nothing's changed
+    lastTextTelemetry[0] = 0;
+    TELEMETRY_FORMAT = TELEMETRY_FORMAT_TEXT;
+  }
+
+  return TELEMETRY_FORMAT;
+}
+
+float fittedSensorTemp(int role) {
+  if (temperatureSensors[role].chipSelectPin < 0) {
+    return -1;
+  }
+
+  return temperatureSensors[role].measuredTemp;
+}
+
+// The original comma separated line.  The mobile app has always understood this.
+void sendTextTelemetry(Telemetry &telemetry, boolean force) {
+
+  // The weight and temp values are composites of 'measured:target'
+  char message[TELEMETRY_TEXT_MAX_LENGTH];
+  snprintf(message, 
+           sizeof(message),
+           "%s, %.1f:%.1f, %d, %d, %d, %.1f:%.1f, %d, %d, %d, %d, %.1f, %.1f, %.1f, %d",
+           telemetry.stateName,
+           telemetry.measuredWeightGrams,
+           scaleState.targetWeight,
+           (int)floor(telemetry.measuredPressureBars),
+           (int)floor(telemetry.pumpDutyCycle),
+           (int)floor(telemetry.flowRateGPS),
+           telemetry.brewTempC,
+           heaterState.targetTemp,
+           telemetry.shotsUntilBackflush,
+           telemetry.totalShots,
+           telemetry.boilerState,
+           telemetry.scaleCalibrationProgress,
+           telemetry.boilerTempC,
+           telemetry.groupHeadTempC,
+           telemetry.steamTempC,
+           telemetry.secondsToTargetTemp);
+
+  if (force || strcmp(message, lastTextTelemetry) != 0) {
+    Log.error("%lu:%s", millis(), message);
+
+    sendMessageOverBLE(message);
+
+    strcpy(lastTextTelemetry, message);
+  }
+}
+
+int32_t fixedPoint(float value, float scale) {
+  return (int32_t) lroundf(value * scale);
+}
+
+// See TelemetryFrame.h.. the same values as the text line, but only the ones
+// that have changed, and in a fraction of the bytes.
+void sendBinaryTelemetry(Telemetry &telemetry, boolean force) {
+
+  int32_t values[TELEMETRY_FIELD_COUNT];
+  values[TELEMETRY_STATE] = telemetry.id;
+  values[TELEMETRY_WEIGHT_DECIGRAMS] = fixedPoint(telemetry.measuredWeightGrams, 10);
+  values[TELEMETRY_TARGET_WEIGHT_DECIGRAMS] = fixedPoint(scaleState.targetWeight, 10);
+  values[TELEMETRY_PRESSURE_CENTIBARS] = fixedPoint(telemetry.measuredPressureBars, 100);
+  values[TELEMETRY_PUMP_DUTY_CYCLE_PERCENT] = fixedPoint(telemetry.pumpDutyCycle, 1);
+  values[TELEMETRY_FLOW_RATE_CENTIGPS] = fixedPoint(telemetry.flowRateGPS, 100);
+  values[TELEMETRY_BREW_TEMP_DECIC] = fixedPoint(telemetry.brewTempC, 10);
+  values[TELEMETRY_TARGET_TEMP_DECIC] = fixedPoint(heaterState.targetTemp, 10);
+  values[TELEMETRY_SHOTS_UNTIL_BACKFLUSH] = telemetry.shotsUntilBackflush;
+  values[TELEMETRY_TOTAL_SHOTS] = telemetry.totalShots;
+  values[TELEMETRY_BOILER_STATE] = telemetry.boilerState;
+  values[TELEMETRY_SCALE_CALIBRATION_PROGRESS] = telemetry.scaleCalibrationProgress;
+  values[TELEMETRY_BOILER_TEMP_DECIC] = fixedPoint(telemetry.boilerTempC, 10);
+  values[TELEMETRY_GROUP_HEAD_TEMP_DECIC] = fixedPoint(telemetry.groupHeadTempC, 10);
+  values[TELEMETRY_STEAM_TEMP_DECIC] = fixedPoint(telemetry.steamTempC, 10);
+  values[TELEMETRY_SECONDS_TO_TARGET_TEMP] = telemetry.secondsToTargetTemp;
+
+  boolean keyframe = force || (millis() - lastKeyframeMillis >= TELEMETRY_KEYFRAME_INTERVAL_MILLIS);
+
+  uint8_t frame[TELEMETRY_FRAME_MAX_BYTES];
+  size_t length = encodeTelemetryFrame(&telemetryFrameEncoder, values, keyframe, frame);
+
+  // Nothing changed
+  if (length == 0) {
+    return;
+  }
+
+  if (frame[1] & TELEMETRY_FRAME_KEYFRAME) {
+    lastKeyframeMillis = millis();
+  }
+
+  sendBytesOverBLE(frame, length);
+}
+
 void sendTelemetry(boolean force) {
 
   Telemetry telemetry;
@@ -24,6 +137,20 @@ void sendTelemetry(boolean force) {
   telemetry.shotsUntilBackflush = shotsUntilBackflush();
   telemetry.totalShots = readTotalBrewCount();
 
+  telemetry.scaleCalibrationProgress = scaleState.calibrationProgress;
+
+  // These are just the last readings, sending telemetry never reads a sensor
+  telemetry.boilerTempC = fittedSensorTemp(BOILER_TEMP_SENSOR);
+  telemetry.groupHeadTempC = fittedSensorTemp(GROUP_HEAD_TEMP_SENSOR);
+  telemetry.steamTempC = fittedSensorTemp(STEAM_TEMP_SENSOR);
+
+  if (currentGaggiaState->state == HEATING_TO_BREW ||
+      currentGaggiaState->state == HEATING_TO_STEAM ||
+      currentGaggiaState->state == HEATING_TO_DISPENSE) {
+    telemetry.secondsToTargetTemp = 
+      thermalModelSecondsToReach(heaterState.measuredTemp, heaterState.targetTemp);
+  }
+
   if (isHeaterOn()) {
     telemetry.boilerState = 1; 
   } else {
@@ -41,55 +168,16 @@ void sendTelemetry(boolean force) {
       telemetry.measuredPressureBars = (long)(currentGaggiaState->targetCounter)/2;
   }
 
-  // only way this send will succeed
-  char measuredWeightGramsBuf[256];
-  snprintf(measuredWeightGramsBuf, 
-           sizeof(measuredWeightGramsBuf), 
-           "%.1lf", 
-           (float)telemetry.measuredWeightGrams);
-
-  // Now we add the 'target weight' for our composite weight value...
-  char targetWeightGramsBuf[256];
-  snprintf(targetWeightGramsBuf, 
-           sizeof(targetWeightGramsBuf), 
-           "%.1lf", 
-           (float)scaleState.targetWeight);  
-
-  String weight = measuredWeightGramsBuf + String(":") + targetWeightGramsBuf;
-
-  char measuredTempBuf[256];
-  snprintf(measuredTempBuf, 
-           sizeof(measuredTempBuf), 
-           "%.1lf", 
-           (float)telemetry.brewTempC);
-
-  // Now we add the 'target temp' for our composite temp value...
-  char targetTempGramsBuf[256];
-  snprintf(targetTempGramsBuf, 
-           sizeof(targetTempGramsBuf), 
-           "%.1lf", 
-           (float)heaterState.targetTemp);  
-
-  String temp = measuredTempBuf + String(":") + targetTempGramsBuf;
-
-  String messageToSendToCloud =             
-    String(telemetry.stateName) + String(", ") + 
-    String(weight) + String(", ") + 
-    String((int)floor(telemetry.measuredPressureBars)) + String(", ") +  
-    String((int)floor(telemetry.pumpDutyCycle)) + String(", ") +
-    String((int)floor(telemetry.flowRateGPS)) + String(", ") +
-    String(temp) + String(", ") + 
-    String(telemetry.shotsUntilBackflush) + String(", ") +
-    String(telemetry.totalShots) + String(", ") +
-    String(telemetry.boilerState);
-
-    if (force || (!messageToSendToCloud.equals(lastMessageSentToCloud))) {
-      Log.error(String(millis()) + String(":") + messageToSendToCloud);
-
-      sendMessageOverBLE(messageToSendToCloud);
-
-      lastMessageSentToCloud = messageToSendToCloud;
-    }
+  if (TELEMETRY_FORMAT == TELEMETRY_FORMAT_BINARY) {
+    sendBinaryTelemetry(telemetry, force);
+  } else {
+    sendTextTelemetry(telemetry, force);
+  }
+}
+
+void telemetryInit() {
+  Particle.variable("telemetryFormat", TELEMETRY_FORMAT);
+  Particle.function("setTelemetryFormat", setTelemetryFormat);
 }
 
 void sendTelemetryIfNecessary(boolean force) {
@@ -6,8 +6,20 @@
 #include "Bluetooth.h"
 #include "Common.h"
 #include "State.h"
+#include "TelemetryFrame.h"
 #include "tiny-collections.h"
 
+// The comma separated text line, or the binary frame in TelemetryFrame.h
+#define TELEMETRY_FORMAT_TEXT 0
+#define TELEMETRY_FORMAT_BINARY 1
+
+extern int TELEMETRY_FORMAT;
+
+// 'binary' for binary frames, anything else for text
+int setTelemetryFormat(String format);
+
 void sendTelemetryIfNecessary(boolean force);
 
+void telemetryInit();
+
 #endif
\ No newline at end of file
@@ -0,0 +1,98 @@
+#include "TelemetryFrame.h"
+#include "Varint.h"
+
+size_t encodeTelemetryFrame(TelemetryFrameEncoder *encoder,
+                            const int32_t values[TELEMETRY_FIELD_COUNT],
+                            bool keyframe,
+                            uint8_t *frame) {
+
+  if (!encoder->hasKeyframe) {
+    keyframe = true;
+  }
+
+  uint16_t presence = 0;
+  size_t length = 5;
+
+  for (int field = 0; field < TELEMETRY_FIELD_COUNT; field++) {
+    if (keyframe) {
+      length += writeVarint(zigzagEncode(values[field]), &frame[length]);
+      presence |= 1 << field;
+
+    } else if (values[field] != encoder->lastValues[field]) {
+      // Wraps rather than overflows, and the decoder wraps it back
+      int32_t delta = (int32_t) ((uint32_t) values[field] - (uint32_t) encoder->lastValues[field]);
+
+      length += writeVarint(zigzagEncode(delta), &frame[length]);
+      presence |= 1 << field;
+    }
+  }
+
+  if (presence == 0) {
+    return 0;
+  }
+
+  frame[0] = TELEMETRY_FRAME_MAGIC | TELEMETRY_FRAME_VERSION;
+  frame[1] = keyframe ? TELEMETRY_FRAME_KEYFRAME : 0;
+  frame[2] = encoder->sequence++;
+  frame[3] = presence & 0xFF;
+  frame[4] = presence >> 8;
+
+  for (int field = 0; field < TELEMETRY_FIELD_COUNT; field++) {
+    encoder->lastValues[field] = values[field];
+  }
+  encoder->hasKeyframe = true;
+
+  return length;
+}
+
+bool decodeTelemetryFrame(TelemetryFrameDecoder *decoder,
+                          const uint8_t *frame,
+                          size_t length) {
+
+  if (length < 5 || frame[0] != (TELEMETRY_FRAME_MAGIC | TELEMETRY_FRAME_VERSION)) {
+    return false;
+  }
+
+  bool keyframe = frame[1] & TELEMETRY_FRAME_KEYFRAME;
+  uint8_t sequence = frame[2];
+  uint16_t presence = frame[3] | (frame[4] << 8);
+
+  // A difference against values we never saw is no use to us
+  if (!keyframe && (!decoder->synced || sequence != decoder->nextSequence)) {
+    decoder->synced = false;
+    return false;
+  }
+
+  // Decode into a copy, so a truncated frame leaves the last good values alone
+  int32_t values[TELEMETRY_FIELD_COUNT];
+  size_t position = 5;
+
+  for (int field = 0; field < TELEMETRY_FIELD_COUNT; field++) {
+    values[field] = keyframe ? 0 : decoder->values[field];
+
+    if (presence & (1 << field)) {
+      uint32_t encoded;
+      size_t read = readVarint(&frame[position], length - position, &encoded);
+      if (read == 0) {
+        decoder->synced = false;
+        return false;
+      }
+      position += read;
+
+      int32_t value = zigzagDecode(encoded);
+      if (keyframe) {
+        values[field] = value;
+      } else {
+        values[field] = (int32_t) ((uint32_t) values[field] + (uint32_t) value);
+      }
+    }
+  }
+
+  for (int field = 0; field < TELEMETRY_FIELD_COUNT; field++) {
+    decoder->values[field] = values[field];
+  }
+  decoder->nextSequence = sequence + 1;
+  decoder->synced = true;
+
+  return true;
+}
@@ -0,0 +1,85 @@
+#ifndef TELEMETRY_FRAME_H
+#define TELEMETRY_FRAME_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// The binary telemetry frame.  This is the compact alternative to the comma
+// separated text line (see Telemetry.cpp).  This is plain C++ with no Particle
+// dependencies so the mobile app side (decodeTelemetryFrame()) can be built and
+// checked off the device.
+//
+// Every value is sent as a fixed point integer (see TelemetryField), and most
+// frames only carry the values that changed since the last frame, as a
+// difference.  Every so often we send a keyframe with everything in it, so a
+// receiver that joins late or misses a frame can get back in step.
+//
+// Layout:
+//   byte 0     TELEMETRY_FRAME_MAGIC | TELEMETRY_FRAME_VERSION.. the top bit is
+//              never set in a text line, so a receiver can tell the two apart
+//   byte 1     flags (TELEMETRY_FRAME_KEYFRAME)
+//   byte 2     sequence number, goes up by one every frame
+//   byte 3-4   field presence bitmap, little endian, bit n is TelemetryField n
+//   byte 5..   one zigzag varint per present field, in field order.. the value
+//              itself in a keyframe, otherwise the change since the last frame
+
+#define TELEMETRY_FRAME_MAGIC 0x80
+#define TELEMETRY_FRAME_VERSION 1
+
+#define TELEMETRY_FRAME_KEYFRAME 0x01
+
+// Fixed point scale of each field is in the name
+enum TelemetryField {
+  TELEMETRY_STATE = 0,
+  TELEMETRY_WEIGHT_DECIGRAMS,
+  TELEMETRY_TARGET_WEIGHT_DECIGRAMS,
+  TELEMETRY_PRESSURE_CENTIBARS,
+  TELEMETRY_PUMP_DUTY_CYCLE_PERCENT,
+  TELEMETRY_FLOW_RATE_CENTIGPS,
+  TELEMETRY_BREW_TEMP_DECIC,
+  TELEMETRY_TARGET_TEMP_DECIC,
+  TELEMETRY_SHOTS_UNTIL_BACKFLUSH,
+  TELEMETRY_TOTAL_SHOTS,
+  TELEMETRY_BOILER_STATE,
+  TELEMETRY_SCALE_CALIBRATION_PROGRESS,
+  TELEMETRY_BOILER_TEMP_DECIC,
+  TELEMETRY_GROUP_HEAD_TEMP_DECIC,
+  TELEMETRY_STEAM_TEMP_DECIC,
+  TELEMETRY_SECONDS_TO_TARGET_TEMP,
+  TELEMETRY_FIELD_COUNT
+};
+
+// Header plus the longest varint (5 bytes) for every field
+#define TELEMETRY_FRAME_MAX_BYTES (5 + 5 * TELEMETRY_FIELD_COUNT)
+
+struct TelemetryFrameEncoder {
+  int32_t lastValues[TELEMETRY_FIELD_COUNT];
+  uint8_t sequence = 0;
+
+  // Nothing to take a difference against until the first keyframe
+  bool hasKeyframe = false;
+};
+
+struct TelemetryFrameDecoder {
+  int32_t values[TELEMETRY_FIELD_COUNT];
+  uint8_t nextSequence = 0;
+
+  // False until we've seen a keyframe, and again after a missed frame
+  bool synced = false;
+};
+
+// Writes the next frame to 'frame', which must have room for TELEMETRY_FRAME_MAX_BYTES.
+// Returns how many bytes were written, or 0 if nothing changed and this isn't
+// a keyframe (so there's nothing worth sending).
+size_t encodeTelemetryFrame(TelemetryFrameEncoder *encoder,
+                            const int32_t values[TELEMETRY_FIELD_COUNT],
+                            bool keyframe,
+                            uint8_t *frame);
+
+// Applies a frame to decoder->values.  Returns true if decoder->values is now up
+// to date, false if the frame was bad or we're waiting on a keyframe.
+bool decodeTelemetryFrame(TelemetryFrameDecoder *decoder,
+                          const uint8_t *frame,
+                          size_t length);
+
+#endif
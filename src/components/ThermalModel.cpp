@@ -0,0 +1,187 @@
+#include "ThermalModel.h"
+
+ThermalModelState thermalModelState;
+
+// We learn from the change in temperature over this long.. the thermocouple only 
+// reads in 0.25C steps, so it has to be long enough to see a change.
+unsigned long THERMAL_MODEL_PERIOD_MILLIS = 2000;
+
+// How long it takes heat from the element to show up at the thermocouple
+unsigned long THERMAL_MODEL_DEAD_TIME_MILLIS = 8000;
+
+// We don't measure ambient.. a few degrees either way doesn't matter much
+// compared to boiler temperatures.
+float THERMAL_MODEL_AMBIENT_C = 22.0;
+
+// How quickly we forget old behaviour.. once per period, so this remembers
+// roughly the last 1000 periods (~ half an hour).
+float THERMAL_MODEL_FORGETTING_FACTOR = 0.999;
+
+// If we haven't heard about the temperature in this long, we can't tell
+// what the heater did in between.
+unsigned long THERMAL_MODEL_MAX_GAP_MILLIS = 5000;
+
+// A minute of learning before we let the model drive the heater
+int THERMAL_MODEL_TRUSTED_UPDATE_COUNT = 30;
+
+int thermalModelDeadTimePeriods() {
+  int periods = THERMAL_MODEL_DEAD_TIME_MILLIS / THERMAL_MODEL_PERIOD_MILLIS;
+  return constrain(periods, 0, THERMAL_MODEL_HISTORY_SIZE - 1);
+}
+
+// Average heater power 'periodsAgo' periods ago
+float thermalModelPowerHistory(int periodsAgo) {
+  int index = thermalModelState.powerHistoryIndex - 1 - periodsAgo;
+  while (index < 0) {
+    index += THERMAL_MODEL_HISTORY_SIZE;
+  }
+  return thermalModelState.powerHistory[index];
+}
+
+void startThermalModelPeriod(float measuredTemp, unsigned long timeMillis) {
+  thermalModelState.periodStartMillis = timeMillis;
+  thermalModelState.periodStartTemp = measuredTemp;
+  thermalModelState.periodEnergy = 0.0;
+}
+
+// Recursive least squares on:
+//   rate of temperature change = heatingRate * delayedPower - coolingRate * excessTemp
+void learnFromThermalModelPeriod(float delayedPower, float excessTemp, float observedRateCPS) {
+
+  float x0 = delayedPower;
+  float x1 = -excessTemp;
+
+  float p00 = thermalModelState.p00;
+  float p01 = thermalModelState.p01;
+  float p11 = thermalModelState.p11;
+
+  // P * x
+  float px0 = p00 * x0 + p01 * x1;
+  float px1 = p01 * x0 + p11 * x1;
+
+  float lambda = THERMAL_MODEL_FORGETTING_FACTOR;
+  float denominator = lambda + x0 * px0 + x1 * px1;
+
+  float k0 = px0 / denominator;
+  float k1 = px1 / denominator;
+
+  float predictedRateCPS = thermalModelState.heatingRateCPS * x0 + thermalModelState.coolingRate * x1;
+  float error = observedRateCPS - predictedRateCPS;
+
+  thermalModelState.heatingRateCPS += k0 * error;
+  thermalModelState.coolingRate += k1 * error;
+
+  thermalModelState.p00 = (p00 - k0 * px0) / lambda;
+  thermalModelState.p01 = (p01 - k0 * px1) / lambda;
+  thermalModelState.p11 = (p11 - k1 * px1) / lambda;
+
+  // When the boiler just sits at temperature, there's nothing new to learn and
+  // forgetting makes the covariance grow without bound.. so we cap it at where we started.
+  thermalModelState.p00 = min(thermalModelState.p00, 4.0f);
+  thermalModelState.p11 = min(thermalModelState.p11, 1e-5f);
+
+  // Keep the model physically sensible no matter what we've seen
+  thermalModelState.heatingRateCPS = constrain(thermalModelState.heatingRateCPS, 0.1f, 10.0f);
+  thermalModelState.coolingRate = constrain(thermalModelState.coolingRate, 1.0f / 3600.0f, 1.0f / 30.0f);
+
+  thermalModelState.updateCount++;
+}
+
+void updateThermalModel(float measuredTemp, float heaterPower, unsigned long timeMillis) {
+
+  unsigned long gapMillis = timeMillis - thermalModelState.lastUpdateTimeMillis;
+
+  if (!thermalModelState.initialized || gapMillis > THERMAL_MODEL_MAX_GAP_MILLIS) {
+    startThermalModelPeriod(measuredTemp, timeMillis);
+    thermalModelState.lastUpdateTimeMillis = timeMillis;
+    thermalModelState.initialized = true;
+    return;
+  }
+
+  thermalModelState.periodEnergy += heaterPower * gapMillis;
+  thermalModelState.lastUpdateTimeMillis = timeMillis;
+
+  unsigned long periodMillis = timeMillis - thermalModelState.periodStartMillis;
+  if (periodMillis < THERMAL_MODEL_PERIOD_MILLIS) {
+    return;
+  }
+
+  // Remember how hard the heater ran this period..
+  thermalModelState.powerHistory[thermalModelState.powerHistoryIndex] = 
+    thermalModelState.periodEnergy / periodMillis;
+  thermalModelState.powerHistoryIndex = 
+    (thermalModelState.powerHistoryIndex + 1) % THERMAL_MODEL_HISTORY_SIZE;
+
+  // .. but it's the heater power from a dead time ago that we're seeing now
+  float delayedPower = thermalModelPowerHistory(thermalModelDeadTimePeriods());
+
+  float observedRateCPS = (measuredTemp - thermalModelState.periodStartTemp) / (periodMillis / 1000.0f);
+  float excessTemp = (measuredTemp + thermalModelState.periodStartTemp) / 2.0f - THERMAL_MODEL_AMBIENT_C;
+
+  learnFromThermalModelPeriod(delayedPower, excessTemp, observedRateCPS);
+
+  startThermalModelPeriod(measuredTemp, timeMillis);
+}
+
+boolean isThermalModelTrusted() {
+  return thermalModelState.updateCount >= THERMAL_MODEL_TRUSTED_UPDATE_COUNT;
+}
+
+float thermalModelPendingRiseC() {
+  float pendingEnergy = 0.0;
+  for (int periodsAgo = 0; periodsAgo < thermalModelDeadTimePeriods(); periodsAgo++) {
+    pendingEnergy += thermalModelPowerHistory(periodsAgo);
+  }
+
+  // Plus whatever has gone in so far this period
+  pendingEnergy += thermalModelState.periodEnergy / THERMAL_MODEL_PERIOD_MILLIS;
+
+  return thermalModelState.heatingRateCPS * pendingEnergy * (THERMAL_MODEL_PERIOD_MILLIS / 1000.0f);
+}
+
+float thermalModelHoldingPower(float targetTemp) {
+  float holdingPower = thermalModelState.coolingRate * (targetTemp - THERMAL_MODEL_AMBIENT_C) / 
+                       thermalModelState.heatingRateCPS;
+
+  return constrain(holdingPower, 0.0f, 1.0f);
+}
+
+int thermalModelSecondsToReach(float currentTemp, float targetTemp) {
+  if (currentTemp >= targetTemp) {
+    return 0;
+  }
+
+  // Where we'd end up if we left the heater on full forever
+  float maxTemp = THERMAL_MODEL_AMBIENT_C + thermalModelState.heatingRateCPS / thermalModelState.coolingRate;
+  if (maxTemp <= targetTemp) {
+    return -1;
+  }
+
+  float seconds = logf((maxTemp - currentTemp) / (maxTemp - targetTemp)) / thermalModelState.coolingRate;
+
+  // Turning the heater up now doesn't show for a dead time, but heat that's
+  // already on its way gets us there sooner.  If we're already on full, these
+  // cancel out.
+  seconds += THERMAL_MODEL_DEAD_TIME_MILLIS / 1000.0f;
+  seconds -= thermalModelPendingRiseC() / thermalModelState.heatingRateCPS;
+
+  return max((int)ceilf(seconds), 0);
+}
+
+String getThermalModel() {
+  return "heatingRateCPS: " + String(thermalModelState.heatingRateCPS, 3) + 
+         ", timeConstantSeconds: " + String(1.0f / thermalModelState.coolingRate, 0) + 
+         ", updates: " + String(thermalModelState.updateCount);
+}
+
+void thermalModelInit() {
+  for (int i = 0; i < THERMAL_MODEL_HISTORY_SIZE; i++) {
+    thermalModelState.powerHistory[i] = 0.0;
+  }
+
+  // We're fairly sure of our starting guesses, to within a few times either way
+  thermalModelState.p00 = 4.0;
+  thermalModelState.p11 = 1e-5;
+
+  Particle.variable("thermalModel", getThermalModel);
+}
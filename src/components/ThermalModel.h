@@ -0,0 +1,76 @@
+#ifndef THERMAL_MODEL_H
+#define THERMAL_MODEL_H
+
+#include "Common.h"
+
+// Dead time is tracked in whole model periods, so this is the longest
+// dead time we can have (THERMAL_MODEL_HISTORY_SIZE * THERMAL_MODEL_PERIOD_MILLIS)
+#define THERMAL_MODEL_HISTORY_SIZE 16
+
+// A simple model of how the boiler heats up and cools down, learned as we go.
+//
+//   rate of temperature change = heatingRate * (heater power, deadTime ago)
+//                                - coolingRate * (temperature - ambient)
+//
+// i.e. a 'first order plus dead time' model.  Heater power is 0-1.  We use it to
+// know when to back off the heater on the way up (so we don't overshoot), how
+// much power it takes to hold a temperature, and how long until we get to temperature.
+struct ThermalModelState {
+
+  // How fast the boiler heats up with the heater on full, ignoring losses (C/second)
+  float heatingRateCPS = 2.0;
+
+  // What fraction of the difference from ambient we lose every second.  1/coolingRate
+  // is the boiler's time constant.
+  float coolingRate = 1.0 / 300.0;
+
+  // 2x2 estimate covariance
+  float p00 = 0.0;
+  float p01 = 0.0;
+  float p11 = 0.0;
+
+  // Average heater power over each of the last THERMAL_MODEL_HISTORY_SIZE periods
+  float powerHistory[THERMAL_MODEL_HISTORY_SIZE];
+  int powerHistoryIndex = 0;
+
+  // Where the current period started
+  unsigned long periodStartMillis = 0;
+  float periodStartTemp = 0.0;
+
+  // Heater power * millis, accumulated over the current period
+  float periodEnergy = 0.0;
+
+  unsigned long lastUpdateTimeMillis = 0;
+
+  // How many periods we've learned from
+  int updateCount = 0;
+
+  boolean initialized = false;
+};
+
+extern ThermalModelState thermalModelState;
+
+// How long it takes heat from the element to show up at the thermocouple
+extern unsigned long THERMAL_MODEL_DEAD_TIME_MILLIS;
+
+// Feed every new boiler temperature in here, along with how hard the heater is 
+// running right now (0-1).
+void updateThermalModel(float measuredTemp, float heaterPower, unsigned long timeMillis);
+
+// Once we've seen enough of the boiler to believe what we've learned
+boolean isThermalModelTrusted();
+
+// How much further the temperature will rise from heat that's already gone in, 
+// but hasn't made it to the thermocouple yet.
+float thermalModelPendingRiseC();
+
+// Heater power (0-1) it takes to hold the boiler at this temperature
+float thermalModelHoldingPower(float targetTemp);
+
+// How long, with the heater on full, until we get from currentTemp to targetTemp.
+// -1 if we never will.
+int thermalModelSecondsToReach(float currentTemp, float targetTemp);
+
+void thermalModelInit();
+
+#endif
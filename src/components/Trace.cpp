@@ -0,0 +1,203 @@
+#include "Trace.h"
+#include "Bluetooth.h"
+
+#include <atomic>
+
+int traceOutput = TRACE_OUTPUT_NONE;
+
+// Must be a power of two, so the ring index survives the sequence wrapping.
+// Records are 16 bytes each, so this is 4K of RAM.
+#define TRACE_BUFFER_SIZE 256
+
+TraceRecord traceBuffer[TRACE_BUFFER_SIZE];
+
+// Next position to be written.  Writers claim a slot by bumping this, which is
+// a single LDREX/STREX on the Argon so ISRs can't get in the middle of it.
+std::atomic<uint32_t> traceHead(0);
+
+// Next position to be drained.  Only the drain thread touches this.
+uint32_t traceTail = 0;
+
+// How long the drain thread sleeps when there's nothing to send
+int TRACE_DRAIN_IDLE_MILLIS = 5;
+
+// How many records the drain thread sends before giving up the CPU
+int TRACE_DRAIN_BATCH_SIZE = 16;
+
+// BLE can't keep up with the serial port, so we space out notifications..
+// each one carries a whole line of records
+int TRACE_BLE_LINE_MILLIS = 20;
+
+// The line being built up, 'T:' then TRACE_HEX_DIGITS per record
+#define TRACE_HEX_DIGITS 24
+char traceLine[2 + TRACE_LINE_MAX_RECORDS * TRACE_HEX_DIGITS + 1];
+int traceLineRecords = 0;
+
+Thread *traceThread;
+
+void traceEvent(uint16_t eventId, int16_t a, int32_t b) {
+  if (traceOutput == TRACE_OUTPUT_NONE) {
+    return;
+  }
+
+  uint32_t position = traceHead.fetch_add(1, std::memory_order_relaxed);
+  TraceRecord *record = &traceBuffer[position % TRACE_BUFFER_SIZE];
+
+  // Anyone reading this slot now knows it's not ready
+  record->sequence = 0;
+  std::atomic_thread_fence(std::memory_order_release);
+
+  record->timeMicros = micros();
+  record->eventId = eventId;
+  record->a = a;
+  record->b = b;
+
+  std::atomic_thread_fence(std::memory_order_release);
+  record->sequence = position + 1;
+}
+
+void flushTraceLine() {
+  if (traceLineRecords == 0) {
+    return;
+  }
+
+  if (traceOutput == TRACE_OUTPUT_SERIAL) {
+    // Log output shares the port, and is written from whichever thread logs..
+    // holding the lock keeps our line in one piece
+    WITH_LOCK(Serial) {
+      Serial.println(traceLine);
+    }
+
+  } else if (traceOutput == TRACE_OUTPUT_BLE) {
+    sendMessageOverBLE(traceLine);
+    delay(TRACE_BLE_LINE_MILLIS);
+  }
+
+  traceLineRecords = 0;
+}
+
+void sendTraceRecord(const TraceRecord *record) {
+
+  // 24 hex digits per record, e.g. 0001E2400004002A000003E8
+  char *hex = &traceLine[2 + traceLineRecords * TRACE_HEX_DIGITS];
+  snprintf(hex, TRACE_HEX_DIGITS + 1, "%08lX%04X%04X%08lX",
+           (unsigned long) record->timeMicros,
+           (unsigned int) record->eventId,
+           (unsigned int) (uint16_t) record->a,
+           (unsigned long) (uint32_t) record->b);
+
+  traceLine[0] = 'T';
+  traceLine[1] = ':';
+  traceLineRecords++;
+
+  if (traceLineRecords == TRACE_LINE_MAX_RECORDS) {
+    flushTraceLine();
+  }
+}
+
+void sendTraceDropped(uint32_t droppedCount) {
+  TraceRecord dropped;
+  dropped.timeMicros = micros();
+  dropped.eventId = TRACE_DROPPED;
+  dropped.a = 0;
+  dropped.b = droppedCount;
+
+  sendTraceRecord(&dropped);
+}
+
+// Takes the next record off the ring, if there's one ready.  Returns false
+// when there's nothing to send right now.
+boolean drainNextTraceRecord() {
+  uint32_t head = traceHead.load(std::memory_order_acquire);
+
+  // Writers have lapped us.. skip to the oldest record still in the ring
+  if (head - traceTail > TRACE_BUFFER_SIZE) {
+    sendTraceDropped(head - traceTail - TRACE_BUFFER_SIZE);
+    traceTail = head - TRACE_BUFFER_SIZE;
+  }
+
+  if (traceTail == head) {
+    return false;
+  }
+
+  TraceRecord *slot = &traceBuffer[traceTail % TRACE_BUFFER_SIZE];
+  uint32_t expectedSequence = traceTail + 1;
+
+  if (slot->sequence != expectedSequence) {
+    if ((int32_t) (slot->sequence - expectedSequence) < 0) {
+      // Claimed but still being written.. the writer outranks us, so it'll
+      // be done by the time we come back
+      return false;
+    }
+
+    // Overwritten since we looked at head
+    sendTraceDropped(1);
+    traceTail++;
+    return true;
+  }
+
+  TraceRecord record;
+  record.timeMicros = slot->timeMicros;
+  record.eventId = slot->eventId;
+  record.a = slot->a;
+  record.b = slot->b;
+
+  // Make sure it wasn't overwritten while we were copying it
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if (slot->sequence != expectedSequence) {
+    sendTraceDropped(1);
+    traceTail++;
+    return true;
+  }
+
+  sendTraceRecord(&record);
+  traceTail++;
+
+  return true;
+}
+
+int drainTraceRecords() {
+  int sentCount = 0;
+  while (sentCount < TRACE_DRAIN_BATCH_SIZE && drainNextTraceRecord()) {
+    sentCount++;
+  }
+
+  // Caught up.. send what we have rather than wait for a full line
+  if (sentCount < TRACE_DRAIN_BATCH_SIZE) {
+    flushTraceLine();
+  }
+
+  return sentCount;
+}
+
+void drainTrace(void *) {
+  while (true) {
+    if (drainTraceRecords() == 0) {
+      delay(TRACE_DRAIN_IDLE_MILLIS);
+    } else {
+      // Let anything else at our priority have a turn
+      os_thread_yield();
+    }
+  }
+}
+
+int setTraceOutput(String output) {
+  if (output.equals("serial")) {
+    traceOutput = TRACE_OUTPUT_SERIAL;
+  } else if (output.equals("ble")) {
+    traceOutput = TRACE_OUTPUT_BLE;
+  } else {
+    traceOutput = TRACE_OUTPUT_NONE;
+  }
+
+  return traceOutput;
+}
+
+void traceInit() {
+  Particle.variable("traceOutput", traceOutput);
+  Particle.function("setTraceOutput", setTraceOutput);
+
+  // Below the application thread, so tracing only ever uses time the
+  // loop would otherwise spend in delay()
+  traceThread = new Thread("trace", drainTrace, NULL, OS_THREAD_PRIORITY_DEFAULT - 1);
+}
@@ -0,0 +1,66 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "Common.h"
+
+// A binary event trace.  Anything (the loop, a timer, or an ISR) can call
+// traceEvent() to drop a small fixed-size record into a ring buffer in RAM..
+// this doesn't block, allocate or format anything, so it can be left in the
+// pump ISRs and PID code without changing their timing.
+//
+// A low priority thread drains the ring and streams it out over USB serial or
+// BLE whenever nothing more important is running.  If it falls behind, the
+// oldest records are overwritten and a TRACE_DROPPED record says how many.
+//
+// Records go out as text lines, 'T:' followed by up to TRACE_LINE_MAX_RECORDS
+// records in hex, so they can share the serial port with the regular log.  Over
+// BLE each line is one notification.  tools/decodeTrace.py turns a capture of
+// those lines into CSV.
+
+// What happened.  The meaning of 'a' and 'b' depends on the event.  Values are
+// scaled to integers (e.g. centibars) so a record is a fixed size.
+enum TraceEventId : uint16_t {
+  TRACE_DROPPED = 1,        // b = how many records were lost
+  TRACE_PUMP_CYCLE = 2,     // a = 1 if this mains cycle is on, b = epoch pattern
+  TRACE_PUMP_FIRE = 3,      // phase angle: a = duty cycle %, b = delay after zero crossing, micros
+  TRACE_PRESSURE_PID = 4,   // a = measured pressure, centibars, b = pump duty cycle, hundredths of %
+  TRACE_FLOW_PID = 5,       // a = flow rate, centigrams/s, b = target pressure, centibars
+  TRACE_HEATER_PID = 6,     // a = measured temp, tenths of C, b = heater duty cycle, hundredths of %
+  TRACE_HEATER_WINDOW = 7,  // a = 1 if the heater is on this window, b = on time, millis
+};
+
+struct TraceRecord {
+
+  // Written last, so the drain thread can tell a finished record from one
+  // that's still being written or has been overwritten.  Position in the
+  // trace, plus one.
+  volatile uint32_t sequence;
+
+  uint32_t timeMicros;
+  uint16_t eventId;
+  int16_t a;
+  int32_t b;
+};
+
+// Where the drain thread sends records.  With no output, traceEvent() returns
+// straight away.
+#define TRACE_OUTPUT_NONE 0
+#define TRACE_OUTPUT_SERIAL 1
+#define TRACE_OUTPUT_BLE 2
+
+// 7 records is a 170 byte line, which fits in the BLE MTU iOS negotiates (185)
+#define TRACE_LINE_MAX_RECORDS 7
+
+extern int traceOutput;
+
+// Safe from any context, including ISRs.
+void traceEvent(uint16_t eventId, int16_t a, int32_t b);
+
+// Sends whatever records are ready, a batch at a time.  Returns how many were
+// sent.. the drain thread calls this in a loop.
+int drainTraceRecords();
+
+// Starts the drain thread
+void traceInit();
+
+#endif
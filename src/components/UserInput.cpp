@@ -1,9 +1,22 @@
 
 #include "UserInput.h"
+#include "Telemetry.h"
+#include "ShotHistory.h"
 
 String SHORT_BUTTON_COMMAND = String("short");
 String LONG_BUTTON_COMMAND = String("long");
 
+// The mobile app sends one of these to pick the telemetry format it wants
+String BINARY_TELEMETRY_COMMAND = String("binaryTelemetry");
+String TEXT_TELEMETRY_COMMAND = String("textTelemetry");
+
+// The mobile app sends this to get the last recorded shot
+String DUMP_SHOT_COMMAND = String("dumpShot");
+
+// .. and these for the shot history.  'loadShot:<id>' sends that shot like 'dumpShot'
+String LIST_SHOTS_COMMAND = String("listShots");
+String LOAD_SHOT_COMMAND = String("loadShot:");
+
 // Based on the physical button, we derive one of three
 // input states
 UserInputState userInputState;
@@ -25,11 +38,10 @@ void readUserInputState() {
   if (incomingCommand != NULL) {
     String incomingCommandString = String(incomingCommand);
     
-    publishParticleLog("incomingCommand", incomingCommandString);
-    Log.error("incomingCommand: " + String(incomingCommandString));
+    GAGGIA_LOG_ERROR("incomingCommand", "%s", incomingCommand);
 
     if (incomingCommandString.startsWith(SHORT_BUTTON_COMMAND)) {
-      publishParticleLog("incomingCommand", "SHORT_PRESS detected");
+      GAGGIA_LOG_INFO("incomingCommand", "SHORT_PRESS detected");
 
       userInputState.state = SHORT_PRESS;
       userInputState.lastUserInteractionTimeMillis = nowTimeMillis;
@@ -37,13 +49,28 @@ void readUserInputState() {
       return;
     } else 
     if (incomingCommandString.startsWith(LONG_BUTTON_COMMAND)) {
-      publishParticleLog("incomingCommand", "LONG_PRESS detected");
+      GAGGIA_LOG_INFO("incomingCommand", "LONG_PRESS detected");
 
       userInputState.state = LONG_PRESS;
       userInputState.lastUserInteractionTimeMillis = nowTimeMillis;
     
       return;
-    } 
+    } else
+    if (incomingCommandString.startsWith(BINARY_TELEMETRY_COMMAND)) {
+      setTelemetryFormat("binary");
+    } else
+    if (incomingCommandString.startsWith(TEXT_TELEMETRY_COMMAND)) {
+      setTelemetryFormat("text");
+    } else
+    if (incomingCommandString.startsWith(DUMP_SHOT_COMMAND)) {
+      dumpShotRecording(SHOT_DUMP_BLE);
+    } else
+    if (incomingCommandString.startsWith(LIST_SHOTS_COMMAND)) {
+      listShotHistory(SHOT_DUMP_BLE);
+    } else
+    if (incomingCommandString.startsWith(LOAD_SHOT_COMMAND)) {
+      dumpShotFromHistory(incomingCommandString.substring(LOAD_SHOT_COMMAND.length()).toInt(), SHOT_DUMP_BLE);
+    }
   }
 
   // if here, fallback is IDLE
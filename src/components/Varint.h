@@ -0,0 +1,60 @@
+#ifndef VARINT_H
+#define VARINT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Variable length integers, for the binary formats (see TelemetryFrame.h and
+// ShotHistory.h).  Plain C++ so those can be built and checked off the device.
+
+// Small numbers of either sign come out as small unsigned numbers
+// (0, -1, 1, -2.. become 0, 1, 2, 3..), so they fit in a byte or two.
+inline uint32_t zigzagEncode(int32_t value) {
+  return ((uint32_t) value << 1) ^ (uint32_t) (value >> 31);
+}
+
+inline int32_t zigzagDecode(uint32_t value) {
+  return (int32_t) (value >> 1) ^ -(int32_t) (value & 1);
+}
+
+// Longest a varint can be
+#define VARINT_MAX_BYTES 5
+
+// 7 bits per byte, top bit set if there's more to come.  Returns how many
+// bytes were written.
+inline size_t writeVarint(uint32_t value, uint8_t *out) {
+  size_t length = 0;
+  while (value >= 0x80) {
+    out[length++] = (uint8_t) (value | 0x80);
+    value >>= 7;
+  }
+  out[length++] = (uint8_t) value;
+
+  return length;
+}
+
+// How many bytes writeVarint() would take
+inline size_t varintLength(uint32_t value) {
+  size_t length = 1;
+  while (value >= 0x80) {
+    value >>= 7;
+    length++;
+  }
+
+  return length;
+}
+
+// Returns how many bytes were read, or 0 if the varint runs off the end
+inline size_t readVarint(const uint8_t *in, size_t available, uint32_t *value) {
+  *value = 0;
+  for (size_t i = 0; i < available && i < VARINT_MAX_BYTES; i++) {
+    *value |= (uint32_t) (in[i] & 0x7F) << (7 * i);
+    if ((in[i] & 0x80) == 0) {
+      return i + 1;
+    }
+  }
+
+  return 0;
+}
+
+#endif
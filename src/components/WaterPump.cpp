@@ -1,30 +1,87 @@
 
 #include "WaterPump.h"
+#include "nrf.h"
+#include "Trace.h"
+
+// The pump is run by two PIDs in 'cascade'..  
+//
+// The pressure PID (inner loop) drives the pump duty cycle to hit a target 
+// pressure.  It runs fast, off the pressure sensor, so it soaks up changes in the 
+// pump (mains voltage, the pump warming up) before they ever show up on the scale.
+// Changes in the puck (channeling, swelling) still go through to the flow, and it's
+// up to the flow PID to take them back out.
+//
+// While brewing, the flow PID (outer loop) sets that target pressure to hit a target
+// flow rate.  The flow rate comes from the scale, so it's slow and laggy, but it
+// only has to steer the pressure, not fight the puck.
+//
+// The rest of the time (preinfusion, cleaning, hot water, etc) we just set the target
+// pressure directly, i.e. 'Pressure Profiling'.
 
 // These were emperically derived.  They are highly dependent on the actual system , but should now work
-// for any RoboGaggia.
+// for any RoboGaggia.  The integral gains were then tuned against a simulated pump,
+// puck and scale (see test/PumpCascadeSim.cpp).
 // see https://en.wikipedia.org/wiki/PID_controller#Loop_tuning
-double flow_PID_kP = 30;
-double flow_PID_kI = 0.08;
+
+// Flow PID.. output is target bars, so kP is bars per gram/second of flow error
+double flow_PID_kP = 1.0;
+double flow_PID_kI = 1.0;
 double flow_PID_kD = 0.0;
 
-double pressure_PID_kP = 4.0;  
-double pressure_PID_kI = 8.0;
-double pressure_PID_kD = 0.0;
+// Pressure PID.. output is pump duty cycle.  kI used to be 8, but then the inner
+// loop is too slow to soak up the pump's changes and, in the simulation, the
+// cascade does no better than running the pump off the scale alone (0.55 vs
+// 0.56 g/s rms flow error, 0.34 with 20).
+float pressure_PID_kP = 4.0;  
+float pressure_PID_kI = 20.0;
+float pressure_PID_kD = 0.0;
 
 double TARGET_FLOW_RATE = 3.0;
 
-// We do 'Pressure Profiling', meaning we modulate the water pump power based
-// on the measure pressure, only during PREINFUSION and CLEANING
-double PRE_INFUSION_TARGET_BAR = 3.0;
+float PRE_INFUSION_TARGET_BAR = 3.0;
+
+// Limits on each stage of the cascade..
+
+// The flow PID can ask for anything in this range while brewing
+float MIN_BREW_TARGET_BAR = 1.0;
+float MAX_BREW_TARGET_BAR = 9.0;
+
+// The pressure PID can drive the pump anywhere in this range
+float MIN_PUMP_DUTY_CYCLE = 35.0;
+float MAX_PUMP_DUTY_CYCLE = 100.0;
 
-double MIN_PUMP_DUTY_CYCLE = 35.0;
-double MAX_PUMP_DUTY_CYCLE = 100.0;
+// When the puck is dry, it provides little backpressure and the pressure PID would
+// immediately ramp up to max duty cycle.. which is NOT what we want for preinfusion,
+// we want to gently fill up the basket.  So we keep the pump just above where
+// it starts to energize.
+float PRE_INFUSION_MAX_PUMP_DUTY_CYCLE = 35.35;
 
 WaterPumpState waterPumpState;
 
-// How often we recalculate flow rate
-int FLOW_RATE_SAMPLE_PERIOD_MILLIS = 500; 
+// Both PIDs are allocated once up front rather than every time we change state.
+
+// Inner loop, run by the pressure control task
+PIDf pressurePID(&waterPumpState.measuredPressureInBars,  // input
+                 &waterPumpState.pumpDutyCycle,  // output
+                 &waterPumpState.targetPressureInBars,  // target
+                 pressure_PID_kP, pressure_PID_kI, pressure_PID_kD, PIDf::DIRECT);
+
+// Outer loop, run by updateFlowRateMetricIfNecessary().  Only AUTOMATIC while brewing.
+PIDf flowPID(&waterPumpState.flowRateGPS,  // input
+             &waterPumpState.targetPressureInBars,  // output
+             &waterPumpState.targetFlowRateGPS,  // target
+             flow_PID_kP, flow_PID_kI, flow_PID_kD, PIDf::DIRECT);
+
+// How often we run the flow PID.  The flow estimate updates with every scale reading,
+// but there's no point steering the pressure PID faster than it can follow.
+int FLOW_CONTROL_PERIOD_MILLIS = 100; 
+
+// How often we read pressure and, when pressure profiling, run the pressure PID.
+// This runs from a timer so it keeps its rate no matter how long the scale, 
+// telemetry or the cloud hold up loop().
+int PRESSURE_CONTROL_PERIOD_MILLIS = 10;
+
+Timer *pressureControlTimer;
 
 // The TRIAC on/off signal for the AC Potentiometer
 // https://rocketcontroller.com/product/1-channel-high-load-ac-dimmer-for-use-witch-micro-controller-3-3v-5v-logic-ac-50-60hz/
@@ -37,73 +94,97 @@ int FLOW_RATE_SAMPLE_PERIOD_MILLIS = 500;
 // 'Pulse Shape Modulation' (PSM)
 #define ZERO_CROSS_DISPENSE_POT A2  
 
-#define PRESSURE_SENSOR_ANALOG_IN A0
-
 // This sends water to the group head
 #define SOLENOID_VALVE_SSR  TX
 
 
 // For all unspecified states while dispensing, such as 
 // push water out of steam wand.
-double DEFAULT_DISPENSE_TARGET_BAR = 5.0;
+float DEFAULT_DISPENSE_TARGET_BAR = 5.0;
 
 
-double BACKFLUSH_TARGET_BAR = 4.0;
+float BACKFLUSH_TARGET_BAR = 4.0;
 
 // Once we hit this, we clamp the pump duty cycle so we don't exceed.. THis is a 
 // software Overflow Prevention feature. 
-double MAX_BAR = 14.0;
+float MAX_BAR = 14.0;
 
 
-// see https://docs.google.com/spreadsheets/d/1_15rEy-WI82vABUwQZRAxucncsh84hbYKb2WIA9cnOU/edit?usp=sharing
-// as shown in shart above, the following values were derived by hooking up a bicycle pump w/ guage to the
-// pressure sensor and measuring a series of values vs bar pressure. 
-double PRESSURE_SENSOR_SCALE_FACTOR = 319.0;
-int PRESSURE_SENSOR_OFFSET = 515; 
+// When the pressure PID last ran, so it can work with the real interval
+// rather than assuming the timer was exactly on time.
+unsigned long lastPressureControlMicros = 0;
 
+// Runs on the timer thread every PRESSURE_CONTROL_PERIOD_MILLIS.  This is the only
+// place the pump duty cycle is handed to the zero crossing interrupt (see
+// publishPumpDutyCycle()), loop() just changes what the pressure PID is aiming for.
+void runPressureControl() {
 
+  readPressureState();
+  waterPumpState.measuredPressureInBars = pressureState.measuredPressureInBars;
 
-void readPumpState() {
-  // reading from first channel of the 1015
+  unsigned long nowMicros = micros();
+
+  if (!waterPumpState.dispensing) {
+    lastPressureControlMicros = 0;
+
+    // So we don't start the next dispense with whatever we ended the last one on
+    publishPumpDutyCycle(0);
+    return;
+  }
 
-  // no pressure ~1100
-  int rawPressure = analogRead(PRESSURE_SENSOR_ANALOG_IN);
-  int normalizedPressureInBars = (rawPressure-PRESSURE_SENSOR_OFFSET)/PRESSURE_SENSOR_SCALE_FACTOR;
-  Log.error("raw pressure: " + String(rawPressure));
-  Log.error("normalized pressure: " + String(normalizedPressureInBars));
+  float dtSeconds = PRESSURE_CONTROL_PERIOD_MILLIS / 1000.0f;
+  if (lastPressureControlMicros != 0) {
+    dtSeconds = (nowMicros - lastPressureControlMicros) / 1000000.0f;
+  }
+  lastPressureControlMicros = nowMicros;
 
-  publishParticleLog("pump", "dutyCycle: " + String(waterPumpState.pumpDutyCycle) + "', normalizedPressure: " + String(normalizedPressureInBars));
+  // The zero crossing interrupt picks up the new duty cycle at the start of its next epoch
+  pressurePID.Compute(dtSeconds);
+  publishPumpDutyCycle(waterPumpState.pumpDutyCycle);
 
-  waterPumpState.measuredPressureInBars = normalizedPressureInBars;
+  traceEvent(TRACE_PRESSURE_PID, 
+             (int16_t) (waterPumpState.measuredPressureInBars * 100), 
+             (int32_t) (waterPumpState.pumpDutyCycle * 100));
 }
 
 void configureWaterPump(int gaggiaState) {
 
-  waterPumpState.targetPressureInBars = DEFAULT_DISPENSE_TARGET_BAR;
-
-  if (gaggiaState == BREWING) {
-    
-      // For brewing, we use flow profiling...
-    
-      // The reason we do this here is because PID can't change its target value,
-      // so we must create a new one when our target pressure changes..
-      PID *thisWaterPumpPID = new PID(&waterPumpState.flowRateGPS,  // input
-                                      &waterPumpState.pumpDutyCycle,  // output
-                                      &waterPumpState.targetFlowRateGPS,  // target
-                                      flow_PID_kP, flow_PID_kI, flow_PID_kD, PID::DIRECT);
-    
-      thisWaterPumpPID->SetOutputLimits(MIN_PUMP_DUTY_CYCLE, MAX_PUMP_DUTY_CYCLE);
-      
-      // we only want the PID to calculcate when we've manually updated the flow rate
-      // and call Compute().. so we should make this number very small so it always computes
-      // when we tell it to.
-      thisWaterPumpPID->SetSampleTime(10);
-      thisWaterPumpPID->SetMode(PID::AUTOMATIC);
-
-      delete waterPumpState.waterPumpPID;
-      waterPumpState.waterPumpPID = thisWaterPumpPID;
+  // The Gaggia water pump doesn't energize at all below 30 duty cycle.
+  // This number range is the 'dutyCycle' of the power we are sending to the water
+  // pump.
+  float minOutput = MIN_PUMP_DUTY_CYCLE;
+  float maxOutput = MAX_PUMP_DUTY_CYCLE;
 
-  } else {
+  if (gaggiaState == PREINFUSION) {
+    maxOutput = PRE_INFUSION_MAX_PUMP_DUTY_CYCLE;
+  }
+
+  // Purging the steam wand, there's nothing to build pressure against, so
+  // we just run the pump as gently as it'll go.
+  if (gaggiaState == PURGE_BEFORE_STEAM_2) {
+    maxOutput = MIN_PUMP_DUTY_CYCLE;
+  }
+
+  // The pressure control task may preempt us part way through and run the pressure
+  // PID against half changed limits and targets, so we reconfigure with interrupts
+  // (and so the task scheduler) off.  None of this allocates anything so it's quick.
+  ATOMIC_BLOCK() {
+
+    if (gaggiaState == BREWING) {
+
+      // For brewing, we use flow profiling...  The flow PID picks up from whatever
+      // pressure we were at (i.e. the end of preinfusion).
+      // The flow gains can be changed from the cloud, so we pick them up every time.
+      flowPID.SetTunings(flow_PID_kP, flow_PID_kI, flow_PID_kD);
+      flowPID.SetOutputLimits(MIN_BREW_TARGET_BAR, MAX_BREW_TARGET_BAR);
+      flowPID.SetMode(PIDf::AUTOMATIC);
+
+    } else {
+
+      // for pre-infusion, cleaning, and hot water dispense, we use pressure profiling
+      flowPID.SetMode(PIDf::MANUAL);
+
+      waterPumpState.targetPressureInBars = DEFAULT_DISPENSE_TARGET_BAR;
 
       if (gaggiaState == PREINFUSION) {
         waterPumpState.targetPressureInBars = PRE_INFUSION_TARGET_BAR;
@@ -113,54 +194,29 @@ void configureWaterPump(int gaggiaState) {
           gaggiaState == BACKFLUSH_CYCLE_2) {
         waterPumpState.targetPressureInBars = BACKFLUSH_TARGET_BAR;
       }
-    
-      // for pre-infusion, cleaning, and hot water dispense, we use pressure profiling
-    
-      // The reason we do this here is because PID can't change its target value,
-      // so we must create a new one when our target pressure changes..
-      PID *thisWaterPumpPID = new PID(&waterPumpState.measuredPressureInBars,  // input
-                                      &waterPumpState.pumpDutyCycle,  // output
-                                      &waterPumpState.targetPressureInBars,  // target
-                                      pressure_PID_kP, pressure_PID_kI, pressure_PID_kD, PID::DIRECT);
-    
-      // The Gaggia water pump doesn't energize at all below 30 duty cycle.
-      // This number range is the 'dutyCycle' of the power we are sending to the water
-      // pump.
-
-      double maxOutput = MAX_PUMP_DUTY_CYCLE;
-      // For preinfusion, we hold dutyCycle at 30%. When the puck is dry, it provides little
-      // backpressure and so the PID will immediately ramp up to max duty cycle, which is NOT
-      // want we want for preinfusion.... This is a silly way to use the PID, in general, but works
-      // only for preinfusion.    
-      if (gaggiaState == PREINFUSION || gaggiaState == PURGE_BEFORE_STEAM_2) {
-        // This is ridiculous but the PID code will ignore the SetOutputLimits
-        // call if min and max are identical.
-        maxOutput = MIN_PUMP_DUTY_CYCLE + MIN_PUMP_DUTY_CYCLE*.01;
-      }
-      
-      thisWaterPumpPID->SetOutputLimits(MIN_PUMP_DUTY_CYCLE, maxOutput);
-      
-      // we only want the PID to calculcate when we've manually updated the flow rate
-      // and call Compute().. so we should make this number very small so it always computes
-      // when we tell it to.
-      thisWaterPumpPID->SetSampleTime(10);
-      thisWaterPumpPID->SetMode(PID::AUTOMATIC);
-
-      if (gaggiaState != PREINFUSION && gaggiaState != BREWING) {
-        // while brewing, the compute is done when we determine flow rate
-        // elsewhere...
-        thisWaterPumpPID->Compute();
-      }
+    }
 
-      delete waterPumpState.waterPumpPID;
-      waterPumpState.waterPumpPID = thisWaterPumpPID;
+    pressurePID.SetOutputLimits(minOutput, maxOutput);
   }
+
+  // If SetOutputLimits() clamped the duty cycle, the pressure control task 
+  // publishes it next time round
 }
 
+// Like startDispensingWater(), this is called every time round loop() while we're
+// not dispensing.. we always make sure the valve and pump are off, the rest only
+// happens when we stop.
 void stopDispensingWater() {
-  publishParticleLog("dispenser", "dispensingOff");
+  if (waterPumpState.dispensing) {
+    GAGGIA_LOG_INFO("dispenser", "dispensingOff");
+
+    detachInterrupt(ZERO_CROSS_DISPENSE_POT);
 
-  detachInterrupt(ZERO_CROSS_DISPENSE_POT);
+    // In case we were part way through a half cycle in phase angle mode
+    NRF_TIMER4->TASKS_STOP = 1;
+
+    waterPumpState.dispensing = false;
+  }
 
   digitalWrite(SOLENOID_VALVE_SSR, LOW);
   digitalWrite(DISPENSE_POT, LOW);
@@ -171,69 +227,200 @@ void stopDispensingWater() {
 // We'll call this arbitrary sequence of cycles an 'epoch'..
 // https://www.instructables.com/Arduino-controlled-light-dimmer-The-circuit/
 
-// total cycles in epoch
-volatile int cyclesInEpoch = 10;
+// total cycles in epoch.. no more than PUMP_COMMAND_MAX_CYCLES
+int cyclesInEpoch = 10;
+
+// Which cycles are on for each duty cycle (0-100), worked out once up front
+// so the interrupt handler just has to look it up.  See PumpPattern.
+uint32_t pumpPatterns[101];
 
 // We track number of cycles within an epoch so we can decide 
 // which should be on or off depending on duty cycle.
-volatile int cycleCount = 1;
-
-// -1 means new cycle
-// 1 means TRIAC was ON for first zero crossing within this cycle
-// 0 means TRIAC was OFF for first zero crossing within this cycle
-volatile int currentCycleValue = -1;
+volatile int cycleCount = 0;
+
+// Each AC cycle gives us two zero crossings.. we decide what to do with the
+// cycle on the first one, and repeat it on the second.
+volatile boolean firstZeroCrossingOfCycle = true;
+volatile boolean cycleIsOn = false;
+
+// The pattern for the duty cycle we picked up at the start of this epoch
+uint32_t epochPattern = 0;
+
+// What the control code hands the interrupt handlers (see pumpCommand()).  Rather
+// than have the interrupt handlers read the PID output part way through being
+// changed (and convert it from float every time), publishPumpDutyCycle() works out
+// everything they need and stores it as one word.  Only the pressure control task
+// writes it, and the interrupt handlers only ever do a single load.
+std::atomic<uint32_t> publishedPumpCommand(0);
+
+void publishPumpDutyCycle(float pumpDutyCycle) {
+  int dutyCycle = (int)pumpDutyCycle;
+  if (dutyCycle < 0) {
+    dutyCycle = 0;
+  } else if (dutyCycle > 100) {
+    dutyCycle = 100;
+  }
 
-volatile int dutyCycle = 0;
+  publishedPumpCommand.store(pumpCommand(dutyCycle, pumpPatterns[dutyCycle]), std::memory_order_release);
+}
 
 void handleZeroCrossingInterrupt() {
   // At each zero cross, the TRIAC automatically turns off.. so we need
   // to always turn it on for a cycle that is meant to be 'on' 
 
-  if (cycleCount > cyclesInEpoch) {
-    // New Epic!
-    cycleCount = 1;
-    dutyCycle = waterPumpState.pumpDutyCycle;
-  }
+  if (firstZeroCrossingOfCycle) {
 
-  volatile bool shouldTurnOnTRIAC = false;
-  if (currentCycleValue < 0) {
-    // new cycle! need to calculate new value based on duty cycle and current cycle count
-    // within the epoch
+    if (cycleCount >= cyclesInEpoch) {
+      // New Epic!
+      cycleCount = 0;
 
-    // This should be between 0 and 100
-    // 0 would mean NO cycles are on during epoch,
-    // 50 would mean half of cycles are on during epoch,
-    // 100 would be ALL cycles on during epoch.
-
-    int pivot = cyclesInEpoch * (dutyCycle/100.0);
-    if(cycleCount <= pivot) {
-      shouldTurnOnTRIAC = true;
-      currentCycleValue = 1;
-    } else {
-      shouldTurnOnTRIAC = false;
-      currentCycleValue = 0;
+      // This should be between 0 and 100
+      // 0 would mean NO cycles are on during epoch,
+      // 50 would mean every other cycle is on during epoch,
+      // 100 would be ALL cycles on during epoch.
+      epochPattern = pumpCommandPattern(publishedPumpCommand.load(std::memory_order_acquire));
     }
-    
+
+    cycleIsOn = (epochPattern >> cycleCount) & 1;
+
+    traceEvent(TRACE_PUMP_CYCLE, cycleIsOn, epochPattern);
+
   } else {
-    // just copy value from first zero crossing in this cycle..
-    shouldTurnOnTRIAC = (currentCycleValue == 1);
-  
-    // Now that we've completed a cycle, reset...
-    currentCycleValue = -1;
+    // Now that we've completed a cycle, move on to the next...
     cycleCount += 1;
   }
+
+  firstZeroCrossingOfCycle = !firstZeroCrossingOfCycle;
   
-  if (shouldTurnOnTRIAC) {
-    digitalWrite(DISPENSE_POT, HIGH);
+  // Writing the GPIO register directly is a fraction of the time digitalWrite() takes
+  if (cycleIsOn) {
+    pinSetFast(DISPENSE_POT);
   } else {
-    digitalWrite(DISPENSE_POT, LOW);
+    pinResetFast(DISPENSE_POT);
   }
+}
+// Phase Angle control is the other way to use the dimmer.. instead of skipping
+// whole cycles, we fire the TRIAC part way through every half cycle.  The later we 
+// fire, the less of the half cycle the pump gets.  Since this picks up a new duty
+// cycle every half cycle (100/120Hz) rather than every epoch (5-6Hz), the PIDs
+// get a much more responsive pump to work with.
+//
+// Off by default since the pulse skipping is what the PIDs were tuned with.
+boolean PHASE_ANGLE_CONTROL = false;
+
+// What we're actually doing, since PHASE_ANGLE_CONTROL can change while dispensing
+boolean usingPhaseAngleControl = false;
+
+// Never fire closer than this to the next zero crossing.. the TRIAC needs current
+// flowing to latch, and a late fire could spill into the next half cycle.
+int PHASE_ANGLE_MARGIN_MICROS = 300;
+
+// Measured between zero crossings. 10000 for 50Hz mains, 8333 for 60Hz.
+volatile unsigned long halfCycleMicros = 10000;
+volatile unsigned long lastZeroCrossingMicros = 0;
+
+// How far into each half cycle to fire the TRIAC for each duty cycle (0-100), as a 
+// fraction of the half cycle.  Power doesn't go down linearly with the delay (most of
+// it is in the middle of the half cycle) so this is worked out from the power curve
+// below, to keep duty cycle roughly proportional to power like it is for pulse skipping.
+float phaseAngleDelays[101];
+
+// Fraction of full power that gets through if we fire firingFraction of the way 
+// into the half cycle (for a resistive load.. the vibe pump isn't quite, but it's close
+// enough for the PID to take care of the rest).
+float phaseAnglePower(float firingFraction) {
+  return 1.0f - firingFraction + sinf(2.0f * M_PI * firingFraction) / (2.0f * M_PI);
+}
+
+void computePhaseAngleDelays() {
+  for (int dutyCycle = 0; dutyCycle <= 100; dutyCycle++) {
+    float targetPower = dutyCycle / 100.0f;
+
+    // phaseAnglePower() only goes down as the delay goes up, so we can just bisect
+    float earliest = 0.0f;
+    float latest = 1.0f;
+    for (int i = 0; i < 20; i++) {
+      float delay = (earliest + latest) / 2.0f;
+      if (phaseAnglePower(delay) > targetPower) {
+        earliest = delay;
+      } else {
+        latest = delay;
+      }
+    }
 
-  delayMicroseconds(10);
+    phaseAngleDelays[dutyCycle] = (earliest + latest) / 2.0f;
+  }
+}
+
+// Device OS doesn't give us a hardware timer, so we use the nRF52's TIMER4 (which
+// Device OS and the SoftDevice leave alone) directly.  It's a one shot:  we
+// start it at the zero crossing and it fires the TRIAC when it hits the delay.
+void handlePhaseAngleTimerInterrupt() {
+  if (NRF_TIMER4->EVENTS_COMPARE[0]) {
+    NRF_TIMER4->EVENTS_COMPARE[0] = 0;
+    pinSetFast(DISPENSE_POT);
+  }
 }
+
+void phaseAngleTimerInit() {
+  NRF_TIMER4->TASKS_STOP = 1;
+  NRF_TIMER4->MODE = TIMER_MODE_MODE_Timer;
+  NRF_TIMER4->BITMODE = TIMER_BITMODE_BITMODE_32Bit;
+
+  // 16MHz / 2^4, so one tick per microsecond
+  NRF_TIMER4->PRESCALER = 4;
+
+  // Stop and reset as soon as we've fired, ready for the next half cycle
+  NRF_TIMER4->SHORTS = TIMER_SHORTS_COMPARE0_CLEAR_Msk | TIMER_SHORTS_COMPARE0_STOP_Msk;
+  NRF_TIMER4->INTENSET = TIMER_INTENSET_COMPARE0_Msk;
+
+  attachInterruptDirect(TIMER4_IRQn, handlePhaseAngleTimerInterrupt);
+}
+
+void handlePhaseAngleZeroCrossingInterrupt() {
+
+  unsigned long nowMicros = micros();
+  unsigned long sinceLastZeroCrossing = nowMicros - lastZeroCrossingMicros;
+  lastZeroCrossingMicros = nowMicros;
+
+  // Track the mains frequency, ignoring anything that doesn't look like
+  // a half cycle (e.g. the first crossing after the pump was off)
+  if (sinceLastZeroCrossing > 7000 && sinceLastZeroCrossing < 12000) {
+    halfCycleMicros = (halfCycleMicros * 7 + sinceLastZeroCrossing) / 8;
+  }
+
+  // The TRIAC turned itself off at the zero crossing, keep it off until we fire it
+  NRF_TIMER4->TASKS_STOP = 1;
+  pinResetFast(DISPENSE_POT);
+
+  uint32_t dutyCycle = pumpCommandDutyCycle(publishedPumpCommand.load(std::memory_order_acquire));
+  if (dutyCycle == 0) {
+    return;
+  }
+
+  unsigned long delayMicros = phaseAngleDelays[dutyCycle] * halfCycleMicros;
+
+  if (delayMicros + PHASE_ANGLE_MARGIN_MICROS > halfCycleMicros) {
+    // Too little of the half cycle left to be worth it
+    return;
+  }
+
+  if (delayMicros == 0) {
+    pinSetFast(DISPENSE_POT);
+    return;
+  }
+
+  NRF_TIMER4->TASKS_CLEAR = 1;
+  NRF_TIMER4->CC[0] = delayMicros;
+  NRF_TIMER4->TASKS_START = 1;
+
+  traceEvent(TRACE_PUMP_FIRE, dutyCycle, delayMicros);
+}
+
 // The solenoid valve allows water to through to grouphead.
+// This is called every time round loop() while we're dispensing, so everything
+// but the solenoid only happens when we start.
 void startDispensingWater(boolean turnOnSolenoidValve) {
-  publishParticleLog("dispenser", "dispensingOn");
 
   if (turnOnSolenoidValve) {
     digitalWrite(SOLENOID_VALVE_SSR, HIGH);
@@ -241,9 +428,26 @@ void startDispensingWater(boolean turnOnSolenoidValve) {
     digitalWrite(SOLENOID_VALVE_SSR, LOW);
   }
 
-  readPumpState();  
+  if (waterPumpState.dispensing) {
+    return;
+  }
+
+  GAGGIA_LOG_INFO("dispenser", "dispensingOn, pumpDutyCycle: %.2f", waterPumpState.pumpDutyCycle);
 
-  publishParticleLog("dispenser", "pumpDutyCycle: " + String(waterPumpState.pumpDutyCycle));
+  // We don't switch pump control modes part way through dispensing
+  usingPhaseAngleControl = PHASE_ANGLE_CONTROL;
+
+  // Start on a fresh epoch, with the next zero crossing as the first of a cycle..
+  // otherwise we pick up wherever the last dispense left off, part way through
+  // an epoch with a stale pattern (or even on the second half of a cycle).
+  ATOMIC_BLOCK() {
+    cycleCount = cyclesInEpoch;
+    firstZeroCrossingOfCycle = true;
+    cycleIsOn = false;
+
+    // Lets the pressure control task know it should be running the PID
+    waterPumpState.dispensing = true;
+  }
 
   // The zero crossings from the incoming AC sinewave will trigger
   // this interrupt handler, which will modulate the power duty cycle to
@@ -251,7 +455,11 @@ void startDispensingWater(boolean turnOnSolenoidValve) {
   //
   // This will not trigger unless water dispenser is running.
   //
-  attachInterrupt(ZERO_CROSS_DISPENSE_POT, handleZeroCrossingInterrupt, RISING, 0);
+  if (usingPhaseAngleControl) {
+    attachInterrupt(ZERO_CROSS_DISPENSE_POT, handlePhaseAngleZeroCrossingInterrupt, RISING, 0);
+  } else {
+    attachInterrupt(ZERO_CROSS_DISPENSE_POT, handleZeroCrossingInterrupt, RISING, 0);
+  }
 }
 
 int setTargetFlowRate(String _flowRate) {
@@ -261,6 +469,15 @@ int setTargetFlowRate(String _flowRate) {
   return 1;
 }
 
+// 1 for phase angle control, 0 for pulse skipping.. takes effect the next
+// time we start dispensing.
+int setPhaseAngleControl(String _phaseAngleControl) {
+
+  PHASE_ANGLE_CONTROL = (_phaseAngleControl.toInt() == 1);
+
+  return 1;
+}
+
 int setPID_kP(String _PID_kP) {
   
   flow_PID_kP = _PID_kP.toFloat();
@@ -283,53 +500,26 @@ int setPID_kD(String _PID_kD) {
 }
 
 String getPumpState() {
-  
-  readPumpState();
-
-  return String(waterPumpState.measuredPressureInBars);
+  return String(waterPumpState.measuredPressureInBars, 2);
 }
 
-// This will calculate based on the last time this function was called
+// Flow rate itself is estimated on every scale reading (see FlowEstimator), so this
+// just picks up the latest estimate, and while brewing, runs the flow PID which
+// steers the pressure PID.
 void updateFlowRateMetricIfNecessary() {
-  if (millis() > waterPumpState.nextSampleMillis) {
-
-    double measuredWeightNow = scaleState.measuredWeight;
-
-    double newFlowRateGPS = 0.0;
-    if (waterPumpState.nextSampleMillis > 0) {
-
-      // This is the difference between when we thought we were ending this sampling
-      // interval and when we did + the length of the sampling interval
-      int flowRateInterval = millis() - waterPumpState.nextSampleMillis + FLOW_RATE_SAMPLE_PERIOD_MILLIS;
-      Log.error("Previous PumpDutyCycle: " + String(waterPumpState.pumpDutyCycle));
-      Log.error("FlowRate Interval: " + String(flowRateInterval));
-      Log.error("FlowRate weight: " + String(measuredWeightNow));
-      Log.error("FlowRate previousWeight: " + String(waterPumpState.previousMeasuredWeight));
-
-      newFlowRateGPS = ( // current extracted weight
-                              measuredWeightNow -
-                              // previous extracted weight
-                              waterPumpState.previousMeasuredWeight) /
-                              (flowRateInterval/1000.0); 
-    }
-    // This is observed by the PID
-    waterPumpState.flowRateGPS = newFlowRateGPS;
-
-    Log.error("FlowRate Reading: " + String(waterPumpState.flowRateGPS));
 
-    // Now that we have new flow rate, recalculate PID..
+  // This is observed by the PID and by telemetry
+  waterPumpState.flowRateGPS = flowEstimatorState.flowRateGPS;
 
-    // This triggers the PID to use previous and current
-    // measured values to calculate the current required
-    // dutyCycle of the water pump
-  
-    // NJD for testing
-    //waterPumpState.pumpDutyCycle = 80;
-
-    waterPumpState.waterPumpPID->Compute();
+  // This only does anything while brewing, and only every FLOW_CONTROL_PERIOD_MILLIS.
+  // The pressure control task picks up the new target pressure next time it runs.
+  if (flowPID.Compute()) {
+    GAGGIA_LOG_TRACE("pump", "flowRate: %.2f, targetPressure: %.2f", 
+                     waterPumpState.flowRateGPS, waterPumpState.targetPressureInBars);
 
-    waterPumpState.nextSampleMillis = millis() + FLOW_RATE_SAMPLE_PERIOD_MILLIS;
-    waterPumpState.previousMeasuredWeight = measuredWeightNow;
+    traceEvent(TRACE_FLOW_PID, 
+               (int16_t) (waterPumpState.flowRateGPS * 100), 
+               (int32_t) (waterPumpState.targetPressureInBars * 100));
   }
 }
 
@@ -337,6 +527,13 @@ void waterPumpInit() {
   
   // Water Pump Potentiometer
   pinMode(DISPENSE_POT, OUTPUT);
+
+  for (int dutyCycle = 0; dutyCycle <= 100; dutyCycle++) {
+    pumpPatterns[dutyCycle] = pumpPattern(dutyCycle, cyclesInEpoch);
+  }
+
+  computePhaseAngleDelays();
+  phaseAngleTimerInit();
   pinMode(ZERO_CROSS_DISPENSE_POT, INPUT_PULLDOWN);
 
   // water dispenser
@@ -344,13 +541,29 @@ void waterPumpInit() {
 
   waterPumpState.targetFlowRateGPS = TARGET_FLOW_RATE;
 
+  // The pressure gains were tuned at a 10ms sample time, and the pressure control task
+  // runs it with the real interval (see runPressureControl()).
+  pressurePID.SetOutputLimits(MIN_PUMP_DUTY_CYCLE, MAX_PUMP_DUTY_CYCLE);
+  pressurePID.SetSampleTime(10);
+  pressurePID.SetMode(PIDf::AUTOMATIC);
+
+  flowPID.SetOutputLimits(MIN_BREW_TARGET_BAR, MAX_BREW_TARGET_BAR);
+  flowPID.SetSampleTime(FLOW_CONTROL_PERIOD_MILLIS);
+
+  pressureInit();
+
+  pressureControlTimer = new Timer(PRESSURE_CONTROL_PERIOD_MILLIS, runPressureControl);
+  pressureControlTimer->start();
+
   Particle.variable("PID_kP", flow_PID_kP);
   Particle.variable("PID_kI", flow_PID_kI);
   Particle.variable("PID_kD", flow_PID_kD);
   Particle.variable("targetFlowRate", TARGET_FLOW_RATE);
+  Particle.variable("phaseAngleControl", PHASE_ANGLE_CONTROL);
   Particle.variable("currentPressureBars", getPumpState);
 
   Particle.function("setTargetFlowRate", setTargetFlowRate);
+  Particle.function("setPhaseAngleControl", setPhaseAngleControl);
   Particle.function("setPID_kP", setPID_kP);
   Particle.function("setPID_kI", setPID_kI);
   Particle.function("setPID_kD", setPID_kD);
@@ -5,57 +5,58 @@
 #include <pid.h>
 #include "Telemetry.h"
 #include "Scale.h"
+#include "Pressure.h"
+#include "PumpPattern.h"
+#include <atomic>
 
-extern double pressure_PID_kP;
-extern double pressure_PID_kI;
-extern double pressure_PID_kD;
+extern float pressure_PID_kP;
+extern float pressure_PID_kI;
+extern float pressure_PID_kD;
 
-extern double MAX_PUMP_DUTY_CYCLE;
-extern double MIN_PUMP_DUTY_CYCLE;
+extern float MAX_PUMP_DUTY_CYCLE;
+extern float MIN_PUMP_DUTY_CYCLE;
 
 struct WaterPumpState {
 
-  // Only used when Pressure Profiling (e.g. preinfusion, cleaning)
-  double targetPressureInBars = -1; 
+  // What the pressure PID is aiming for.. set by us when Pressure Profiling (e.g.
+  // preinfusion, cleaning), and by the flow PID when brewing.
+  float targetPressureInBars = -1; 
 
-  double targetFlowRateGPS = -1; 
+  float targetFlowRateGPS = -1; 
 
   // current pressure
-  // This is input for the PID
-  double measuredPressureInBars;
+  // This is input for the pressure PID
+  float measuredPressureInBars = 0.0;
 
   // represents how we are currently driving the pump
   // How much of the time we're dispensing out of our total
   // coherence time.. in percentage
-  // This is calculated and updated by the PID
-  double pumpDutyCycle = -1;
+  // This is calculated and updated by the pressure PID
+  float pumpDutyCycle = -1;
 
-  // The control system for determining when to turn on
-  // the pump in order to achieve target pressure
-  PID *waterPumpPID;
+  // Whether the pump is running
+  volatile boolean dispensing = false;
 
-  double flowRateGPS = 0.0;
-
-  float nextSampleMillis = -1;
-
-  // used to calculate flowRate
-  double previousMeasuredWeight = 0.0;
+  // Latest flow estimate from the scale (see FlowEstimator)
+  // This is input for the flow PID
+  float flowRateGPS = 0.0;
 };
 
 extern WaterPumpState waterPumpState;
 
 void waterPumpInit();
 
-// Measures the current pressure in the water pump system
-void readPumpState();
-
 void configureWaterPump(int gaggiaState);
 
 void startDispensingWater(boolean turnOnSolenoidValve);
 
 void stopDispensingWater();
 
-// We only update this value at specific intervals
+// Picks up the latest flow rate, and while brewing, runs the flow PID
 void updateFlowRateMetricIfNecessary();
 
+// Hands a pump duty cycle over to the zero crossing interrupt.  Only the pressure
+// control task calls this, so there's only ever one writer.
+void publishPumpDutyCycle(float pumpDutyCycle);
+
 #endif
\ No newline at end of file
@@ -33,11 +33,11 @@ boolean doesWaterReservoirNeedFilling() {
 }
 
 void turnWaterReservoirSolenoidOn() {
-  publishParticleLog("waterReservoirSolenoid", "on");
+  GAGGIA_LOG_INFO("waterReservoirSolenoid", "on");
   digitalWrite(WATER_RESERVOIR_SOLENOID, HIGH);
 }
 
 void turnWaterReservoirSolenoidOff() {
-  publishParticleLog("waterReservoirSolenoid", "off");
+  GAGGIA_LOG_INFO("waterReservoirSolenoid", "off");
   digitalWrite(WATER_RESERVOIR_SOLENOID, LOW);
 }
\ No newline at end of file
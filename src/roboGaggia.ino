@@ -27,14 +27,18 @@ Copyright (c) 2016 SparkFun Electronics
 #include "components/WaterReservoir.h"
 #include "components/State.h"
 #include "components/Bluetooth.h"
+#include "components/Trace.h"
 
 
-// This can be zero as we read the scale every loop and that takes
-// ~ 500ms
-#define LOOP_INTERVAL_MILLIS 0
+// readScaleState() no longer waits on the scale (it used to take ~ 500ms),
+// so the loop now runs as fast as its slowest component.. We still yield
+// for a millisecond so the system thread gets some time.
+#define LOOP_INTERVAL_MILLIS 1
 
 
-SerialLogHandler logHandler;
+// Lets everything through.. what actually gets logged is down to 'logLevel'
+// (see Common.h)
+SerialLogHandler logHandler(LOG_LEVEL_TRACE);
 SYSTEM_THREAD(ENABLED);
 
 // This instructs the core to not connect to the
@@ -49,8 +53,9 @@ void setup() {
   // I2C Setup
   Wire.begin();
 
-  // this might not work for all components of RogoGaggia!!
-  Wire.setClock(50000); //Qwiic Scale is capable of running at 400kHz if desired
+  // Each I2C component asks for the clock it can handle as it's initialized
+  // (see requestI2CClock()).  If you add anything slower to the bus, have it
+  // ask for its clock too!
 
   // Manages system state, when to change state, and what to do when
   // entering or leaving state.  
@@ -58,7 +63,8 @@ void setup() {
 
   // Manages the vibration pump.  Maintains PID controllers for
   // both flow-based control (brewing) and 
-  // pressure-based control (preinfusion, hot water dispense, cleaning)
+  // pressure-based control (preinfusion, hot water dispense, cleaning).
+  // Pressure is read, and pressure control is run, from a timer.
   waterPumpInit();
 
   // Manages the water reservoir to ensure water always available.  Controls the
@@ -76,6 +82,19 @@ void setup() {
 
   bluetoothInit();
 
+  // Text or binary telemetry over BLE
+  telemetryInit();
+
+  // Records every shot at a high rate, for sending afterwards
+  shotRecorderInit();
+
+  // Keeps recorded shots on flash
+  shotHistoryInit();
+
+  // Binary event trace of the pump and heater control, drained by a low 
+  // priority thread.  Off until setTraceOutput is called.
+  traceInit();
+
   settingsInit();
 
   // Wait for a USB serial connection for up to 3 seconds
@@ -118,6 +137,10 @@ void loop() {
 
   sendTelemetryIfNecessary(false);
 
+  // If we've been asked for the last shot, send a bit more of it
+  sendShotRecordingIfNecessary();
+  sendShotHistoryIfNecessary();
+
   // resume service loop
   if (networkState.connected) {
     Particle.process();
@@ -0,0 +1,169 @@
+#include "Test.h"
+#include "FlowEstimator.h"
+
+#include <math.h>
+#include <random>
+
+// Runs the flow estimator (see FlowEstimator.cpp) over synthetic shots where we
+// know the true flow, and compares it with what it replaced: the difference
+// between weights averaged over 500ms.  Then tries a few values of
+// FLOW_ESTIMATOR_FLOW_NOISE_GPS to show the trade off between lag and noise.
+//
+// Lag is measured after the pump stops, when the flow falls away quickly.. that's
+// when being late matters to the shot cutoff (see ShotCutoff.cpp).
+
+extern float FLOW_ESTIMATOR_FLOW_NOISE_GPS;
+
+// Filtered scale readings come at 40Hz (see Scale.cpp)
+#define READING_MILLIS 25
+
+#define SHOT_MILLIS 32000
+
+// The true flow into the cup: nothing during preinfusion, a ramp up as the puck
+// saturates, a slow decline through the shot, then drips once the pump stops
+float trueFlowRateGPS(float seconds, float peakFlowRateGPS) {
+  if (seconds < 6) {
+    return 0;
+  }
+  if (seconds < 9) {
+    return peakFlowRateGPS * (seconds - 6) / 3;
+  }
+  if (seconds < 25) {
+    return peakFlowRateGPS * (1 - 0.2f * (seconds - 9) / 16);
+  }
+  return peakFlowRateGPS * 0.8f * expf(-(seconds - 25));
+}
+
+struct FlowErrors {
+  double sumSquaredError = 0;
+  int count = 0;
+
+  // While the flow is steady(ish), how much the estimate wobbles about the truth
+  double steadySumSquaredError = 0;
+  int steadyCount = 0;
+
+  // After the pump stops, how far behind the truth we are in seeing the flow
+  // fall to half.. this is what the shot cutoff cares about
+  double sumStopLagSeconds = 0;
+  int shotCount = 0;
+  boolean sawStop = false;
+
+  void startShot() {
+    sawStop = false;
+    shotCount++;
+  }
+
+  void add(float seconds, float estimate, float truth, float peakFlowRateGPS) {
+    float error = estimate - truth;
+    sumSquaredError += error * error;
+    count++;
+
+    if (seconds >= 12 && seconds < 25) {
+      steadySumSquaredError += error * error;
+      steadyCount++;
+    }
+
+    // The truth falls to half of 0.8 * peak ln(2) seconds after the stop
+    if (!sawStop && seconds >= 25 && estimate < 0.4f * peakFlowRateGPS) {
+      sumStopLagSeconds += seconds - (25 + logf(2));
+      sawStop = true;
+    }
+  }
+
+  float rms() { return sqrt(sumSquaredError / count); }
+  float steadyRMS() { return sqrt(steadySumSquaredError / steadyCount); }
+  float stopLagSeconds() { return sumStopLagSeconds / shotCount; }
+};
+
+// What we used to do.. average the weight over 500ms, and take the difference 
+// from the last 500ms
+struct AveragedDifference {
+  float sum = 0;
+  int count = 0;
+  float lastAverage = NAN;
+  float flowRateGPS = 0;
+
+  void update(float weight) {
+    sum += weight;
+    count++;
+
+    if (count * READING_MILLIS >= 500) {
+      float average = sum / count;
+      if (!isnan(lastAverage)) {
+        flowRateGPS = (average - lastAverage) / 0.5f;
+      }
+      lastAverage = average;
+      sum = 0;
+      count = 0;
+    }
+  }
+};
+
+// A few shots, each with its own peak flow and noise
+void runShots(FlowErrors *kalman, FlowErrors *averaged) {
+  std::mt19937 random(3);
+  std::normal_distribution<float> noise(0, 0.15);
+  float peakFlowRates[] = { 1.2, 1.8, 2.5, 3.2 };
+
+  for (float peakFlowRateGPS : peakFlowRates) {
+    resetFlowEstimate();
+    AveragedDifference difference;
+    kalman->startShot();
+    averaged->startShot();
+
+    double weight = 0;
+    for (int millis = 0; millis < SHOT_MILLIS; millis += READING_MILLIS) {
+      float seconds = millis / 1000.0f;
+      float truth = trueFlowRateGPS(seconds, peakFlowRateGPS);
+      weight += truth * READING_MILLIS / 1000.0;
+
+      float reading = weight + noise(random);
+      updateFlowEstimate(reading, millis);
+      difference.update(reading);
+
+      kalman->add(seconds, flowEstimatorState.flowRateGPS, truth, peakFlowRateGPS);
+      averaged->add(seconds, difference.flowRateGPS, truth, peakFlowRateGPS);
+    }
+  }
+}
+
+void report(const char *name, FlowErrors errors) {
+  printf("  %-36s rms %.3f g/s, steady rms %.3f g/s, %.2fs behind when the pump stops\n",
+         name, errors.rms(), errors.steadyRMS(), errors.stopLagSeconds());
+}
+
+int main() {
+  printf("flow rate error over 4 synthetic shots, 40Hz readings with 0.15g noise\n");
+
+  FlowErrors kalman;
+  FlowErrors averaged;
+  runShots(&kalman, &averaged);
+
+  report("500ms averaged difference", averaged);
+  report("Kalman", kalman);
+
+  // The point of the Kalman filter is seeing changes in flow sooner, without 
+  // wobbling more than we used to while the flow is steady
+  CHECK(kalman.stopLagSeconds() < 0.6f * averaged.stopLagSeconds());
+  CHECK(kalman.steadyRMS() < averaged.steadyRMS());
+  CHECK(kalman.rms() < 1.05f * averaged.rms());
+
+  float flowNoise = FLOW_ESTIMATOR_FLOW_NOISE_GPS;
+  float flowNoises[] = { 0.125, 0.25, 0.5, 1.0, 2.0 };
+
+  for (float candidate : flowNoises) {
+    FLOW_ESTIMATOR_FLOW_NOISE_GPS = candidate;
+
+    FlowErrors errors;
+    FlowErrors unused;
+    runShots(&errors, &unused);
+
+    char name[64];
+    snprintf(name, sizeof(name), "Kalman, flow noise %.3f%s", candidate, candidate == flowNoise ? " (current)" : "");
+    report(name, errors);
+  }
+
+  FLOW_ESTIMATOR_FLOW_NOISE_GPS = flowNoise;
+
+  return testResult("FlowEstimatorBench");
+}
@@ -0,0 +1,291 @@
+#include "Test.h"
+#include "SimulatedBoiler.h"
+#include "Heater.h"
+#include "Bluetooth.h"
+
+// Runs the heater (see Heater.cpp) against a simulated boiler, from cold and then
+// through a change of target, with and without boosting.  Boosting has to happen
+// once per heat up, not toggle on and off every loop, and has to get us there
+// without overshooting.  Time proportioning on its own has to do better than the
+// bang-bang control it replaced.
+
+#define HEATER D8
+
+extern Timer *heaterTimer;
+extern float HEATER_BOOST_MIN_ERROR_C;
+String getThermalModel();
+
+// What the heater needs from the rest of the firmware
+void sendMessageOverBLE(const char *) {
+}
+
+// How many times we started boosting
+int boostCount = 0;
+
+struct HeatUp {
+  float peakC;
+  float secondsToTarget;
+  float secondsToSettle;
+
+  // Highest minus lowest, over the last minute
+  float rippleC;
+};
+
+// The heater as it used to be..  the PID's output clamped to 0-1, and the SSR on
+// whenever it's above 0, checked every loop.  Same gains as it had.
+float bangBangOutput = 0;
+PIDf bangBangPID(&heaterState.measuredTemp, &bangBangOutput, &heaterState.targetTemp, 
+                 4.0, 8.0, 0.0, PIDf::DIRECT);
+boolean bangBang = false;
+
+// One pass of loop() (and the heater timer) every 10ms, for a while.  Reports
+// the overshoot past targetC, how long it took to get there, and how long until 
+// it stayed within a degree of it.
+HeatUp runHeater(float seconds, float targetC) {
+  HeatUp heatUp = { 0.0, -1, 0, 0 };
+  float lastMinuteLowC = 1000;
+  float lastMinuteHighC = 0;
+
+  int steps = seconds * 1000 / SIMULATED_BOILER_STEP_MILLIS;
+  for (int step = 0; step < steps; step++) {
+    advanceHostMicros(SIMULATED_BOILER_STEP_MILLIS * 1000);
+    if (!bangBang) {
+      heaterTimer->callback();
+    }
+    boiler.step();
+
+    boolean wasBoosting = heaterState.boosting;
+    readTemperatureSensors();
+
+    if (bangBang) {
+      bangBangPID.Compute();
+      digitalWrite(HEATER, bangBangOutput > 0 ? HIGH : LOW);
+    } else {
+      regulateHeater();
+    }
+
+    if (heaterState.boosting && !wasBoosting) {
+      boostCount++;
+      printf("  boost at %.1fC\n", boiler.tempC);
+    }
+    if (!heaterState.boosting && wasBoosting) {
+      printf("  boost done at %.1fC\n", boiler.tempC);
+    }
+
+    float stepSeconds = (step + 1) * SIMULATED_BOILER_STEP_MILLIS / 1000.0f;
+    heatUp.peakC = max(heatUp.peakC, boiler.tempC);
+    if (heatUp.secondsToTarget < 0 && boiler.tempC >= targetC) {
+      heatUp.secondsToTarget = stepSeconds;
+    }
+    if (fabsf(boiler.tempC - targetC) > 1.0) {
+      heatUp.secondsToSettle = stepSeconds;
+    }
+    if (stepSeconds > seconds - 60) {
+      lastMinuteLowC = min(lastMinuteLowC, boiler.tempC);
+      lastMinuteHighC = max(lastMinuteHighC, boiler.tempC);
+    }
+  }
+
+  heatUp.rippleC = lastMinuteHighC - lastMinuteLowC;
+
+  return heatUp;
+}
+
+void report(const char *name, HeatUp heatUp, float targetC) {
+  printf("%s: overshoot %.1fC, at target in %.0fs, settled (+/- 1C) in %.0fs, then +/- %.1fC\n",
+         name, heatUp.peakC - targetC, heatUp.secondsToTarget, heatUp.secondsToSettle, heatUp.rippleC / 2);
+}
+
+// From cold, the model learns the boiler
+void checkColdStart() {
+  configureBrewHeater();
+  int boostsBefore = boostCount;
+
+  HeatUp heatUp = runHeater(900, TARGET_BREW_TEMP);
+  report("cold start to brew", heatUp, TARGET_BREW_TEMP);
+  printf("  %s\n", getThermalModel().c_str());
+
+  CHECK(isThermalModelTrusted());
+  CHECK(boostCount - boostsBefore <= 1);
+  CHECK(heatUp.peakC - TARGET_BREW_TEMP < 3.0);
+  CHECK_NEAR(boiler.tempC, TARGET_BREW_TEMP, 1.0);
+}
+
+// Up to steam temperature and back, boosting or not
+HeatUp stepToSteam(const char *name) {
+  int boostsBefore = boostCount;
+  int switchesBefore = boiler.heaterSwitchCount;
+
+  configureSteamHeater();
+  HeatUp heatUp = runHeater(600, TARGET_STEAM_TEMP);
+  report(name, heatUp, TARGET_STEAM_TEMP);
+
+  printf("  %d boosts, heater switched %d times\n",
+         boostCount - boostsBefore, boiler.heaterSwitchCount - switchesBefore);
+
+  configureBrewHeater();
+  runHeater(900, TARGET_BREW_TEMP);
+
+  // Bang-bang never settles, which is the point
+  if (!bangBang) {
+    CHECK_NEAR(boiler.tempC, TARGET_BREW_TEMP, 1.0);
+  }
+
+  return heatUp;
+}
+
+// The time to temperature the thermal model gives us (and we show while heating)
+// is with the heater on full, so that's what we hold it to.  Boosting stops
+// short and coasts the rest of the way, so it takes longer.
+void checkSecondsToReach(HeatUp boosted) {
+  int etaSeconds = thermalModelSecondsToReach(heaterState.measuredTemp, TARGET_STEAM_TEMP);
+
+  // The heater timer only ever switches the SSR while regulating, so it's ours
+  turnHeaterOff();
+  digitalWrite(HEATER, HIGH);
+
+  float seconds = 0;
+  while (boiler.tempC < TARGET_STEAM_TEMP && seconds < 600) {
+    advanceHostMicros(SIMULATED_BOILER_STEP_MILLIS * 1000);
+    boiler.step();
+    seconds += SIMULATED_BOILER_STEP_MILLIS / 1000.0f;
+  }
+  digitalWrite(HEATER, LOW);
+
+  printf("brew to steam: ETA %ds, at target in %.0fs on full, %.0fs boosting\n",
+         etaSeconds, seconds, boosted.secondsToTarget);
+  CHECK(etaSeconds > 0);
+  CHECK_NEAR(etaSeconds, seconds, max(2.0f, 0.15f * seconds));
+  CHECK(boosted.secondsToTarget >= seconds);
+
+  configureBrewHeater();
+  runHeater(900, TARGET_BREW_TEMP);
+  CHECK_NEAR(boiler.tempC, TARGET_BREW_TEMP, 1.0);
+}
+
+// Returns how it went with the PID only, for checkTimeProportioning()
+HeatUp checkBoost() {
+  float boostMinErrorC = HEATER_BOOST_MIN_ERROR_C;
+
+  HEATER_BOOST_MIN_ERROR_C = 1000;
+  HeatUp pidOnly = stepToSteam("brew to steam, PID only");
+
+  HEATER_BOOST_MIN_ERROR_C = boostMinErrorC;
+  int boostsBefore = boostCount;
+
+  HeatUp boosted = stepToSteam("brew to steam, boosting");
+
+  // One boost on the way up, and none on the way back down
+  CHECK(boostCount - boostsBefore == 1);
+
+  // Less overshoot, and settled sooner
+  CHECK(boosted.secondsToTarget > 0);
+  CHECK(boosted.peakC - TARGET_STEAM_TEMP < pidOnly.peakC - TARGET_STEAM_TEMP);
+  CHECK(boosted.peakC - TARGET_STEAM_TEMP < 2.0);
+  CHECK(boosted.secondsToSettle < pidOnly.secondsToSettle);
+
+  checkSecondsToReach(boosted);
+
+  return pidOnly;
+}
+
+// The same step to steam as the PID only (time proportioning, but no boosting)
+// in checkBoost(), with the bang-bang control we had before
+void checkTimeProportioning(HeatUp timeProportioned) {
+  float boostMinErrorC = HEATER_BOOST_MIN_ERROR_C;
+  HEATER_BOOST_MIN_ERROR_C = 1000;
+
+  // The heater timer only ever switches the SSR while regulating, so it's ours
+  turnHeaterOff();
+  bangBang = true;
+  bangBangOutput = 0;
+  bangBangPID.SetOutputLimits(0, 1);
+  bangBangPID.SetSampleTime(10);
+  bangBangPID.SetMode(PIDf::AUTOMATIC);
+
+  HeatUp bangBangHeatUp = stepToSteam("brew to steam, bang-bang");
+
+  bangBangPID.SetMode(PIDf::MANUAL);
+  bangBang = false;
+  HEATER_BOOST_MIN_ERROR_C = boostMinErrorC;
+
+  CHECK(timeProportioned.peakC < bangBangHeatUp.peakC);
+  CHECK(timeProportioned.secondsToSettle < bangBangHeatUp.secondsToSettle);
+  CHECK(timeProportioned.rippleC < bangBangHeatUp.rippleC);
+
+  // Back on time proportioning
+  runHeater(900, TARGET_BREW_TEMP);
+  CHECK_NEAR(boiler.tempC, TARGET_BREW_TEMP, 1.0);
+}
+
+// Turning the heater off and on again is a new heat up
+void checkRearm() {
+  turnHeaterOff();
+  CHECK(heaterState.boostArmed);
+
+  runHeater(120, TARGET_BREW_TEMP);
+  CHECK(!heaterState.boostArmed);
+
+  // Already close, so no boost
+  configureBrewHeater();
+  CHECK(!heaterState.boostArmed);
+}
+
+// Until the thermal model has seen enough of the boiler, the PID is on its own..
+// and once it has, the PID hands the holding power over to it without a bump
+void checkUntrustedModel() {
+  thermalModelState.updateCount = 0;
+
+  configureBrewHeater();
+  runHeater(20, TARGET_BREW_TEMP);
+  CHECK(!isThermalModelTrusted());
+  CHECK_NEAR(heaterState.heaterDutyCycle, constrain(heaterState.pidDutyCycle, 0.0f, 100.0f), 0.01);
+
+  float untrustedDutyCycle = heaterState.heaterDutyCycle;
+
+  HeatUp handover = runHeater(120, TARGET_BREW_TEMP);
+  printf("model trusted again: duty cycle %.1f%% (was %.1f%%, PID alone), then +/- %.1fC\n",
+         heaterState.heaterDutyCycle, untrustedDutyCycle, handover.rippleC / 2);
+  CHECK(isThermalModelTrusted());
+  CHECK(heaterState.pidDutyCycle < heaterState.heaterDutyCycle);
+  CHECK(handover.peakC - TARGET_BREW_TEMP < 1.0);
+  CHECK_NEAR(boiler.tempC, TARGET_BREW_TEMP, 0.5);
+}
+
+// Changing state just reconfigures the one PID.. nothing comes off the heap, so
+// nothing can fragment it
+void checkStateEntryDoesNotAllocate() {
+  int allocationsBefore = hostAllocationCount;
+  int freesBefore = hostFreeCount;
+
+  for (int shot = 0; shot < 100; shot++) {
+    configureBrewHeater();
+    runHeater(1, TARGET_BREW_TEMP);
+    configureSteamHeater();
+    runHeater(1, TARGET_STEAM_TEMP);
+    configureHotWaterDispenseHeater();
+    turnHeaterOff();
+  }
+
+  printf("100 trips round the heater states: %d allocations, %d frees\n",
+         hostAllocationCount - allocationsBefore, hostFreeCount - freesBefore);
+  CHECK(hostAllocationCount == allocationsBefore);
+  CHECK(hostFreeCount == freesBefore);
+}
+
+int main() {
+  attachSimulatedBoiler();
+  logLevel = GAGGIA_LOG_LEVEL_INFO;
+
+  heaterInit();
+  readTemperatureSensors();
+
+  checkColdStart();
+  HeatUp pidOnly = checkBoost();
+  checkTimeProportioning(pidOnly);
+  checkRearm();
+  checkUntrustedModel();
+  checkStateEntryDoesNotAllocate();
+
+  return testResult("HeaterTest");
+}
@@ -0,0 +1,101 @@
+#include "Test.h"
+#include "Common.h"
+
+#include <chrono>
+#include <math.h>
+
+// How much a GAGGIA_LOG_TRACE() in the loop costs (see Common.h): compiled out,
+// compiled in but turned off at runtime, and on.  Also checks each level goes 
+// to the matching Log level, and that arguments aren't evaluated unless the 
+// level is on.
+
+#define ITERATIONS 1000000
+
+volatile int argumentEvaluations = 0;
+
+float expensiveArgument(int i) {
+  argumentEvaluations++;
+  return sqrtf(i);
+}
+
+// GAGGIA_LOG_LEVEL is checked where the macro is used, so we can have it 
+// both ways in one file
+#undef GAGGIA_LOG_LEVEL
+#define GAGGIA_LOG_LEVEL GAGGIA_LOG_LEVEL_TRACE
+
+__attribute__((noinline)) void traceCompiledIn(int i) {
+  GAGGIA_LOG_TRACE("bench", "i: %d, sqrt: %.3f", i, expensiveArgument(i));
+}
+
+void logAtEveryLevel() {
+  GAGGIA_LOG_ERROR("bench", "error");
+  GAGGIA_LOG_INFO("bench", "info");
+  GAGGIA_LOG_TRACE("bench", "trace");
+}
+
+#undef GAGGIA_LOG_LEVEL
+#define GAGGIA_LOG_LEVEL GAGGIA_LOG_LEVEL_INFO
+
+__attribute__((noinline)) void traceCompiledOut(int i) {
+  GAGGIA_LOG_TRACE("bench", "i: %d, sqrt: %.3f", i, expensiveArgument(i));
+}
+
+// Nanoseconds per call
+double timeCalls(void (*call)(int)) {
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < ITERATIONS; i++) {
+    call(i);
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  return std::chrono::duration<double, std::nano>(end - start).count() / ITERATIONS;
+}
+
+void checkLevels() {
+  logLevel = GAGGIA_LOG_LEVEL_TRACE;
+  Log = Logger();
+
+  logAtEveryLevel();
+  CHECK(Log.errorCount == 1);
+  CHECK(Log.infoCount == 1);
+  CHECK(Log.traceCount == 1);
+
+  logLevel = GAGGIA_LOG_LEVEL_INFO;
+  logAtEveryLevel();
+  CHECK(Log.errorCount == 2);
+  CHECK(Log.infoCount == 2);
+  CHECK(Log.traceCount == 1);
+
+  logLevel = GAGGIA_LOG_LEVEL_NONE;
+  logAtEveryLevel();
+  CHECK(Log.errorCount == 2);
+}
+
+void benchmark() {
+  logLevel = GAGGIA_LOG_LEVEL_TRACE;
+  argumentEvaluations = 0;
+  double compiledOut = timeCalls(traceCompiledOut);
+  CHECK(argumentEvaluations == 0);
+
+  logLevel = GAGGIA_LOG_LEVEL_ERROR;
+  argumentEvaluations = 0;
+  double turnedOff = timeCalls(traceCompiledIn);
+  CHECK(argumentEvaluations == 0);
+
+  logLevel = GAGGIA_LOG_LEVEL_TRACE;
+  argumentEvaluations = 0;
+  double on = timeCalls(traceCompiledIn);
+  CHECK(argumentEvaluations == ITERATIONS);
+
+  printf("GAGGIA_LOG_TRACE: compiled out %.1fns, turned off %.1fns, on %.1fns (formatting, no output)\n",
+         compiledOut, turnedOff, on);
+
+  CHECK(turnedOff < on / 10);
+}
+
+int main() {
+  checkLevels();
+  benchmark();
+
+  return testResult("LogBench");
+}
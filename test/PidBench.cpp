@@ -0,0 +1,148 @@
+#include "Test.h"
+#include <pid.h>
+
+#include <chrono>
+#include <math.h>
+#include <random>
+
+// The PID library is templated on its numeric type (see lib/pid/src/pid.h).  This
+// runs PID (double) and PIDf (float) side by side on the pressure loop (same
+// tuning and rate as WaterPump.cpp) to show float gives the same answers, and 
+// times Compute() for each.
+//
+// The timing is on this machine, which does double precision in hardware.  The
+// Argon's FPU only does single precision, so there the gap is much wider.
+
+#define CONTROL_PERIOD_MILLIS 10
+#define SHOT_STEPS 3000
+#define SHOTS 100
+
+#define TIMING_ITERATIONS 10000000
+
+// Pump pressure, roughly.. first order towards 15 bar at full duty cycle
+struct Plant {
+  double pressure = 0;
+
+  void step(double pumpDutyCycle, double seconds) {
+    pressure += (pumpDutyCycle / 100.0 * 15.0 - pressure) * seconds / 0.3;
+  }
+};
+
+double targetPressure(int step) {
+  return step < 2000 ? 9.0 : 6.0;
+}
+
+template <typename Real>
+struct PressureLoop {
+  Real measured = 0;
+  Real output = 0;
+  Real setpoint = 0;
+  BasicPID<Real> pid;
+
+  PressureLoop() : pid(&measured, &output, &setpoint, 4.0, 8.0, 0.0, PIDTypes::DIRECT) {
+    pid.SetOutputLimits(0, 100);
+    pid.SetSampleTime(CONTROL_PERIOD_MILLIS);
+    pid.SetMode(PIDTypes::AUTOMATIC);
+  }
+
+  double compute(double measuredPressure, double target) {
+    measured = measuredPressure;
+    setpoint = target;
+    pid.Compute((Real) (CONTROL_PERIOD_MILLIS / 1000.0));
+    return output;
+  }
+};
+
+// Both fed exactly the same (noisy) measurements, from the double loop's plant
+void compareSameInputs() {
+  std::mt19937 random(9);
+  std::normal_distribution<double> noise(0, 0.05);
+
+  double worstDifference = 0;
+
+  for (int shot = 0; shot < SHOTS; shot++) {
+    PressureLoop<double> pidDouble;
+    PressureLoop<float> pidFloat;
+    Plant plant;
+
+    for (int step = 0; step < SHOT_STEPS; step++) {
+      double measured = plant.pressure + noise(random);
+
+      double outputDouble = pidDouble.compute(measured, targetPressure(step));
+      double outputFloat = pidFloat.compute(measured, targetPressure(step));
+
+      worstDifference = fmax(worstDifference, fabs(outputDouble - outputFloat));
+
+      plant.step(outputDouble, CONTROL_PERIOD_MILLIS / 1000.0);
+    }
+  }
+
+  printf("same inputs, %d shots: worst pump duty cycle difference %.6f%%\n", SHOTS, worstDifference);
+
+  // The pump only resolves whole mains cycles in an epoch, far coarser than this
+  CHECK(worstDifference < 0.01);
+}
+
+// Each in its own loop, so any difference can build up
+void compareClosedLoop() {
+  double worstDifference = 0;
+  double sumSquaredErrorDouble = 0;
+  double sumSquaredErrorFloat = 0;
+
+  for (int shot = 0; shot < SHOTS; shot++) {
+    PressureLoop<double> pidDouble;
+    PressureLoop<float> pidFloat;
+    Plant plantDouble;
+    Plant plantFloat;
+
+    for (int step = 0; step < SHOT_STEPS; step++) {
+      double target = targetPressure(step);
+
+      plantDouble.step(pidDouble.compute(plantDouble.pressure, target), CONTROL_PERIOD_MILLIS / 1000.0);
+      plantFloat.step(pidFloat.compute(plantFloat.pressure, target), CONTROL_PERIOD_MILLIS / 1000.0);
+
+      worstDifference = fmax(worstDifference, fabs(plantDouble.pressure - plantFloat.pressure));
+      sumSquaredErrorDouble += pow(plantDouble.pressure - target, 2);
+      sumSquaredErrorFloat += pow(plantFloat.pressure - target, 2);
+    }
+  }
+
+  int steps = SHOTS * SHOT_STEPS;
+  printf("closed loop, %d shots: worst pressure difference %.6f bar, rms error %.4f bar (double) %.4f bar (float)\n",
+         SHOTS, worstDifference, sqrt(sumSquaredErrorDouble / steps), sqrt(sumSquaredErrorFloat / steps));
+
+  CHECK(worstDifference < 0.001);
+}
+
+template <typename Real>
+double nanosPerCompute() {
+  PressureLoop<Real> loop;
+
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < TIMING_ITERATIONS; i++) {
+    loop.measured = (Real) (8.5 + (i & 15) * 0.0625);
+    loop.pid.Compute((Real) 0.01);
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  // So the loop can't be thrown away
+  volatile Real output = loop.output;
+  (void) output;
+
+  return std::chrono::duration<double, std::nano>(end - start).count() / TIMING_ITERATIONS;
+}
+
+void compareTiming() {
+  double nanosDouble = nanosPerCompute<double>();
+  double nanosFloat = nanosPerCompute<float>();
+
+  printf("Compute(dt) on this machine: %.1fns (double), %.1fns (float)\n", nanosDouble, nanosFloat);
+}
+
+int main() {
+  compareSameInputs();
+  compareClosedLoop();
+  compareTiming();
+
+  return testResult("PidBench");
+}
@@ -0,0 +1,125 @@
+#include "Test.h"
+#include "Pressure.h"
+
+// Feeds readPressureState() (see Pressure.cpp) a pump-like pressure, with the
+// ripple a vibe pump puts on the line at mains frequency, and calls it every
+// 10ms (give or take) like the pressure control task does.  The reading should
+// follow the average pressure, not wherever the ripple happens to be.
+
+#define PRESSURE_SENSOR_ANALOG_IN A0
+
+extern float PRESSURE_SENSOR_SCALE_FACTOR;
+extern int PRESSURE_SENSOR_OFFSET;
+
+float averageBars = 9.0;
+float mainsHz = 50.0;
+
+// Peak ripple at mains frequency, and at twice it
+float rippleBars = 1.5;
+float harmonicBars = 0.5;
+
+// ADC noise, in counts
+float adcNoiseCounts = 3.0;
+
+uint32_t randomState = 1;
+
+float randomUniform() {
+  randomState = randomState * 1103515245 + 12345;
+  return ((randomState >> 8) & 0xFFFF) / 65536.0f;
+}
+
+float linePressure() {
+  float phase = 2 * M_PI * mainsHz * (hostMicros / 1000000.0);
+  return averageBars + rippleBars * sinf(phase) + harmonicBars * sinf(2 * phase);
+}
+
+// Each conversion takes ~12us
+int32_t readPressureSensor() {
+  advanceHostMicros(12);
+
+  float noise = (randomUniform() + randomUniform() + randomUniform() - 1.5f) * 2 * adcNoiseCounts;
+  return lroundf(PRESSURE_SENSOR_OFFSET + linePressure() * PRESSURE_SENSOR_SCALE_FACTOR + noise);
+}
+
+// What a single back to back burst of 32 reads (how we used to read it) gets
+float readBurst() {
+  uint32_t sum = 0;
+  for (int i = 0; i < 32; i++) {
+    sum += readPressureSensor();
+  }
+  return ((float)sum / 32 - PRESSURE_SENSOR_OFFSET) / PRESSURE_SENSOR_SCALE_FACTOR;
+}
+
+// Next tick of the pressure control task, 10ms on with a little jitter
+void waitForTick() {
+  advanceHostMicros(10000 - 300 + (uint64_t) (randomUniform() * 600));
+}
+
+// RMS error of the reading over a few seconds, against the burst
+void checkRipple(float hz) {
+  mainsHz = hz;
+
+  float errorSum = 0.0;
+  float burstErrorSum = 0.0;
+  int count = 0;
+
+  for (int tick = 0; tick < 500; tick++) {
+    waitForTick();
+
+    readPressureState();
+    float error = pressureState.measuredPressureInBars - averageBars;
+
+    float burstError = readBurst() - averageBars;
+
+    if (tick >= 10) {
+      errorSum += error * error;
+      burstErrorSum += burstError * burstError;
+      count++;
+    }
+  }
+
+  float rmsError = sqrtf(errorSum / count);
+  float burstRmsError = sqrtf(burstErrorSum / count);
+
+  printf("%.0fHz ripple: %.3f bar rms (single burst %.3f), noise floor says %.3f\n",
+         hz, rmsError, burstRmsError, pressureState.noiseFloorBars);
+
+  CHECK(rmsError < burstRmsError / 2);
+
+  // The noise floor should be about right
+  CHECK(pressureState.noiseFloorBars > rmsError / 3);
+  CHECK(pressureState.noiseFloorBars < rmsError * 3);
+}
+
+// A step in pressure has fully shown up once it's filled the window (40ms)
+void checkStep() {
+  averageBars = 3.0;
+  for (int tick = 0; tick < 50; tick++) {
+    waitForTick();
+    readPressureState();
+  }
+
+  averageBars = 9.0;
+  waitForTick();
+  readPressureState();
+  CHECK(pressureState.measuredPressureInBars > 3.5);
+
+  for (int tick = 0; tick < 3; tick++) {
+    waitForTick();
+    readPressureState();
+  }
+  CHECK_NEAR(pressureState.measuredPressureInBars, 9.0, 0.7);
+}
+
+int main() {
+  hostPins[PRESSURE_SENSOR_ANALOG_IN].analogSource = readPressureSensor;
+
+  pressureInit();
+
+  checkRipple(50.0);
+  checkRipple(50.2);
+  checkRipple(60.0);
+  checkStep();
+
+  return testResult("PressureTest");
+}
@@ -0,0 +1,320 @@
+#include "Test.h"
+#include "WaterPump.h"
+#include "FlowEstimator.h"
+#include "Bluetooth.h"
+
+#include <math.h>
+#include <random>
+
+// Pulls a simulated shot with the pump (see WaterPump.cpp) driving a simulated
+// vibe pump, puck and scale.  The firmware's own interrupt handler switches the
+// pump every mains half cycle, the pressure control task runs off the simulated
+// pressure sensor, and the flow PID off the flow estimate from the simulated scale.
+//
+// Part way through the shot the mains sags (the pump puts out less), and later the
+// puck channels (its resistance drops suddenly).  We compare the cascade (flow PID
+// setting the pressure PID's target) with what it replaced: the flow PID driving
+// the pump directly off the scale.  Then we try the cascade with other integral 
+// gains, which is where the current ones came from.
+
+#define PRESSURE_SENSOR_ANALOG_IN A0
+#define ZERO_CROSS_DISPENSE_POT A2
+#define DISPENSE_POT D7
+
+extern Timer *pressureControlTimer;
+extern int PRESSURE_CONTROL_PERIOD_MILLIS;
+extern float PRESSURE_SENSOR_SCALE_FACTOR;
+extern int PRESSURE_SENSOR_OFFSET;
+extern double TARGET_FLOW_RATE;
+extern double flow_PID_kI;
+extern PIDf pressurePID;
+
+// What the pump needs from the rest of the firmware
+void sendMessageOverBLE(const char *) {
+}
+
+#define STEP_MICROS 1000
+#define HALF_CYCLE_MICROS 10000
+#define SCALE_READING_MICROS 25000
+
+#define PREINFUSION_SECONDS 8
+#define BREWING_SECONDS 30
+#define CHANNEL_SECONDS 20
+
+// We score the flow from this far into brewing, and for this long after each
+// disturbance
+#define BREWING_SETTLE_SECONDS 5
+#define DISTURBANCE_SECONDS 6
+
+// Every result is the average of this many shots, each with its own sensor noise
+#define SHOTS 8
+
+// Vibe pump: flow falls off linearly with the pressure it's pushing against
+#define PUMP_MAX_FLOW_GPS 8.0
+#define PUMP_MAX_BAR 15.0
+
+// How much water it takes to raise the pressure in the group by a bar
+#define GROUP_COMPLIANCE_GRAMS_PER_BAR 1.0
+
+// Water the puck soaks up before anything comes out
+#define PUCK_ABSORBS_GRAMS 12.0
+
+// Bar per gram/second through the puck, at the start.. it erodes as the shot 
+// goes on, and drops suddenly when it channels
+#define PUCK_RESISTANCE 2.5
+#define PUCK_EROSION 0.25
+#define PUCK_CHANNEL 0.6
+
+// Somebody switches the kettle on, and the mains sags.. the pump puts out
+// this much less for a few seconds
+#define SAG_SECONDS 12
+#define SAG_LENGTH_SECONDS 4
+#define SAG_PUMP_FLOW 0.75
+
+// From the bottom of the basket to the cup
+#define DRIP_DELAY_MICROS 500000
+
+std::mt19937 randomNumbers(16);
+std::normal_distribution<float> normal(0, 1);
+
+struct Espresso {
+  float pressureBars = 0;
+  float absorbedGrams = 0;
+
+  // Through the puck right now, and what's landed in the cup
+  float flowRateGPS = 0;
+  float cupGrams = 0;
+
+  // What's on its way to the cup, one slot per step
+  float dripping[DRIP_DELAY_MICROS / STEP_MICROS] = { 0 };
+  int drippingIndex = 0;
+
+  // Whether the pump has power this half cycle
+  boolean pumpOn = false;
+
+  float puckResistance(float brewingSeconds) {
+    float resistance = PUCK_RESISTANCE * (1 - PUCK_EROSION * constrain(brewingSeconds / BREWING_SECONDS, 0.0f, 1.0f));
+    if (brewingSeconds >= CHANNEL_SECONDS) {
+      resistance *= PUCK_CHANNEL;
+    }
+    return resistance;
+  }
+
+  void step(float brewingSeconds) {
+    float seconds = STEP_MICROS / 1e6f;
+
+    float pumpGPS = pumpOn ? PUMP_MAX_FLOW_GPS * max(0.0f, 1 - pressureBars / (float) PUMP_MAX_BAR) : 0;
+    if (brewingSeconds >= SAG_SECONDS && brewingSeconds < SAG_SECONDS + SAG_LENGTH_SECONDS) {
+      pumpGPS *= SAG_PUMP_FLOW;
+    }
+
+    float throughPuckGPS = pressureBars / puckResistance(brewingSeconds);
+
+    // Until the puck is soaked, what goes through it stays in it
+    flowRateGPS = 0;
+    if (absorbedGrams < PUCK_ABSORBS_GRAMS) {
+      absorbedGrams += throughPuckGPS * seconds;
+    } else {
+      flowRateGPS = throughPuckGPS;
+    }
+
+    pressureBars += (pumpGPS - throughPuckGPS) * seconds / GROUP_COMPLIANCE_GRAMS_PER_BAR;
+    pressureBars = max(pressureBars, 0.0f);
+
+    cupGrams += dripping[drippingIndex];
+    dripping[drippingIndex] = flowRateGPS * seconds;
+    drippingIndex = (drippingIndex + 1) % (DRIP_DELAY_MICROS / STEP_MICROS);
+  }
+};
+
+Espresso espresso;
+
+int32_t readPressureSensor() {
+  return lroundf(PRESSURE_SENSOR_OFFSET + espresso.pressureBars * PRESSURE_SENSOR_SCALE_FACTOR + 3 * normal(randomNumbers));
+}
+
+// The flow PID as it used to be, driving the pump duty cycle straight off the
+// scale.. same gains and sample time as it had
+float scaleOnlyFlowRate = 0;
+float scaleOnlyDutyCycle = 0;
+float scaleOnlyTarget = 0;
+PIDf scaleOnlyPID(&scaleOnlyFlowRate, &scaleOnlyDutyCycle, &scaleOnlyTarget, 30, 0.08, 0, PIDf::DIRECT);
+
+struct ShotResult {
+
+  // Of the flow through the puck from the target, from BREWING_SETTLE_SECONDS in
+  float rmsFlowErrorGPS;
+
+  // Furthest the flow (over half a second, like the cup sees it) strays while 
+  // the mains sags and the loop catches up
+  float worstSagErrorGPS;
+
+  // Extra coffee in the cup from the puck channeling, in the DISTURBANCE_SECONDS after
+  float channelExtraGrams;
+};
+
+ShotResult pullShot(boolean cascade) {
+  espresso = Espresso();
+  resetFlowEstimate();
+
+  configureWaterPump(PREINFUSION);
+  startDispensingWater(true);
+
+  uint64_t startMicros = hostMicros;
+  uint64_t nextHalfCycleMicros = startMicros;
+  uint64_t nextPressureControlMicros = startMicros + 3000;
+  uint64_t nextScaleReadingMicros = startMicros;
+  uint64_t nextScaleOnlyMicros = 0;
+
+  // The load cell and the scale's filtering lag behind what's in the cup
+  float scaleGrams = 0;
+
+  boolean brewing = false;
+  double sumSquaredError = 0;
+  int errorCount = 0;
+
+  ShotResult result = { 0, 0, 0 };
+  float smoothedFlowGPS = 0;
+
+  while (hostMicros - startMicros < (PREINFUSION_SECONDS + BREWING_SECONDS) * 1000000ULL) {
+    advanceHostMicros(STEP_MICROS);
+    float seconds = (hostMicros - startMicros) / 1e6f;
+    float brewingSeconds = seconds - PREINFUSION_SECONDS;
+
+    if (!brewing && brewingSeconds >= 0) {
+      brewing = true;
+      configureWaterPump(BREWING);
+
+      if (!cascade) {
+        scaleOnlyDutyCycle = waterPumpState.pumpDutyCycle;
+        scaleOnlyTarget = TARGET_FLOW_RATE;
+        scaleOnlyPID.SetOutputLimits(MIN_PUMP_DUTY_CYCLE, MAX_PUMP_DUTY_CYCLE);
+        scaleOnlyPID.SetSampleTime(10);
+        scaleOnlyPID.SetMode(PIDf::AUTOMATIC);
+      }
+    }
+
+    // The zero crossing interrupt decides whether the pump gets this half cycle
+    if (hostMicros >= nextHalfCycleMicros) {
+      nextHalfCycleMicros += HALF_CYCLE_MICROS;
+      if (hostPins[ZERO_CROSS_DISPENSE_POT].interruptHandler != nullptr) {
+        hostPins[ZERO_CROSS_DISPENSE_POT].interruptHandler();
+      }
+      espresso.pumpOn = hostPins[DISPENSE_POT].level == HIGH;
+    }
+
+    espresso.step(brewingSeconds);
+
+    if (hostMicros >= nextScaleReadingMicros) {
+      nextScaleReadingMicros += SCALE_READING_MICROS;
+      scaleGrams += (espresso.cupGrams - scaleGrams) * 0.3f;
+      updateFlowEstimate(scaleGrams + 0.15f * normal(randomNumbers), millis());
+    }
+
+    if (cascade || !brewing) {
+      if (hostMicros >= nextPressureControlMicros) {
+        nextPressureControlMicros += PRESSURE_CONTROL_PERIOD_MILLIS * 1000;
+        pressureControlTimer->callback();
+      }
+      updateFlowRateMetricIfNecessary();
+
+    } else if (hostMicros >= nextScaleOnlyMicros) {
+      nextScaleOnlyMicros = hostMicros + 100000;
+      waterPumpState.flowRateGPS = flowEstimatorState.flowRateGPS;
+      scaleOnlyFlowRate = waterPumpState.flowRateGPS;
+      scaleOnlyPID.Compute();
+      publishPumpDutyCycle(scaleOnlyDutyCycle);
+    }
+
+    smoothedFlowGPS += (espresso.flowRateGPS - smoothedFlowGPS) * STEP_MICROS / 500000.0f;
+
+    // How well the flow through the puck follows the target, once it's had a
+    // few seconds to get going
+    if (brewingSeconds >= BREWING_SETTLE_SECONDS) {
+      float errorGPS = espresso.flowRateGPS - TARGET_FLOW_RATE;
+      sumSquaredError += errorGPS * errorGPS;
+      errorCount++;
+    }
+
+    if (brewingSeconds >= SAG_SECONDS && brewingSeconds < SAG_SECONDS + DISTURBANCE_SECONDS) {
+      result.worstSagErrorGPS = max(result.worstSagErrorGPS, fabsf(smoothedFlowGPS - (float) TARGET_FLOW_RATE));
+    }
+
+    if (brewingSeconds >= CHANNEL_SECONDS && brewingSeconds < CHANNEL_SECONDS + DISTURBANCE_SECONDS) {
+      result.channelExtraGrams += (espresso.flowRateGPS - TARGET_FLOW_RATE) * STEP_MICROS / 1e6f;
+    }
+  }
+
+  stopDispensingWater();
+  scaleOnlyPID.SetMode(PIDf::MANUAL);
+
+  result.rmsFlowErrorGPS = sqrt(sumSquaredError / errorCount);
+
+  return result;
+}
+
+// Pulls SHOTS shots, and averages what we measured
+ShotResult pullShots(boolean cascade) {
+  ShotResult total = { 0, 0, 0 };
+
+  for (int shot = 0; shot < SHOTS; shot++) {
+    randomNumbers.seed(shot);
+    ShotResult result = pullShot(cascade);
+
+    total.rmsFlowErrorGPS += result.rmsFlowErrorGPS / SHOTS;
+    total.worstSagErrorGPS += result.worstSagErrorGPS / SHOTS;
+    total.channelExtraGrams += result.channelExtraGrams / SHOTS;
+  }
+
+  return total;
+}
+
+void report(const char *name, ShotResult result) {
+  printf("  %-38s rms flow error %.2f g/s, mains sag: off by up to %.2f g/s, channeling: %+.1f g extra\n",
+         name, result.rmsFlowErrorGPS, result.worstSagErrorGPS, result.channelExtraGrams);
+}
+
+int main() {
+  hostPins[PRESSURE_SENSOR_ANALOG_IN].analogSource = readPressureSensor;
+
+  waterPumpInit();
+
+  printf("target %.1f g/s, the mains sags %ds into brewing, the puck channels at %ds\n", 
+         TARGET_FLOW_RATE, SAG_SECONDS, CHANNEL_SECONDS);
+
+  ShotResult cascade = pullShots(true);
+  ShotResult scaleOnly = pullShots(false);
+
+  report("cascade", cascade);
+  report("scale only", scaleOnly);
+
+  // The pressure PID takes up a sag in the pump before the scale sees it..  but
+  // holding the pressure while the puck channels pushes more through it, and the
+  // flow PID only takes that back once the scale notices.
+  CHECK(cascade.rmsFlowErrorGPS < 0.75f * scaleOnly.rmsFlowErrorGPS);
+  CHECK(cascade.worstSagErrorGPS < 0.75f * scaleOnly.worstSagErrorGPS);
+
+  float pressureKI = pressure_PID_kI;
+  double flowKI = flow_PID_kI;
+  float pressureKIs[] = { 8, 20, 40 };
+  double flowKIs[] = { 0.5, 1.0, 2.0 };
+
+  for (float pressureCandidate : pressureKIs) {
+    for (double flowCandidate : flowKIs) {
+      pressurePID.SetTunings(pressure_PID_kP, pressureCandidate, pressure_PID_kD);
+      flow_PID_kI = flowCandidate;
+
+      ShotResult result = pullShots(true);
+
+      char name[64];
+      snprintf(name, sizeof(name), "pressure kI %.0f, flow kI %.1f%s", pressureCandidate, flowCandidate,
+               pressureCandidate == pressureKI && flowCandidate == flowKI ? " (current)" : "");
+      report(name, result);
+    }
+  }
+
+  pressurePID.SetTunings(pressure_PID_kP, pressureKI, pressure_PID_kD);
+  flow_PID_kI = flowKI;
+
+  return testResult("PumpCascadeSim");
+}
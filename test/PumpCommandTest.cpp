@@ -0,0 +1,133 @@
+#include "Test.h"
+#include "PumpPattern.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+// Hammers the pump command (see pumpCommand()) from writer threads, standing
+// in for the pressure control task, while reader threads stand in for the zero
+// crossing interrupt.  Every load has to be a duty cycle and its own pattern.
+//
+// For comparison, the same again with the duty cycle and pattern in two
+// separate atomics (how they used to be published), which does tear.  The
+// writers spin a little after every store, so that even on a single core the
+// readers (like an interrupt) often get to run part way through publishing.
+
+#define CYCLES_IN_EPOCH 10
+#define WRITER_COUNT 2
+#define READER_COUNT 2
+#define ITERATIONS 200000
+
+uint32_t patterns[101];
+
+std::atomic<uint32_t> command(0);
+
+std::atomic<uint32_t> separatePattern(0);
+std::atomic<uint32_t> separateDutyCycle(0);
+
+std::atomic<bool> running(true);
+
+void spin() {
+  for (volatile int i = 0; i < 50; i++) {
+  }
+}
+
+void writeCommands(int seed) {
+  for (int i = 0; i < ITERATIONS; i++) {
+    int dutyCycle = (i * 37 + seed * 53) % 101;
+    command.store(pumpCommand(dutyCycle, patterns[dutyCycle]), std::memory_order_release);
+    spin();
+  }
+}
+
+void writeSeparately(int seed) {
+  for (int i = 0; i < ITERATIONS; i++) {
+    int dutyCycle = (i * 37 + seed * 53) % 101;
+    separatePattern.store(patterns[dutyCycle], std::memory_order_release);
+    spin();
+    separateDutyCycle.store(dutyCycle, std::memory_order_release);
+    spin();
+  }
+}
+
+void readCommands(long *reads, long *torn) {
+  while (running.load(std::memory_order_relaxed)) {
+    uint32_t loaded = command.load(std::memory_order_acquire);
+    int dutyCycle = pumpCommandDutyCycle(loaded);
+    if (dutyCycle > 100 || pumpCommandPattern(loaded) != patterns[dutyCycle]) {
+      (*torn)++;
+    }
+    (*reads)++;
+  }
+}
+
+void readSeparately(long *reads, long *torn) {
+  while (running.load(std::memory_order_relaxed)) {
+    uint32_t pattern = separatePattern.load(std::memory_order_acquire);
+    uint32_t dutyCycle = separateDutyCycle.load(std::memory_order_acquire);
+    if (dutyCycle > 100 || pattern != patterns[dutyCycle]) {
+      (*torn)++;
+    }
+    (*reads)++;
+  }
+}
+
+void stress(void (*writer)(int), void (*reader)(long *, long *), long *reads, long *torn) {
+  running = true;
+
+  long readerReads[READER_COUNT] = { 0 };
+  long readerTorn[READER_COUNT] = { 0 };
+
+  std::vector<std::thread> readers;
+  for (int i = 0; i < READER_COUNT; i++) {
+    readers.emplace_back(reader, &readerReads[i], &readerTorn[i]);
+  }
+
+  std::vector<std::thread> writers;
+  for (int i = 0; i < WRITER_COUNT; i++) {
+    writers.emplace_back(writer, i);
+  }
+  for (auto &thread : writers) {
+    thread.join();
+  }
+
+  running = false;
+  for (auto &thread : readers) {
+    thread.join();
+  }
+
+  *reads = 0;
+  *torn = 0;
+  for (int i = 0; i < READER_COUNT; i++) {
+    *reads += readerReads[i];
+    *torn += readerTorn[i];
+  }
+}
+
+int main() {
+  for (int dutyCycle = 0; dutyCycle <= 100; dutyCycle++) {
+    patterns[dutyCycle] = pumpPattern(dutyCycle, CYCLES_IN_EPOCH);
+  }
+
+  // Everything packs and unpacks, up to the longest pattern there's room for
+  for (int dutyCycle = 0; dutyCycle <= 100; dutyCycle++) {
+    uint32_t pattern = pumpPattern(dutyCycle, PUMP_COMMAND_MAX_CYCLES);
+    uint32_t packed = pumpCommand(dutyCycle, pattern);
+    CHECK(pumpCommandDutyCycle(packed) == dutyCycle);
+    CHECK(pumpCommandPattern(packed) == pattern);
+  }
+
+  long reads;
+  long torn;
+
+  stress(writeCommands, readCommands, &reads, &torn);
+  printf("one word: %ld torn of %ld reads\n", torn, reads);
+  CHECK(reads > 0);
+  CHECK(torn == 0);
+
+  stress(writeSeparately, readSeparately, &reads, &torn);
+  printf("two words (for comparison): %ld torn of %ld reads\n", torn, reads);
+
+  return testResult("PumpCommandTest");
+}
@@ -0,0 +1,104 @@
+#include "Test.h"
+#include "PumpPattern.h"
+
+#include <chrono>
+
+// Checks the pulse-skip patterns (see pumpPattern()) for every duty cycle
+// and epoch length:  the right number of 'on' cycles, spread as evenly as
+// they can be.  Also reports how far each pattern strays from the ideal
+// and what the ISR's per-cycle work costs on this machine.
+
+int onCycleCount(uint32_t pattern) {
+  int count = 0;
+  for (; pattern; pattern >>= 1) {
+    count += pattern & 1;
+  }
+  return count;
+}
+
+int main() {
+  double worstDistributionError = 0;
+
+  for (int cycles = 1; cycles <= PUMP_PATTERN_MAX_CYCLES; cycles++) {
+    for (int dutyCycle = 0; dutyCycle <= 100; dutyCycle++) {
+      uint32_t pattern = pumpPattern(dutyCycle, cycles);
+      int expectedOnCycles = cycles * dutyCycle / 100;
+
+      CHECK(onCycleCount(pattern) == expectedOnCycles);
+
+      // Nothing outside the epoch
+      if (cycles < 32) {
+        CHECK((pattern >> cycles) == 0);
+      }
+
+      // Part way through the epoch, the 'on' count is never more than a cycle
+      // from where it would be if power were spread perfectly evenly
+      int onSoFar = 0;
+      for (int cycle = 0; cycle < cycles; cycle++) {
+        onSoFar += (pattern >> cycle) & 1;
+
+        double ideal = (double) expectedOnCycles * (cycle + 1) / cycles;
+        double error = onSoFar > ideal ? onSoFar - ideal : ideal - onSoFar;
+        CHECK(error <= 1.0);
+
+        if (error > worstDistributionError) {
+          worstDistributionError = error;
+        }
+      }
+
+      // Gaps between 'on' cycles (going round the end of the epoch, since
+      // epochs run back to back) differ by at most one cycle
+      if (expectedOnCycles > 0) {
+        int shortestGap = cycles + 1;
+        int longestGap = 0;
+        int lastOn = -1;
+        int firstOn = -1;
+        for (int cycle = 0; cycle < cycles; cycle++) {
+          if ((pattern >> cycle) & 1) {
+            if (lastOn >= 0) {
+              int gap = cycle - lastOn;
+              shortestGap = gap < shortestGap ? gap : shortestGap;
+              longestGap = gap > longestGap ? gap : longestGap;
+            } else {
+              firstOn = cycle;
+            }
+            lastOn = cycle;
+          }
+        }
+        int wrapGap = firstOn + cycles - lastOn;
+        shortestGap = wrapGap < shortestGap ? wrapGap : shortestGap;
+        longestGap = wrapGap > longestGap ? wrapGap : longestGap;
+
+        CHECK(longestGap - shortestGap <= 1);
+      }
+    }
+  }
+
+  // Out of range duty cycles are clamped
+  CHECK(pumpPattern(-5, 10) == 0);
+  CHECK(pumpPattern(150, 10) == pumpPattern(100, 10));
+  CHECK(pumpPattern(50, 0) == 0);
+
+  printf("worst distribution error: %.2f cycles\n", worstDistributionError);
+
+  // All the ISR does per cycle now is a shift and a mask.  This is on the
+  // host, so it's only a guide.. but there's no maths left in it to get slow
+  // on the Argon.
+  uint32_t patterns[101];
+  for (int dutyCycle = 0; dutyCycle <= 100; dutyCycle++) {
+    patterns[dutyCycle] = pumpPattern(dutyCycle, 10);
+  }
+
+  const int iterations = 10000000;
+  volatile uint32_t sink = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; i++) {
+    sink = sink + ((patterns[i % 101] >> (i % 10)) & 1);
+  }
+  auto nanos = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+  printf("ISR per cycle: %.2fns (host)\n", nanos / iterations);
+
+  return testResult("PumpPatternTest");
+}
@@ -0,0 +1,171 @@
+#include "Test.h"
+#include "SimulatedNAU7802.h"
+
+#include <SparkFun_Qwiic_Scale_NAU7802_Arduino_Library.h>
+
+// Profiles how much I2C it takes to keep up with the NAU7802 at 40Hz, three ways:
+//
+//   available() then getReading(), as we used to
+//   one burst from PU_CTRL through ADCO_B0.. one transaction instead of two, but
+//     21 registers rather than the status register plus the three ADCO ones
+//   getReadingIfAvailable(), as Scale.cpp does now.. the status register, then the
+//     three ADCO ones if there's a conversion, each under a repeated start
+//
+// each asked every loop, and only once the next conversion could be done (as
+// Scale.cpp does).  The host's Wire takes as long as each transfer would at
+// 400kHz, plus a fixed overhead per transfer for Device OS and the TWI peripheral.
+// We don't know that overhead, so we try a few and work out where the burst
+// would start to win.
+
+#define SAMPLES_PER_SECOND 40
+#define RUN_SECONDS 10
+#define LOOP_MICROS 1000
+
+SimulatedNAU7802 nau7802;
+NAU7802 scale;
+
+enum ReadMethod {
+  SEPARATE,
+  BURST,
+  IF_AVAILABLE,
+  READ_METHOD_COUNT
+};
+
+const char *readMethodNames[] = { "available() + getReading()", "21 register burst", "getReadingIfAvailable()" };
+
+struct BusUse {
+  int readings;
+  uint32_t busMicros;
+  uint32_t transfers;
+  uint32_t bytes;
+
+  void report(const char *name, const char *when) {
+    printf("  %-28s %-11s %5.2f transfers, %5.1f bytes, %6.1fus a reading, bus %4.1f%% busy\n",
+           name, when, transfers / (float) readings, bytes / (float) readings,
+           busMicros / (float) readings, busMicros / (RUN_SECONDS * 1e4f));
+  }
+};
+
+// How getReadingIfAvailable() used to do it
+bool getReadingInOneBurst(int32_t *reading) {
+  const uint8_t burstLength = NAU7802_ADCO_B0 - NAU7802_PU_CTRL + 1;
+
+  Wire.beginTransmission(0x2A);
+  Wire.write(NAU7802_PU_CTRL);
+  if (Wire.endTransmission(false) != 0 || Wire.requestFrom(0x2A, burstLength) != burstLength) {
+    return false;
+  }
+
+  uint8_t registers[burstLength];
+  for (uint8_t i = 0; i < burstLength; i++) {
+    registers[i] = Wire.read();
+  }
+
+  if ((registers[NAU7802_PU_CTRL] & (1 << NAU7802_PU_CTRL_CR)) == 0) {
+    return false;
+  }
+
+  *reading = ((int32_t) (int8_t) registers[NAU7802_ADCO_B2] << 16) |
+             (registers[NAU7802_ADCO_B1] << 8) | registers[NAU7802_ADCO_B0];
+  return true;
+}
+
+// One pass of loop() every LOOP_MICROS.  With 'gated', we don't ask until the
+// next conversion could be done (like Scale.cpp), otherwise we ask every loop.
+BusUse run(ReadMethod method, boolean gated) {
+  Wire.transferCount = 0;
+  Wire.bytesClocked = 0;
+  scale.resetBusStats();
+
+  BusUse use = { 0, 0, 0, 0 };
+  uint64_t startMicros = hostMicros;
+  uint32_t idleMicros = 0;
+  uint64_t lastReadingMicros = hostMicros;
+  uint64_t periodMicros = 1000000 / SAMPLES_PER_SECOND;
+
+  uint64_t endMicros = hostMicros + RUN_SECONDS * 1000000ULL;
+  while (hostMicros < endMicros) {
+    advanceHostMicros(LOOP_MICROS);
+    idleMicros += LOOP_MICROS;
+
+    if (gated && (hostMicros - lastReadingMicros) < periodMicros * 9 / 10) {
+      continue;
+    }
+
+    int32_t reading;
+    boolean gotReading;
+    if (method == BURST) {
+      gotReading = getReadingInOneBurst(&reading);
+    } else if (method == IF_AVAILABLE) {
+      gotReading = scale.getReadingIfAvailable(&reading);
+    } else {
+      gotReading = scale.available();
+      if (gotReading) {
+        reading = scale.getReading();
+      }
+    }
+
+    if (gotReading) {
+      use.readings++;
+      lastReadingMicros = hostMicros;
+    }
+  }
+
+  // Time only moves on the bus or between loops
+  use.busMicros = (hostMicros - startMicros) - idleMicros;
+  use.transfers = Wire.transferCount;
+  use.bytes = Wire.bytesClocked;
+
+  return use;
+}
+
+int main() {
+  Wire.attachDevice(0x2A, &nau7802);
+  Wire.setClock(400000);
+
+  CHECK(scale.begin(Wire));
+  scale.setSampleRate(NAU7802_SPS_40);
+
+  Wire.clockBusTime = true;
+
+  uint32_t overheads[] = { 0, 20, 50 };
+  BusUse everyLoop[READ_METHOD_COUNT];
+  BusUse whenDue[READ_METHOD_COUNT][3];
+
+  for (int i = 0; i < 3; i++) {
+    Wire.transferOverheadMicros = overheads[i];
+    printf("%luus overhead a transfer:\n", (unsigned long) overheads[i]);
+
+    for (int method = 0; method < READ_METHOD_COUNT; method++) {
+      everyLoop[method] = run((ReadMethod) method, false);
+      everyLoop[method].report(readMethodNames[method], "every loop");
+    }
+    for (int method = 0; method < READ_METHOD_COUNT; method++) {
+      whenDue[method][i] = run((ReadMethod) method, true);
+      whenDue[method][i].report(readMethodNames[method], "when due");
+
+      // Every conversion is read
+      CHECK(abs(whenDue[method][i].readings - RUN_SECONDS * SAMPLES_PER_SECOND) <= 1);
+    }
+
+    // Waiting until a conversion is due is most of the saving
+    CHECK(whenDue[IF_AVAILABLE][i].busMicros * 3 < everyLoop[IF_AVAILABLE].busMicros);
+    CHECK(whenDue[IF_AVAILABLE][i].busMicros < whenDue[BURST][i].busMicros);
+  }
+
+  // Where the burst's fewer transfers would make up for its extra bytes
+  float extraBusMicros = (float) whenDue[BURST][0].busMicros - whenDue[IF_AVAILABLE][0].busMicros;
+  float savedTransfers = (float) whenDue[IF_AVAILABLE][0].transfers - whenDue[BURST][0].transfers;
+  printf("the burst only wins once a transfer costs more than %.0fus on top of its bytes\n",
+         extraBusMicros / savedTransfers);
+
+  // The driver's own profiling agrees with the bus
+  scale.resetBusStats();
+  BusUse use = run(IF_AVAILABLE, true);
+  CHECK(scale.getTransactionCount() * 2 == use.transfers);
+  CHECK(scale.getBusTimeMicros() == use.busMicros);
+
+  Wire.clockBusTime = false;
+
+  return testResult("ScaleBusBench");
+}
@@ -0,0 +1,220 @@
+#include "Test.h"
+#include "SimulatedNAU7802.h"
+#include "Scale.h"
+
+#include <SparkFun_Qwiic_Scale_NAU7802_Arduino_Library.h>
+
+// Runs readScaleState() (see Scale.cpp) against a simulated NAU7802, the way
+// loop() does, and checks the scale never holds up the loop, keeps up with
+// the weight, and doesn't flood the I2C bus.
+
+// What Scale.cpp needs from the rest of the firmware
+HeaterState heaterState;
+
+extern NAU7802 myScale;
+
+SimulatedNAU7802 nau7802;
+
+// One pass of loop() every loopMicros, for durationMillis
+void runLoop(unsigned long durationMillis, unsigned long loopMicros = 1000) {
+  uint64_t endMicros = hostMicros + durationMillis * 1000ULL;
+  while (hostMicros < endMicros) {
+    advanceHostMicros(loopMicros);
+
+    uint64_t beforeMicros = hostMicros;
+    readScaleState();
+
+    // Never blocks.. nothing in there waits on the clock
+    CHECK(hostMicros == beforeMicros);
+  }
+}
+
+void calibrate() {
+  nau7802.grams = 0.0;
+  runLoop(500);
+  zeroScale();
+  runLoop(500);
+
+  nau7802.grams = loadSettings().referenceCupWeight;
+  runLoop(500);
+  beginScaleCalibration();
+
+  while (isScaleCalibrating()) {
+    runLoop(10);
+  }
+}
+
+void checkCalibration() {
+  CHECK_NEAR(myScale.getCalibrationFactor(), nau7802.countsPerGram, nau7802.countsPerGram * 0.01);
+
+  runLoop(500);
+  CHECK_NEAR(scaleState.measuredWeight, nau7802.grams, 0.2);
+}
+
+// The weight follows a pour within a few filtered readings
+void checkTracking() {
+  configureScale(BREWING);
+  nau7802.grams = 100.0;
+  runLoop(1000);
+
+  // Pour 30g at 2g/s, like a shot
+  float lagMillis = 0;
+  for (int i = 0; i < 15000; i++) {
+    nau7802.grams = 100.0 + i * 0.002;
+    runLoop(1);
+
+    // Fresh, no matter how long ago the loop started
+    CHECK(millis() - scaleState.lastSampleTimeMillis <= 30);
+  }
+
+  // How far behind the scale is, in time
+  lagMillis = (nau7802.grams - scaleState.measuredWeight) / 2.0 * 1000;
+  printf("brewing: %.0fms behind a 2g/s pour\n", lagMillis);
+  CHECK(lagMillis > 0 && lagMillis < 150);
+
+  // And settles on the right weight once the pour stops
+  runLoop(500);
+  CHECK_NEAR(scaleState.measuredWeight, nau7802.grams, 0.2);
+}
+
+// Single conversion spikes (the pump rattling the drip tray) don't get through
+void checkSpikes() {
+  configureScale(BREWING);
+  nau7802.grams = 150.0;
+  nau7802.spikeEvery = 17;
+  nau7802.spikeCounts = (int32_t) (50 * nau7802.countsPerGram);
+  runLoop(1000);
+
+  float worstErrorGrams = 0.0;
+  for (int i = 0; i < 2000; i++) {
+    runLoop(1);
+    worstErrorGrams = max(worstErrorGrams, fabsf(scaleState.measuredWeight - nau7802.grams));
+  }
+
+  printf("worst error with a 50g spike every 17 conversions: %.2fg\n", worstErrorGrams);
+  CHECK(worstErrorGrams < 0.2);
+
+  nau7802.spikeEvery = 0;
+}
+
+// Calibrating with the pump rattling the drip tray, the spikes don't get into the
+// calibration factor
+void checkCalibrationSpikes() {
+  nau7802.spikeEvery = 17;
+  nau7802.spikeCounts = (int32_t) (50 * nau7802.countsPerGram);
+
+  calibrate();
+
+  printf("calibrated with a 50g spike every 17 conversions: %.2f%% off\n",
+         100 * (myScale.getCalibrationFactor() / nau7802.countsPerGram - 1));
+  CHECK_NEAR(myScale.getCalibrationFactor(), nau7802.countsPerGram, nau7802.countsPerGram * 0.002);
+
+  nau7802.spikeEvery = 0;
+}
+
+// Only touches the bus a couple of times per conversion (the status register, then
+// the conversion), however fast the loop runs
+void checkBusLoad() {
+  runLoop(100);
+
+  int readsBefore = nau7802.readCount;
+  int conversionsBefore = nau7802.conversionsRead;
+  runLoop(1000);
+
+  int reads = nau7802.readCount - readsBefore;
+  int conversions = nau7802.conversionsRead - conversionsBefore;
+
+  printf("1000 loops a second: %d I2C reads, %d conversions picked up\n", reads, conversions);
+  CHECK(conversions >= 300);
+  CHECK(reads < 2.5 * conversions);
+}
+
+// Leaving PREHEAT, we tare the cup straight away, even if we're calibrating, and
+// the tare comes over to the new calibration when it's done
+void checkTareWhileCalibrating() {
+  configureScale(PREHEAT);
+  nau7802.grams = loadSettings().referenceCupWeight;
+
+  // As if the load cell's gain had drifted 10%
+  myScale.setCalibrationFactor(nau7802.countsPerGram * 1.1);
+  runLoop(500);
+
+  beginScaleCalibration();
+  tareScale();
+  CHECK(isScaleCalibrating());
+  CHECK_NEAR(scaleState.tareWeight, nau7802.grams / 1.1, 0.3);
+
+  while (isScaleCalibrating()) {
+    runLoop(1);
+  }
+  CHECK_NEAR(scaleState.tareWeight, nau7802.grams, 0.3);
+
+  // Then the beans go on
+  configureScale(MEASURE_BEANS);
+  nau7802.grams += 18.0;
+  runLoop(1500);
+  CHECK_NEAR(scaleState.measuredWeight - scaleState.tareWeight, 18.0, 0.2);
+}
+
+// If the scale goes quiet part way through calibrating, we give up and keep the
+// calibration and the tare we had
+void checkCalibrationTimeout() {
+  float calibrationFactor = myScale.getCalibrationFactor();
+
+  nau7802.grams = loadSettings().referenceCupWeight;
+  runLoop(500);
+
+  beginScaleCalibration();
+  tareScale();
+  float tareWeight = scaleState.tareWeight;
+
+  Wire.attachDevice(0x2A, nullptr);
+  runLoop(4000);
+  Wire.attachDevice(0x2A, &nau7802);
+
+  CHECK(!isScaleCalibrating());
+  CHECK(myScale.getCalibrationFactor() == calibrationFactor);
+  CHECK(scaleState.tareWeight == tareWeight);
+}
+
+// Test mode runs loop() every 2 seconds, so we only ever see one conversion at a
+// time.. the weight still has to follow along.
+void checkSlowLoop() {
+  configureScale(MEASURE_BEANS);
+  nau7802.grams = 18.0;
+  runLoop(1000);
+
+  for (int i = 0; i < 5; i++) {
+    nau7802.grams = 18.0 + i * 5;
+    runLoop(2000, 2000000);
+
+    CHECK_NEAR(scaleState.measuredWeight, nau7802.grams, 1.0);
+    CHECK(millis() - scaleState.lastSampleTimeMillis == 0);
+  }
+
+  // And picks up the pace again when the loop does
+  nau7802.grams = 60.0;
+  runLoop(1000);
+  CHECK_NEAR(scaleState.measuredWeight, nau7802.grams, 0.1);
+}
+
+int main() {
+  Wire.attachDevice(0x2A, &nau7802);
+
+  nau7802.noiseCounts = 100;
+
+  scaleInit();
+  CHECK(nau7802.samplesPerSecond() == 320);
+
+  calibrate();
+  checkCalibration();
+  checkTracking();
+  checkSpikes();
+  checkCalibrationSpikes();
+  checkBusLoad();
+  checkSlowLoop();
+  checkTareWhileCalibrating();
+  checkCalibrationTimeout();
+
+  return testResult("ScaleTest");
+}
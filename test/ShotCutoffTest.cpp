@@ -0,0 +1,278 @@
+#include "Test.h"
+#include "ShotCutoff.h"
+#include "Scale.h"
+#include "FlowEstimator.h"
+#include "Settings.h"
+#include "Statistics.h"
+
+#include <random>
+
+// Pulls simulated shots through the shot cutoff (see ShotCutoff.cpp), and 
+// compares how far past the target weight they end up stopping the pump early
+// for the drips and not.  Checks it only learns the drip lag from shots where the
+// cup stayed put, then pulls a few hundred shots, some of them disturbed, and 
+// compares how far past the target weight they end up with the drip lag learned
+// from every shot (as it used to be) and from only the undisturbed ones.  And 
+// what it learns has to survive the brew counts being written after every shot.
+
+// What ShotCutoff.cpp needs from the rest of the firmware
+ScaleState scaleState;
+FlowEstimatorState flowEstimatorState;
+GaggiaState doneBrewingState;
+GaggiaState *currentGaggiaState = &doneBrewingState;
+
+#define SHOT_STEP_MILLIS 50
+
+// How long the drips take to land once the pump stops
+#define DRIP_TIME_CONSTANT_MILLIS 1000
+
+// How far the scale reading (load cell, the NAU7802's filtering, our averaging)
+// lags behind what's in the cup
+#define SCALE_TIME_CONSTANT_MILLIS 400
+
+#define CUP_GRAMS 250
+
+enum Disturbance {
+  UNDISTURBED,
+
+  // Taken off the scale before it settled, and not put back
+  CUP_TAKEN,
+
+  // Lifted at 2s, a sip taken, put back at 3s
+  CUP_SIPPED,
+
+  // A hand resting on the drip tray from 4s
+  HAND_ON_TRAY
+};
+
+struct Shot {
+  float cutoffFlowRateGPS;
+  float dripLagMillis;
+  Disturbance disturbance;
+};
+
+// What's really in the cup (not counting disturbances), and what the scale 
+// makes of it
+float cupGrams;
+float scaleGrams;
+
+void updateScale(float grams) {
+  scaleGrams += (grams - scaleGrams) * SHOT_STEP_MILLIS / (float) (SHOT_STEP_MILLIS + SCALE_TIME_CONSTANT_MILLIS);
+  scaleState.measuredWeight = scaleGrams;
+}
+
+// Brews until the cutoff stops the pump, then lets it settle for a while.
+// Returns how far past the target weight the cup really ended up.  Without
+// 'predict', we stop the pump as soon as the scale reaches the target, like we
+// used to.
+float pullShot(Shot shot, boolean learn, boolean predict = true) {
+  scaleState.tareWeight = 0;
+  scaleState.targetWeight = 36;
+  flowEstimatorState.flowRateGPS = shot.cutoffFlowRateGPS;
+
+  prepareShotCutoff();
+  if (!predict) {
+    shotCutoffState.dripLagMillis = 0;
+  }
+
+  cupGrams = 0;
+  scaleGrams = 0;
+  scaleState.measuredWeight = scaleGrams;
+  while (!shouldStopBrewing()) {
+    advanceHostMicros(SHOT_STEP_MILLIS * 1000);
+    cupGrams += shot.cutoffFlowRateGPS * SHOT_STEP_MILLIS / 1000.0f;
+    updateScale(cupGrams);
+  }
+
+  recordShotCutoff();
+  currentGaggiaState->stateEnterTimeMillis = millis();
+
+  float cutoffGrams = cupGrams;
+  float dripGrams = shot.cutoffFlowRateGPS * shot.dripLagMillis / 1000.0f;
+
+  for (int elapsedMillis = 0; elapsedMillis <= 6000; elapsedMillis += SHOT_STEP_MILLIS) {
+    cupGrams = cutoffGrams + dripGrams * (1 - expf(-elapsedMillis / (float) DRIP_TIME_CONSTANT_MILLIS));
+
+    float onScaleGrams = cupGrams;
+    if (shot.disturbance == CUP_TAKEN && elapsedMillis >= 3000) {
+      onScaleGrams = -CUP_GRAMS;
+    }
+    if (shot.disturbance == CUP_SIPPED && elapsedMillis >= 2000) {
+      onScaleGrams = elapsedMillis < 3000 ? -CUP_GRAMS : cupGrams - 10;
+    }
+    if (shot.disturbance == HAND_ON_TRAY && elapsedMillis >= 4000) {
+      onScaleGrams = cupGrams + 150;
+    }
+    updateScale(onScaleGrams);
+
+    if (learn) {
+      learnFromSettledShotIfNecessary();
+    }
+
+    advanceHostMicros(SHOT_STEP_MILLIS * 1000);
+  }
+
+  return (cutoffGrams + dripGrams) - scaleState.targetWeight;
+}
+
+// The learning as it used to be, before we checked the cup stayed put
+void learnFromEveryShot() {
+  float settledWeight = scaleState.measuredWeight - scaleState.tareWeight;
+  float observedDripLagMillis = 
+    (settledWeight - shotCutoffState.cutoffWeight) / shotCutoffState.cutoffFlowRateGPS * 1000.0f;
+
+  SettingsStorage settingsStorage = loadSettings();
+  settingsStorage.dripLagMillis = constrain((int) (settingsStorage.dripLagMillis + 
+    0.3f * (observedDripLagMillis - settingsStorage.dripLagMillis)), 0, 5000);
+  saveSettings(settingsStorage);
+
+  shotCutoffState.waitingToLearn = false;
+}
+
+void setDripLag(int dripLagMillis) {
+  SettingsStorage settingsStorage = loadSettings();
+  settingsStorage.dripLagMillis = dripLagMillis;
+  saveSettings(settingsStorage);
+}
+
+// Every disturbance leaves the drip lag alone, an undisturbed shot moves it
+void checkDisturbances() {
+  Disturbance disturbances[] = { CUP_TAKEN, CUP_SIPPED, HAND_ON_TRAY };
+
+  for (Disturbance disturbance : disturbances) {
+    setDripLag(1500);
+    pullShot({ 2.0, 2500, disturbance }, true);
+
+    CHECK(!shotCutoffState.waitingToLearn);
+    CHECK(loadSettings().dripLagMillis == 1500);
+  }
+
+  setDripLag(1500);
+  pullShot({ 2.0, 2500, UNDISTURBED }, true);
+  CHECK(loadSettings().dripLagMillis > 1500);
+}
+
+// The same few hundred shots, one in five disturbed
+void compareOvershoot() {
+  const char *names[] = { "learning from every shot", "learning from undisturbed shots" };
+
+  float meanAbsOvershoot[2];
+
+  for (int guarded = 0; guarded < 2; guarded++) {
+    std::mt19937 random(4);
+    std::uniform_real_distribution<float> flowRateGPS(1.2, 2.5);
+    std::normal_distribution<float> dripLagMillis(2200, 150);
+    std::uniform_int_distribution<int> disturbance(0, 14);
+
+    setDripLag(1500);
+
+    float sumAbsOvershoot = 0;
+    float worstOvershoot = 0;
+    int shots = 300;
+
+    for (int i = 0; i < shots; i++) {
+      int roll = disturbance(random);
+      Shot shot = { flowRateGPS(random), dripLagMillis(random), roll < 3 ? (Disturbance) (roll + 1) : UNDISTURBED };
+
+      float overshoot = pullShot(shot, guarded);
+      if (!guarded) {
+        learnFromEveryShot();
+      }
+
+      sumAbsOvershoot += fabsf(overshoot);
+      if (fabsf(overshoot) > fabsf(worstOvershoot)) {
+        worstOvershoot = overshoot;
+      }
+    }
+
+    meanAbsOvershoot[guarded] = sumAbsOvershoot / shots;
+
+    printf("%s: mean |overshoot| %.2fg, worst %.2fg, drip lag now %dms\n",
+           names[guarded], meanAbsOvershoot[guarded], worstOvershoot, loadSettings().dripLagMillis);
+  }
+
+  CHECK(meanAbsOvershoot[1] < meanAbsOvershoot[0]);
+  CHECK(meanAbsOvershoot[1] < 0.5);
+}
+
+// Settings used to share EEPROM with the total brew count, so counting a shot
+// threw away the drip lag (and the next save bumped the count by 512)
+void checkBrewCountKeepsSettings() {
+  setDripLag(2222);
+  int totalBrewCount = readTotalBrewCount();
+
+  for (int shot = 0; shot < 600; shot++) {
+    increaseBrewCount();
+    CHECK(loadSettings().dripLagMillis == 2222);
+    setDripLag(2222);
+  }
+
+  CHECK(readTotalBrewCount() == totalBrewCount + 600);
+  CHECK(loadSettings().referenceCupWeight == 104);
+}
+
+// Settings saved where they used to live, with the total brew count written
+// over the bottom of their version, come across to where they live now
+void checkLegacySettingsMove() {
+  memset(&EEPROM.bytes[SETTINGS_EEPROM_ADDRESS], 0xFF, sizeof(SettingsStorage));
+
+  SettingsStorage legacy = { 2, 120, 3, 2100 };
+  EEPROM.put(LEGACY_SETTINGS_EEPROM_ADDRESS, legacy);
+  int legacyTotalBrewCount = 0x345;
+  EEPROM.put(TOTAL_BREW_COUNT_EEPROM_ADDRESS, legacyTotalBrewCount);
+
+  CHECK(loadSettings().dripLagMillis == 2100);
+  CHECK(loadSettings().referenceCupWeight == 120);
+  CHECK(readTotalBrewCount() == 0x345);
+
+  // Nothing there to move
+  memset(&EEPROM.bytes[SETTINGS_EEPROM_ADDRESS], 0xFF, sizeof(SettingsStorage));
+  memset(&EEPROM.bytes[LEGACY_SETTINGS_EEPROM_ADDRESS], 0xFF, sizeof(SettingsStorage));
+  CHECK(loadSettings().dripLagMillis == 1500);
+}
+
+// The same undisturbed shots, stopping the pump when the scale reaches the target
+// (as we used to) and when we expect the drips to take us there
+void compareCutoffs() {
+  const char *names[] = { "stopping at the target weight", "stopping early for the drips" };
+
+  float meanOvershoot[2];
+
+  for (int predict = 0; predict < 2; predict++) {
+    std::mt19937 random(5);
+    std::uniform_real_distribution<float> flowRateGPS(1.2, 2.5);
+    std::normal_distribution<float> dripLagMillis(2200, 150);
+
+    setDripLag(1500);
+
+    float sumOvershoot = 0;
+    float worstOvershoot = 0;
+    int shots = 100;
+
+    for (int i = 0; i < shots; i++) {
+      float overshoot = pullShot({ flowRateGPS(random), dripLagMillis(random), UNDISTURBED }, true, predict);
+
+      sumOvershoot += overshoot;
+      if (fabsf(overshoot) > fabsf(worstOvershoot)) {
+        worstOvershoot = overshoot;
+      }
+    }
+
+    meanOvershoot[predict] = sumOvershoot / shots;
+
+    printf("%s: mean overshoot %.2fg, worst %.2fg\n", names[predict], meanOvershoot[predict], worstOvershoot);
+  }
+
+  CHECK(meanOvershoot[0] > 3.0);
+  CHECK(fabsf(meanOvershoot[1]) < 0.5);
+}
+
+int main() {
+  checkBrewCountKeepsSettings();
+  checkLegacySettingsMove();
+  checkDisturbances();
+  compareCutoffs();
+  compareOvershoot();
+
+  return testResult("ShotCutoffTest");
+}
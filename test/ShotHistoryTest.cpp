@@ -0,0 +1,235 @@
+#include "Test.h"
+#include "ShotHistory.h"
+#include "ShotCutoff.h"
+#include "Scale.h"
+
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// Saves shots into a scratch directory with the shot history (see ShotHistory.cpp)
+// and reads them back the way a restart does.  Checks shots come back exactly as
+// recorded, a torn index record is dropped without losing anything before it,
+// old shots are evicted, and a failed eviction leaves RAM matching flash.
+
+// What ShotHistory.cpp needs from the rest of the firmware
+ShotRecorderState shotRecorderState;
+ShotCutoffState shotCutoffState;
+ScaleState scaleState;
+
+int dumpedOutput = SHOT_DUMP_NONE;
+
+void dumpShotRecording(int output) {
+  dumpedOutput = output;
+}
+
+void sendMessageOverBLE(const char *) {
+}
+
+extern const char *SHOT_HISTORY_DIRECTORY;
+extern uint32_t SHOT_HISTORY_MAX_BYTES;
+
+char directory[] = "/tmp/shotHistoryTestXXXXXX";
+
+// A made up shot, different for every seed
+void recordShot(int seed, int sampleCount) {
+  shotRecorderState.startTimeMillis = millis();
+  shotRecorderState.sampleCount = sampleCount;
+
+  for (int i = 0; i < sampleCount; i++) {
+    ShotSample *sample = &shotRecorderState.samples[i];
+    sample->weightDecigrams = i * 3 + seed;
+    sample->flowRateCentiGPS = 150 + (i * seed) % 40 - 20;
+    sample->pressureCentibars = 900 + (i % 7) * seed;
+    sample->tempDeciC = 930 - (i % 5);
+    sample->pumpDutyCycle = (i * 7 + seed) % 101;
+    sample->flags = (i + seed) & 0xBF;
+  }
+
+  advanceHostMicros(30 * 1000000ULL);
+}
+
+// Brewed to a cutoff that settled at yieldGrams
+void finishShot(float yieldGrams) {
+  shotCutoffState.cutoffMillis = millis();
+  shotCutoffState.yieldWeight = yieldGrams;
+  advanceHostMicros(7 * 1000000ULL);
+}
+
+// As if we'd just restarted
+void restart() {
+  shotHistoryState = ShotHistoryState();
+  shotHistoryInit();
+}
+
+void checkShotReadsBack(uint32_t id, int seed, int sampleCount) {
+  ShotRecorderState recorded = shotRecorderState;
+  recordShot(seed, sampleCount);
+  ShotRecorderState expected = shotRecorderState;
+  shotRecorderState = recorded;
+
+  shotRecorderState.sampleCount = 0;
+  CHECK(dumpShotFromHistory(id, SHOT_DUMP_SERIAL));
+  CHECK(dumpedOutput == SHOT_DUMP_SERIAL);
+  CHECK(shotRecorderState.sampleCount == sampleCount);
+  CHECK(memcmp(shotRecorderState.samples, expected.samples, sampleCount * sizeof(ShotSample)) == 0);
+}
+
+off_t indexBytes() {
+  char path[128];
+  snprintf(path, sizeof(path), "%s/index.log", directory);
+
+  struct stat status;
+  return stat(path, &status) == 0 ? status.st_size : -1;
+}
+
+void checkRoundTrip() {
+  recordShot(1, 800);
+  finishShot(36.4);
+  saveShotToHistory();
+
+  recordShot(2, 1000);
+  finishShot(40.0);
+  saveShotToHistory();
+
+  // Abandoned before the cutoff, so the yield is the last weight
+  recordShot(3, 300);
+  saveShotToHistory();
+
+  // Too short to keep
+  recordShot(4, 10);
+  saveShotToHistory();
+
+  restart();
+
+  CHECK(shotHistoryState.shotCount == 3);
+  CHECK(shotHistoryState.nextId == 4);
+  CHECK(shotHistoryState.shots[0].id == 1);
+  CHECK(shotHistoryState.shots[0].sampleCount == 800);
+  CHECK(shotHistoryState.shots[0].yieldDecigrams == 364);
+  CHECK(shotHistoryState.shots[1].yieldDecigrams == 400);
+  CHECK(shotHistoryState.shots[2].yieldDecigrams == 299 * 3 + 3);
+
+  checkShotReadsBack(1, 1, 800);
+  checkShotReadsBack(2, 2, 1000);
+  checkShotReadsBack(3, 3, 300);
+
+  CHECK(!dumpShotFromHistory(4, SHOT_DUMP_SERIAL));
+}
+
+// Lose power half way through appending a record
+void checkTornRecord() {
+  int shotCount = shotHistoryState.shotCount;
+  off_t goodBytes = indexBytes();
+
+  char path[128];
+  snprintf(path, sizeof(path), "%s/index.log", directory);
+  int fd = open(path, O_WRONLY | O_APPEND);
+  uint8_t half[sizeof(ShotHistoryRecord) / 2] = { SHOT_HISTORY_ADD, 0x12, 0x34 };
+  CHECK(write(fd, half, sizeof(half)) == sizeof(half));
+  close(fd);
+
+  restart();
+
+  CHECK(shotHistoryState.shotCount == shotCount);
+  CHECK(indexBytes() == (off_t) (shotCount * sizeof(ShotHistoryRecord)));
+  CHECK(indexBytes() <= goodBytes);
+
+  // and carries on from there
+  uint32_t id = shotHistoryState.nextId;
+  recordShot(5, 500);
+  finishShot(30.0);
+  saveShotToHistory();
+
+  restart();
+
+  CHECK(shotHistoryState.shotCount == shotCount + 1);
+  CHECK(shotHistoryState.shots[shotCount].id == id);
+  checkShotReadsBack(id, 5, 500);
+}
+
+void checkEviction() {
+  // Room for about three of these
+  SHOT_HISTORY_MAX_BYTES = shotHistoryState.shots[0].fileBytes * 3;
+
+  for (int seed = 10; seed < 16; seed++) {
+    recordShot(seed, 800);
+    finishShot(36.0);
+    saveShotToHistory();
+
+    CHECK(shotHistoryState.totalBytes <= SHOT_HISTORY_MAX_BYTES);
+  }
+
+  int shotCount = shotHistoryState.shotCount;
+  uint32_t oldestId = shotHistoryState.shots[0].id;
+  CHECK(oldestId > 4);
+
+  // Evicted shots are gone from flash too
+  CHECK(!dumpShotFromHistory(1, SHOT_DUMP_SERIAL));
+  CHECK(!dumpShotFromHistory(4, SHOT_DUMP_SERIAL));
+
+  restart();
+
+  CHECK(shotHistoryState.shotCount == shotCount);
+  CHECK(shotHistoryState.shots[0].id == oldestId);
+  checkShotReadsBack(shotHistoryState.shots[shotCount - 1].id, 15, 800);
+}
+
+// If we can't write the index, nothing changes in RAM.. so RAM still matches 
+// what we'll read back at the next restart
+void checkFailedEviction() {
+  char path[128];
+  char asidePath[128];
+  snprintf(path, sizeof(path), "%s/index.log", directory);
+  snprintf(asidePath, sizeof(asidePath), "%s/index.aside", directory);
+
+  int shotCount = shotHistoryState.shotCount;
+  uint32_t oldestId = shotHistoryState.shots[0].id;
+  uint32_t nextId = shotHistoryState.nextId;
+
+  // Can't open a directory to append to it, even as root
+  CHECK(rename(path, asidePath) == 0);
+  CHECK(mkdir(path, 0777) == 0);
+
+  recordShot(20, 800);
+  finishShot(36.0);
+  saveShotToHistory();
+
+  CHECK(shotHistoryState.shotCount == shotCount);
+  CHECK(shotHistoryState.shots[0].id == oldestId);
+  CHECK(shotHistoryState.nextId == nextId);
+
+  CHECK(rmdir(path) == 0);
+  CHECK(rename(asidePath, path) == 0);
+
+  restart();
+
+  CHECK(shotHistoryState.shotCount == shotCount);
+  CHECK(shotHistoryState.shots[0].id == oldestId);
+}
+
+void removeDirectory() {
+  char command[160];
+  snprintf(command, sizeof(command), "rm -rf %s", directory);
+  system(command);
+}
+
+int main() {
+  if (mkdtemp(directory) == NULL) {
+    printf("ShotHistoryTest: couldn't make %s\n", directory);
+    return 1;
+  }
+  SHOT_HISTORY_DIRECTORY = directory;
+
+  shotHistoryInit();
+
+  checkRoundTrip();
+  checkTornRecord();
+  checkEviction();
+  checkFailedEviction();
+
+  removeDirectory();
+
+  return testResult("ShotHistoryTest");
+}
@@ -0,0 +1,100 @@
+#ifndef SIMULATED_BOILER_H
+#define SIMULATED_BOILER_H
+
+#include <Arduino.h>
+
+// The boiler, its heater and the boiler thermocouple's MAX6675, for the host
+// tests.  The boiler is 'first order plus dead time' like the thermal model
+// assumes (see ThermalModel.h), but with its own numbers, so the model has to
+// learn them.  The MAX6675 is bit banged by readMAX6675() through the host pins
+// like the real one, in 0.25C steps.
+
+#define SIMULATED_BOILER_STEP_MILLIS 10
+#define SIMULATED_BOILER_MAX_DEAD_TIME_STEPS 2000
+
+#define SIMULATED_HEATER_PIN D8
+#define SIMULATED_MAX6675_SCK D3
+#define SIMULATED_MAX6675_SO D6
+#define SIMULATED_MAX6675_CS D5
+
+struct SimulatedBoiler {
+  float tempC = 22.0;
+  float ambientC = 22.0;
+
+  // How fast the heater warms the boiler when it's on, ignoring losses
+  float heatingRateCPS = 1.4;
+
+  // Fraction of the difference from ambient lost every second
+  float coolingRate = 1.0 / 700.0;
+
+  float deadTimeSeconds = 6.0;
+
+  // Extra cooling while water is drawn through (e.g. pulling a shot), C/second
+  float drawCoolingCPS = 0.0;
+
+  // Whether the heater was on, each step, for the dead time
+  bool heaterHistory[SIMULATED_BOILER_MAX_DEAD_TIME_STEPS] = { false };
+  int heaterHistoryIndex = 0;
+
+  // How many steps the heater was switched on or off
+  int heaterSwitchCount = 0;
+  bool lastHeaterOn = false;
+
+  // What the MAX6675 is shifting out, and which bit it's on
+  uint16_t max6675Value = 0;
+  int max6675Bit = 0;
+
+  // Moves the boiler on by one step, with the heater as the firmware left it
+  void step() {
+    bool heaterOn = hostPins[SIMULATED_HEATER_PIN].level == HIGH;
+    if (heaterOn != lastHeaterOn) {
+      heaterSwitchCount++;
+      lastHeaterOn = heaterOn;
+    }
+
+    int deadTimeSteps = constrain((int) (deadTimeSeconds * 1000 / SIMULATED_BOILER_STEP_MILLIS), 
+                                  1, SIMULATED_BOILER_MAX_DEAD_TIME_STEPS);
+
+    // The heat from deadTimeSteps ago is what gets to the thermocouple now
+    int delayedIndex = (heaterHistoryIndex + SIMULATED_BOILER_MAX_DEAD_TIME_STEPS - deadTimeSteps) %
+                       SIMULATED_BOILER_MAX_DEAD_TIME_STEPS;
+    bool delayedHeaterOn = heaterHistory[delayedIndex];
+
+    heaterHistory[heaterHistoryIndex] = heaterOn;
+    heaterHistoryIndex = (heaterHistoryIndex + 1) % SIMULATED_BOILER_MAX_DEAD_TIME_STEPS;
+
+    float seconds = SIMULATED_BOILER_STEP_MILLIS / 1000.0f;
+    float rateCPS = (delayedHeaterOn ? heatingRateCPS : 0.0f) - coolingRate * (tempC - ambientC) - drawCoolingCPS;
+    tempC += rateCPS * seconds;
+  }
+
+  // The MAX6675 latches a conversion when chip select goes low, and shifts the
+  // next bit out every time the clock falls
+  void onChipSelect(int32_t level) {
+    if (level == LOW) {
+      uint16_t quarterDegrees = (uint16_t) max(0L, lroundf(tempC * 4));
+      max6675Value = quarterDegrees << 3;
+      max6675Bit = 15;
+    }
+  }
+
+  void onClock(int32_t level) {
+    if (level == LOW && max6675Bit > 0) {
+      max6675Bit--;
+    }
+  }
+
+  int32_t serialOut() {
+    return (max6675Value >> max6675Bit) & 1;
+  }
+};
+
+SimulatedBoiler boiler;
+
+void attachSimulatedBoiler() {
+  hostPins[SIMULATED_MAX6675_CS].onWrite = [](int32_t level) { boiler.onChipSelect(level); };
+  hostPins[SIMULATED_MAX6675_SCK].onWrite = [](int32_t level) { boiler.onClock(level); };
+  hostPins[SIMULATED_MAX6675_SO].digitalSource = []() { return boiler.serialOut(); };
+}
+
+#endif
@@ -0,0 +1,214 @@
+#ifndef SIMULATED_NAU7802_H
+#define SIMULATED_NAU7802_H
+
+#include <Arduino.h>
+
+// A register level model of the NAU7802 load cell amp, for the host tests.
+// Attach it to Wire at 0x2A and the SparkFun library talks to it like the
+// real thing.  Conversions come out at the configured sample rate in host
+// time, and like the real chip only the latest one is kept.. if nobody reads
+// it before the next one, it's gone.
+//
+// What it reads is 'grams' on the load cell times countsPerGram, plus
+// bridgeOffsetCounts, minus the offset calibration register (which an
+// external offset calibration sets to whatever is on the load cell), plus noise.
+
+class SimulatedNAU7802 : public HostI2CDevice {
+public:
+  float grams = 0.0;
+  float countsPerGram = 420.0;
+  int32_t bridgeOffsetCounts = 37000;
+
+  // Standard deviation of the noise, in counts
+  float noiseCounts = 0.0;
+
+  // One in this many conversions is a spike of spikeCounts (0 for none)
+  int spikeEvery = 0;
+  int32_t spikeCounts = 0;
+
+  // How the bus was used
+  int writeCount = 0;
+  int readCount = 0;
+  int conversionCount = 0;
+  int conversionsRead = 0;
+
+  SimulatedNAU7802() {
+    reset();
+  }
+
+  void reset() {
+    memset(registers, 0, sizeof(registers));
+    registers[REVISION] = 0x0F;
+    pointer = 0;
+    conversionPending = false;
+  }
+
+  void receive(const uint8_t *bytes, size_t length) override {
+    writeCount++;
+
+    pointer = bytes[0];
+    for (size_t i = 1; i < length; i++) {
+      writeRegister(pointer++, bytes[i]);
+    }
+  }
+
+  void send(uint8_t *bytes, size_t length) override {
+    readCount++;
+
+    updateConversions();
+    for (size_t i = 0; i < length; i++) {
+      bytes[i] = readRegister(pointer++);
+    }
+  }
+
+  int samplesPerSecond() {
+    switch ((registers[CTRL2] >> 4) & 0x07) {
+      case 0: return 10;
+      case 1: return 20;
+      case 2: return 40;
+      case 3: return 80;
+      default: return 320;
+    }
+  }
+
+  // What the next conversion would be, without the noise
+  int32_t idealReading() {
+    return lroundf(grams * countsPerGram) + bridgeOffsetCounts - offsetCalibration();
+  }
+
+private:
+  enum {
+    PU_CTRL = 0x00,
+    CTRL2 = 0x02,
+    OCAL1_B2 = 0x03,
+    ADCO_B2 = 0x12,
+    REVISION = 0x1F
+  };
+
+  // PU_CTRL
+  static const uint8_t RR = 1 << 0;
+  static const uint8_t PUA = 1 << 2;
+  static const uint8_t PUR = 1 << 3;
+  static const uint8_t CS = 1 << 4;
+  static const uint8_t CR = 1 << 5;
+
+  // CTRL2
+  static const uint8_t CALS = 1 << 2;
+
+  static const uint32_t CALIBRATION_MICROS = 344000;
+
+  uint8_t registers[32];
+  uint8_t pointer;
+
+  uint64_t lastConversionMicros = 0;
+  bool conversionPending;
+
+  uint64_t calibrationDoneMicros = 0;
+
+  uint32_t noiseState = 12345;
+
+  int32_t offsetCalibration() {
+    int32_t offset = ((int32_t) registers[OCAL1_B2] << 16) |
+                     ((int32_t) registers[OCAL1_B2 + 1] << 8) |
+                     registers[OCAL1_B2 + 2];
+    if (offset & 0x800000) {
+      offset |= 0xFF000000;
+    }
+    return offset;
+  }
+
+  // Roughly gaussian, from the sum of a few uniform draws
+  float noise() {
+    float sum = 0.0;
+    for (int i = 0; i < 4; i++) {
+      noiseState = noiseState * 1103515245 + 12345;
+      sum += ((noiseState >> 8) & 0xFFFF) / 65536.0f - 0.5f;
+    }
+    return sum * 1.732f;
+  }
+
+  void writeRegister(uint8_t address, uint8_t value) {
+    if (address >= sizeof(registers)) {
+      return;
+    }
+
+    if (address == PU_CTRL) {
+      if (value & RR) {
+        reset();
+        registers[PU_CTRL] = RR;
+        return;
+      }
+
+      // Powers up straight away, and starts converting as soon as CS is set
+      if (value & PUA) {
+        value |= PUR;
+      }
+      if ((value & CS) && !(registers[PU_CTRL] & CS)) {
+        lastConversionMicros = hostMicros;
+      }
+      value = (value & ~CR) | (registers[PU_CTRL] & CR);
+    }
+
+    if (address == CTRL2 && (value & CALS)) {
+      calibrationDoneMicros = hostMicros + CALIBRATION_MICROS;
+
+      // External offset calibration.. whatever's on the load cell now reads zero
+      if ((value & 0x03) == 2) {
+        int32_t offset = lroundf(grams * countsPerGram) + bridgeOffsetCounts;
+        registers[OCAL1_B2] = (offset >> 16) & 0xFF;
+        registers[OCAL1_B2 + 1] = (offset >> 8) & 0xFF;
+        registers[OCAL1_B2 + 2] = offset & 0xFF;
+      }
+    }
+
+    registers[address] = value;
+  }
+
+  uint8_t readRegister(uint8_t address) {
+    if (address >= sizeof(registers)) {
+      return 0;
+    }
+
+    uint8_t value = registers[address];
+
+    // Reading the conversion clears Cycle Ready
+    if (address == ADCO_B2 && (registers[PU_CTRL] & CR)) {
+      registers[PU_CTRL] &= ~CR;
+      conversionsRead++;
+    }
+
+    return value;
+  }
+
+  void updateConversions() {
+    if ((registers[CTRL2] & CALS) && hostMicros >= calibrationDoneMicros) {
+      registers[CTRL2] &= ~CALS;
+    }
+
+    if (!(registers[PU_CTRL] & CS)) {
+      return;
+    }
+
+    uint64_t periodMicros = 1000000 / samplesPerSecond();
+    if (hostMicros - lastConversionMicros < periodMicros) {
+      return;
+    }
+
+    // Skip over any we missed, only the latest is kept
+    lastConversionMicros += ((hostMicros - lastConversionMicros) / periodMicros) * periodMicros;
+
+    int32_t reading = idealReading() + lroundf(noise() * noiseCounts);
+    conversionCount++;
+    if (spikeEvery > 0 && conversionCount % spikeEvery == 0) {
+      reading += spikeCounts;
+    }
+    reading = constrain(reading, -0x800000, 0x7FFFFF);
+
+    registers[ADCO_B2] = (reading >> 16) & 0xFF;
+    registers[ADCO_B2 + 1] = (reading >> 8) & 0xFF;
+    registers[ADCO_B2 + 2] = reading & 0xFF;
+    registers[PU_CTRL] |= CR;
+  }
+};
+
+#endif
@@ -0,0 +1,204 @@
+#include "Test.h"
+#include "TelemetryFrame.h"
+#include "Varint.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Round trips telemetry frames (see TelemetryFrame.h) through the encoder
+// and the reference decoder.
+
+void checkVarints() {
+  const int32_t values[] = { 0, 1, -1, 63, -64, 64, -65, 8191, -8192, 
+                             INT32_MAX, INT32_MIN, INT32_MAX - 1, INT32_MIN + 1 };
+
+  for (int32_t value : values) {
+    CHECK(zigzagDecode(zigzagEncode(value)) == value);
+
+    uint8_t bytes[VARINT_MAX_BYTES];
+    size_t length = writeVarint(zigzagEncode(value), bytes);
+    CHECK(length == varintLength(zigzagEncode(value)));
+    CHECK(length <= VARINT_MAX_BYTES);
+
+    uint32_t decoded;
+    CHECK(readVarint(bytes, length, &decoded) == length);
+    CHECK(zigzagDecode(decoded) == value);
+
+    // Cut short, it's no good
+    if (length > 1) {
+      CHECK(readVarint(bytes, length - 1, &decoded) == 0);
+    }
+  }
+
+  // Small values of either sign are one byte
+  CHECK(varintLength(zigzagEncode(-64)) == 1);
+  CHECK(varintLength(zigzagEncode(63)) == 1);
+  CHECK(varintLength(zigzagEncode(INT32_MIN)) == 5);
+}
+
+void checkValues(const TelemetryFrameDecoder &decoder, const int32_t values[TELEMETRY_FIELD_COUNT]) {
+  CHECK(memcmp(decoder.values, values, sizeof(decoder.values)) == 0);
+}
+
+void checkKeyframesAndDeltas() {
+  TelemetryFrameEncoder encoder;
+  TelemetryFrameDecoder decoder;
+  uint8_t frame[TELEMETRY_FRAME_MAX_BYTES];
+
+  int32_t values[TELEMETRY_FIELD_COUNT];
+  for (int field = 0; field < TELEMETRY_FIELD_COUNT; field++) {
+    values[field] = field * 100 - 300;
+  }
+
+  // First frame is always a keyframe, even if we don't ask for one
+  size_t length = encodeTelemetryFrame(&encoder, values, false, frame);
+  CHECK(length > 5);
+  CHECK(frame[0] == (TELEMETRY_FRAME_MAGIC | TELEMETRY_FRAME_VERSION));
+  CHECK(frame[1] & TELEMETRY_FRAME_KEYFRAME);
+  CHECK(decodeTelemetryFrame(&decoder, frame, length));
+  checkValues(decoder, values);
+
+  // Nothing changed, nothing to send
+  CHECK(encodeTelemetryFrame(&encoder, values, false, frame) == 0);
+
+  // One field changed, a delta with just that field
+  values[TELEMETRY_BREW_TEMP_DECIC] += 3;
+  length = encodeTelemetryFrame(&encoder, values, false, frame);
+  CHECK(length == 6);
+  CHECK((frame[1] & TELEMETRY_FRAME_KEYFRAME) == 0);
+  CHECK((frame[3] | (frame[4] << 8)) == (1 << TELEMETRY_BREW_TEMP_DECIC));
+  CHECK(decodeTelemetryFrame(&decoder, frame, length));
+  checkValues(decoder, values);
+
+  // Deltas from one extreme to the other wrap, and come back out the same
+  values[TELEMETRY_WEIGHT_DECIGRAMS] = INT32_MIN;
+  values[TELEMETRY_FLOW_RATE_CENTIGPS] = INT32_MAX;
+  length = encodeTelemetryFrame(&encoder, values, false, frame);
+  CHECK(decodeTelemetryFrame(&decoder, frame, length));
+  checkValues(decoder, values);
+
+  values[TELEMETRY_WEIGHT_DECIGRAMS] = INT32_MAX;
+  values[TELEMETRY_FLOW_RATE_CENTIGPS] = INT32_MIN;
+  length = encodeTelemetryFrame(&encoder, values, false, frame);
+  CHECK(length <= TELEMETRY_FRAME_MAX_BYTES);
+  CHECK(decodeTelemetryFrame(&decoder, frame, length));
+  checkValues(decoder, values);
+
+  // Every field at an extreme, in a keyframe, fits in the max frame size
+  for (int field = 0; field < TELEMETRY_FIELD_COUNT; field++) {
+    values[field] = field % 2 ? INT32_MIN : INT32_MAX;
+  }
+  length = encodeTelemetryFrame(&encoder, values, true, frame);
+  CHECK(length == TELEMETRY_FRAME_MAX_BYTES);
+  CHECK(decodeTelemetryFrame(&decoder, frame, length));
+  checkValues(decoder, values);
+
+  // Bad frames are turned away, and don't touch the values
+  int32_t before[TELEMETRY_FIELD_COUNT];
+  memcpy(before, decoder.values, sizeof(before));
+  values[TELEMETRY_STATE] = 7;
+  length = encodeTelemetryFrame(&encoder, values, false, frame);
+
+  uint8_t badVersion[TELEMETRY_FRAME_MAX_BYTES];
+  memcpy(badVersion, frame, length);
+  badVersion[0] = TELEMETRY_FRAME_MAGIC | (TELEMETRY_FRAME_VERSION + 1);
+  CHECK(!decodeTelemetryFrame(&decoder, badVersion, length));
+  CHECK(!decodeTelemetryFrame(&decoder, frame, 3));
+  checkValues(decoder, before);
+}
+
+void checkResync() {
+  TelemetryFrameEncoder encoder;
+  TelemetryFrameDecoder decoder;
+  uint8_t frame[TELEMETRY_FRAME_MAX_BYTES];
+
+  int32_t values[TELEMETRY_FIELD_COUNT] = { 0 };
+
+  size_t length = encodeTelemetryFrame(&encoder, values, true, frame);
+  CHECK(decodeTelemetryFrame(&decoder, frame, length));
+
+  // This one gets lost
+  values[TELEMETRY_PRESSURE_CENTIBARS] = 850;
+  encodeTelemetryFrame(&encoder, values, false, frame);
+
+  // The next delta doesn't follow on, so the decoder waits for a keyframe
+  values[TELEMETRY_PRESSURE_CENTIBARS] = 860;
+  length = encodeTelemetryFrame(&encoder, values, false, frame);
+  CHECK(!decodeTelemetryFrame(&decoder, frame, length));
+  CHECK(!decoder.synced);
+
+  // Even a delta with the right sequence number is no good until then
+  values[TELEMETRY_PRESSURE_CENTIBARS] = 870;
+  length = encodeTelemetryFrame(&encoder, values, false, frame);
+  CHECK(!decodeTelemetryFrame(&decoder, frame, length));
+
+  values[TELEMETRY_PRESSURE_CENTIBARS] = 880;
+  length = encodeTelemetryFrame(&encoder, values, true, frame);
+  CHECK(decodeTelemetryFrame(&decoder, frame, length));
+  CHECK(decoder.synced);
+  checkValues(decoder, values);
+
+  // And deltas work again after it
+  values[TELEMETRY_PRESSURE_CENTIBARS] = 890;
+  length = encodeTelemetryFrame(&encoder, values, false, frame);
+  CHECK(decodeTelemetryFrame(&decoder, frame, length));
+  checkValues(decoder, values);
+
+  // The sequence number wraps without losing sync
+  for (int i = 0; i < 600; i++) {
+    values[TELEMETRY_WEIGHT_DECIGRAMS] = i + 1;
+    length = encodeTelemetryFrame(&encoder, values, false, frame);
+    CHECK(decodeTelemetryFrame(&decoder, frame, length));
+  }
+  checkValues(decoder, values);
+}
+
+// Lots of random changes, with frames dropped now and then.. whenever the
+// decoder says it's in sync, it has exactly what was sent.
+void checkRandomShots() {
+  TelemetryFrameEncoder encoder;
+  TelemetryFrameDecoder decoder;
+  uint8_t frame[TELEMETRY_FRAME_MAX_BYTES];
+
+  int32_t values[TELEMETRY_FIELD_COUNT] = { 0 };
+  size_t totalBytes = 0;
+  int frameCount = 0;
+  int syncedCount = 0;
+
+  srand(1);
+  for (int i = 0; i < 20000; i++) {
+    for (int field = 0; field < TELEMETRY_FIELD_COUNT; field++) {
+      if (rand() % 4 == 0) {
+        values[field] += rand() % 41 - 20;
+      }
+    }
+
+    size_t length = encodeTelemetryFrame(&encoder, values, i % 20 == 0, frame);
+    if (length == 0) {
+      continue;
+    }
+    totalBytes += length;
+    frameCount++;
+
+    if (rand() % 50 == 0) {
+      continue;
+    }
+
+    if (decodeTelemetryFrame(&decoder, frame, length)) {
+      syncedCount++;
+      checkValues(decoder, values);
+    }
+  }
+
+  printf("average frame %.1f bytes, in sync for %d of %d frames\n",
+         (double) totalBytes / frameCount, syncedCount, frameCount);
+}
+
+int main() {
+  checkVarints();
+  checkKeyframesAndDeltas();
+  checkResync();
+  checkRandomShots();
+
+  return testResult("TelemetryFrameTest");
+}
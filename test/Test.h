@@ -0,0 +1,42 @@
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdio.h>
+
+// Just enough of a test framework for the host tests in this directory.
+// CHECK() reports and counts failures but keeps going, so one run shows
+// everything that's wrong.  Each test's main() returns testResult().
+
+static int testFailures = 0;
+
+#define CHECK(condition)                                                  \
+  do {                                                                    \
+    if (!(condition)) {                                                   \
+      printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition);\
+      testFailures++;                                                     \
+    }                                                                     \
+  } while (0)
+
+#define CHECK_NEAR(actual, expected, tolerance)                           \
+  do {                                                                    \
+    double _actual = (actual);                                            \
+    double _expected = (expected);                                        \
+    if (_actual - _expected > (tolerance) ||                              \
+        _expected - _actual > (tolerance)) {                              \
+      printf("%s:%d: %s was %f, expected %f +/- %f\n", __FILE__, __LINE__,\
+             #actual, _actual, _expected, (double) (tolerance));          \
+      testFailures++;                                                     \
+    }                                                                     \
+  } while (0)
+
+static int testResult(const char *name) {
+  if (testFailures == 0) {
+    printf("%s: passed\n", name);
+    return 0;
+  }
+
+  printf("%s: %d failed\n", name, testFailures);
+  return 1;
+}
+
+#endif
@@ -0,0 +1,146 @@
+#include "Test.h"
+#include "Trace.h"
+
+#include <string>
+#include <vector>
+
+// Fills the trace ring (see Trace.cpp) and drains it the way the drain thread
+// does.  Checks every record comes out once, in order and intact, several to a
+// line, that serial lines are written holding the Serial lock (so the log can't
+// split them), and how fast BLE can keep up.
+
+// BLE notifications, as sent
+std::vector<std::string> notifications;
+
+void sendMessageOverBLE(const char *message) {
+  notifications.push_back(message);
+}
+
+struct DecodedRecord {
+  uint32_t timeMicros;
+  uint16_t eventId;
+  int16_t a;
+  int32_t b;
+};
+
+// The same as tools/decodeTrace.py
+std::vector<DecodedRecord> decodeTraceLines(const std::vector<std::string> &lines) {
+  std::vector<DecodedRecord> records;
+
+  for (const std::string &line : lines) {
+    CHECK(line.compare(0, 2, "T:") == 0);
+    CHECK((line.length() - 2) % 24 == 0);
+    CHECK((line.length() - 2) / 24 <= TRACE_LINE_MAX_RECORDS);
+
+    for (size_t i = 2; i + 24 <= line.length(); i += 24) {
+      DecodedRecord record;
+      record.timeMicros = strtoul(line.substr(i, 8).c_str(), NULL, 16);
+      record.eventId = strtoul(line.substr(i + 8, 4).c_str(), NULL, 16);
+      record.a = (int16_t) strtoul(line.substr(i + 12, 4).c_str(), NULL, 16);
+      record.b = (int32_t) strtoul(line.substr(i + 16, 8).c_str(), NULL, 16);
+      records.push_back(record);
+    }
+  }
+
+  return records;
+}
+
+std::vector<std::string> serialLines() {
+  std::vector<std::string> lines;
+  size_t start = 0;
+  size_t end;
+  while ((end = Serial.output.find('\n', start)) != std::string::npos) {
+    lines.push_back(Serial.output.substr(start, end - start));
+    start = end + 1;
+  }
+  return lines;
+}
+
+void drainAll() {
+  while (drainTraceRecords() > 0) {
+  }
+}
+
+void checkSerial() {
+  traceOutput = TRACE_OUTPUT_SERIAL;
+  Serial.capture = true;
+  Serial.output.clear();
+
+  for (int i = 0; i < 100; i++) {
+    advanceHostMicros(100);
+    traceEvent(TRACE_PRESSURE_PID, -i, 100000 * i - 5000000);
+  }
+  drainAll();
+
+  std::vector<std::string> lines = serialLines();
+  std::vector<DecodedRecord> records = decodeTraceLines(lines);
+
+  CHECK(records.size() == 100);
+  for (int i = 0; i < (int) records.size(); i++) {
+    CHECK(records[i].eventId == TRACE_PRESSURE_PID);
+    CHECK(records[i].a == -i);
+    CHECK(records[i].b == 100000 * i - 5000000);
+    CHECK(records[i].timeMicros == (uint32_t) (records[0].timeMicros + 100 * i));
+  }
+
+  // Full lines, apart from the last one
+  CHECK(lines.size() == (100 + TRACE_LINE_MAX_RECORDS - 1) / TRACE_LINE_MAX_RECORDS);
+  CHECK(Serial.unlockedLines == 0);
+
+  // A partial line goes out as soon as we've caught up
+  Serial.output.clear();
+  traceEvent(TRACE_HEATER_WINDOW, 1, 250);
+  CHECK(drainTraceRecords() == 1);
+  CHECK(decodeTraceLines(serialLines()).size() == 1);
+}
+
+// The writers lap the drain thread
+void checkDropped() {
+  Serial.output.clear();
+
+  for (int i = 0; i < 300; i++) {
+    traceEvent(TRACE_PUMP_CYCLE, 1, i);
+  }
+  drainAll();
+
+  std::vector<DecodedRecord> records = decodeTraceLines(serialLines());
+
+  CHECK(records.size() == 257);
+  CHECK(records[0].eventId == TRACE_DROPPED);
+  CHECK(records[0].b == 300 - 256);
+  CHECK(records[1].b == 300 - 256);
+  CHECK(records[256].b == 299);
+}
+
+// Notifications are spaced out, so how much BLE can carry is down to how many
+// records go in each one
+void checkBLE() {
+  traceOutput = TRACE_OUTPUT_BLE;
+  notifications.clear();
+
+  int recordCount = 10 * TRACE_LINE_MAX_RECORDS;
+  for (int i = 0; i < recordCount; i++) {
+    traceEvent(TRACE_HEATER_PID, i, i);
+  }
+
+  uint64_t startMicros = hostMicros;
+  drainAll();
+  float seconds = (hostMicros - startMicros) / 1e6f;
+
+  std::vector<DecodedRecord> records = decodeTraceLines(notifications);
+  CHECK((int) records.size() == recordCount);
+  CHECK(notifications.size() == 10);
+
+  // 20ms per notification
+  printf("BLE: %d records in %d notifications, %.2fs, %.0f records/s (was %.0f, one per notification)\n",
+         recordCount, (int) notifications.size(), seconds, recordCount / seconds, 1000.0 / 20);
+  CHECK(recordCount / seconds > 300);
+}
+
+int main() {
+  checkSerial();
+  checkDropped();
+  checkBLE();
+
+  return testResult("TraceTest");
+}
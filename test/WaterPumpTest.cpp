@@ -0,0 +1,116 @@
+#include "Test.h"
+#include "WaterPump.h"
+#include "Bluetooth.h"
+
+// Runs the pump the way loop() does (see State.cpp).. start or stop is
+// called every time round, and only the first of each should do anything.
+
+#define ZERO_CROSS_DISPENSE_POT A2
+#define SOLENOID_VALVE_SSR TX
+#define DISPENSE_POT D7
+
+// What the pump needs from the rest of the firmware
+void sendMessageOverBLE(const char *) {
+}
+
+void checkStartStop() {
+  int attachesBefore = hostPins[ZERO_CROSS_DISPENSE_POT].attachCount;
+  int infosBefore = Log.infoCount + Particle.publishCount;
+
+  logLevel = GAGGIA_LOG_LEVEL_INFO;
+
+  for (int shot = 0; shot < 3; shot++) {
+    for (int loop = 0; loop < 1000; loop++) {
+      startDispensingWater(true);
+      CHECK(waterPumpState.dispensing);
+      CHECK(hostPins[SOLENOID_VALVE_SSR].level == HIGH);
+      CHECK(hostPins[ZERO_CROSS_DISPENSE_POT].interruptHandler != nullptr);
+    }
+
+    for (int loop = 0; loop < 1000; loop++) {
+      stopDispensingWater();
+      CHECK(!waterPumpState.dispensing);
+      CHECK(hostPins[SOLENOID_VALVE_SSR].level == LOW);
+      CHECK(hostPins[ZERO_CROSS_DISPENSE_POT].interruptHandler == nullptr);
+    }
+  }
+
+  int attaches = hostPins[ZERO_CROSS_DISPENSE_POT].attachCount - attachesBefore;
+  int infos = Log.infoCount + Particle.publishCount - infosBefore;
+
+  printf("3 shots of 1000 loops: %d interrupt attaches, %d info logs\n", attaches, infos);
+  CHECK(attaches == 3);
+
+  // One on, one off, published and logged
+  CHECK(infos <= 3 * 2 * 2);
+}
+
+// Hot water through the wand then the group head, without stopping in between,
+// just changes the valve
+void checkValveChange() {
+  startDispensingWater(false);
+  CHECK(hostPins[SOLENOID_VALVE_SSR].level == LOW);
+
+  int attachesBefore = hostPins[ZERO_CROSS_DISPENSE_POT].attachCount;
+  startDispensingWater(true);
+  CHECK(hostPins[SOLENOID_VALVE_SSR].level == HIGH);
+  CHECK(hostPins[ZERO_CROSS_DISPENSE_POT].attachCount == attachesBefore);
+
+  stopDispensingWater();
+}
+
+// Stopping part way through a cycle, then starting again, starts a fresh epoch
+// from the top of a cycle.. so the first crossing picks up the duty cycle we've
+// got now, rather than carrying on with the last dispense's pattern.
+void checkRestartMidEpoch() {
+  publishPumpDutyCycle(0);
+  startDispensingWater(true);
+  for (int crossing = 0; crossing < 3; crossing++) {
+    hostPins[ZERO_CROSS_DISPENSE_POT].interruptHandler();
+  }
+  CHECK(hostPins[DISPENSE_POT].level == LOW);
+  stopDispensingWater();
+
+  publishPumpDutyCycle(100);
+  startDispensingWater(true);
+  hostPins[ZERO_CROSS_DISPENSE_POT].interruptHandler();
+  CHECK(hostPins[DISPENSE_POT].level == HIGH);
+  hostPins[ZERO_CROSS_DISPENSE_POT].interruptHandler();
+  CHECK(hostPins[DISPENSE_POT].level == HIGH);
+  stopDispensingWater();
+
+  publishPumpDutyCycle(0);
+}
+
+// Changing state just reconfigures the flow and pressure PIDs.. nothing comes off
+// the heap, so nothing can fragment it
+void checkStateEntryDoesNotAllocate() {
+  int states[] = { PREINFUSION, BREWING, PURGE_BEFORE_STEAM_2, BACKFLUSH_CYCLE_1, DISPENSE_HOT_WATER };
+
+  int allocationsBefore = hostAllocationCount;
+  int freesBefore = hostFreeCount;
+
+  for (int shot = 0; shot < 100; shot++) {
+    for (int state : states) {
+      configureWaterPump(state);
+      startDispensingWater(state != DISPENSE_HOT_WATER);
+    }
+    stopDispensingWater();
+  }
+
+  printf("100 trips round the pump states: %d allocations, %d frees\n",
+         hostAllocationCount - allocationsBefore, hostFreeCount - freesBefore);
+  CHECK(hostAllocationCount == allocationsBefore);
+  CHECK(hostFreeCount == freesBefore);
+}
+
+int main() {
+  waterPumpInit();
+
+  checkStartStop();
+  checkValveChange();
+  checkRestartMidEpoch();
+  checkStateEntryDoesNotAllocate();
+
+  return testResult("WaterPumpTest");
+}
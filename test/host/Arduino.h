@@ -0,0 +1,404 @@
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+// Just enough of Device OS to build the firmware on Linux for the host tests.
+// Time only moves when a test moves it (see advanceHostMicros()), so
+// everything that depends on millis() and micros() is repeatable.  The
+// globals (Log, Particle, Wire, ...) live in HostParticle.cpp.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <string>
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+using std::min;
+using std::max;
+
+template <class T, class L, class H>
+T constrain(T value, L low, H high) {
+  return value < low ? low : (value > high ? high : value);
+}
+
+#define PLATFORM_ID 12
+#define PLATFORM_ARGON 12
+
+#define HAL_PLATFORM_NRF52840 1
+
+// Time
+
+// Where the host clock is, in micros.  Only moves when a test (or delay()) moves it.
+extern uint64_t hostMicros;
+
+void advanceHostMicros(uint64_t micros);
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long millis);
+void delayMicroseconds(unsigned int micros);
+
+// Memory
+
+// Every operator new/delete since the test started, so a test can check something
+// doesn't allocate (it's the heap fragmenting on the device we're worried about)
+extern int hostAllocationCount;
+extern int hostFreeCount;
+
+struct TimeClass {
+  bool isValid();
+  uint32_t now();
+};
+extern TimeClass Time;
+
+// Strings
+
+class String {
+public:
+  std::string value;
+
+  String() {}
+  String(const char *cString) : value(cString ? cString : "") {}
+  String(const std::string &string) : value(string) {}
+  String(char c) : value(1, c) {}
+  String(int number) : value(std::to_string(number)) {}
+  String(unsigned int number) : value(std::to_string(number)) {}
+  String(long number) : value(std::to_string(number)) {}
+  String(unsigned long number) : value(std::to_string(number)) {}
+  String(float number, int decimalPlaces = 2) : String((double) number, decimalPlaces) {}
+  String(double number, int decimalPlaces = 2) {
+    char formatted[32];
+    snprintf(formatted, sizeof(formatted), "%.*f", decimalPlaces, number);
+    value = formatted;
+  }
+
+  friend String operator+(const String &a, const String &b) { return String(a.value + b.value); }
+  String &operator+=(const String &other) { value += other.value; return *this; }
+
+  bool equals(const String &other) const { return value == other.value; }
+  bool startsWith(const String &prefix) const { return value.rfind(prefix.value, 0) == 0; }
+  String substring(unsigned int from) const { return String(value.substr(std::min<size_t>(from, value.size()))); }
+  String substring(unsigned int from, unsigned int to) const { return String(value.substr(from, to - from)); }
+  float toFloat() const { return atof(value.c_str()); }
+  long toInt() const { return atol(value.c_str()); }
+  unsigned int length() const { return value.size(); }
+  const char *c_str() const { return value.c_str(); }
+  operator const char *() const { return value.c_str(); }
+};
+
+// Logging and the cloud.. these count what they're asked to do, and only print
+// if the test turns it on.
+
+struct Logger {
+  int errorCount = 0;
+  int warnCount = 0;
+  int infoCount = 0;
+  int traceCount = 0;
+
+  bool print = false;
+
+  void error(const char *format, ...);
+  void warn(const char *format, ...);
+  void info(const char *format, ...);
+  void trace(const char *format, ...);
+};
+extern Logger Log;
+
+enum LogLevel { LOG_LEVEL_ALL = 1, LOG_LEVEL_TRACE = 1, LOG_LEVEL_INFO = 30, LOG_LEVEL_WARN = 40, LOG_LEVEL_ERROR = 50 };
+
+struct SerialLogHandler {
+  SerialLogHandler(LogLevel = LOG_LEVEL_INFO) {}
+};
+
+enum PublishFlag { PUBLIC, PRIVATE };
+
+struct ParticleClass {
+  int publishCount = 0;
+
+  bool publish(const char *, const char *, int = 60, PublishFlag = PUBLIC) {
+    publishCount++;
+    return true;
+  }
+
+  template <class T> bool variable(const char *, const T &) { return true; }
+  template <class F> bool function(const char *, F) { return true; }
+
+  void process() {}
+  bool connected() { return false; }
+  void connect() {}
+  void disconnect() {}
+};
+extern ParticleClass Particle;
+
+#define SYSTEM_THREAD(mode)
+#define SYSTEM_MODE(mode)
+
+template <class F> bool waitFor(F condition, int timeoutMillis) { return condition(); }
+
+struct SystemClass {
+  void dfu(int) {}
+  uint32_t freeMemory() { return 0; }
+  uint32_t ticks() { return (uint32_t) (hostMicros * 64); }
+  static uint32_t ticksPerMicrosecond() { return 64; }
+};
+extern SystemClass System;
+
+#define RESET_NO_WAIT 1
+
+typedef struct {
+  uint16_t size;
+  uint16_t flags;
+  uint32_t freeheap;
+  uint32_t system_version;
+  uint32_t total_init_heap;
+  uint32_t total_heap;
+  uint32_t max_used_heap;
+  uint32_t user_static_ram;
+  uint32_t largest_free_block_heap;
+} runtime_info_t;
+
+int HAL_Core_Runtime_Info(runtime_info_t *info, void *reserved);
+
+struct WiFiClass {
+  bool isOff() { return true; }
+  bool connecting() { return false; }
+  void on() {}
+  void off() {}
+};
+extern WiFiClass WiFi;
+
+// Serial and BLE keep every line sent if the test asks them to
+
+struct SerialClass {
+  bool capture = false;
+  std::string output;
+
+  // Lines written without holding the lock (see WITH_LOCK)
+  int lockDepth = 0;
+  int unlockedLines = 0;
+
+  void lock() { lockDepth++; }
+  void unlock() { lockDepth--; }
+
+  static bool isConnected() { return true; }
+  void begin(int) {}
+  size_t write(uint8_t c) { if (capture) output += (char) c; return 1; }
+  size_t write(const uint8_t *bytes, size_t length) { if (capture) output.append((const char *) bytes, length); return length; }
+  void print(const char *text) { if (capture) output += text; }
+  void println(const char *text) {
+    if (lockDepth == 0) unlockedLines++;
+    if (capture) { output += text; output += "\n"; }
+  }
+  void printlnf(const char *format, ...);
+  int available() { return 0; }
+  int read() { return -1; }
+};
+extern SerialClass Serial;
+
+// Holds a lock for the block that follows, like Device OS's
+#define WITH_LOCK(lockable) \
+  for (bool _locked = ((lockable).lock(), true); _locked; (lockable).unlock(), _locked = false)
+
+struct BleUuid {
+  BleUuid(const char *) {}
+};
+
+struct BlePeerDevice {};
+
+enum class BleCharacteristicProperty { NOTIFY, WRITE_WO_RSP };
+
+struct BleCharacteristic {
+  BleCharacteristic(const char *, BleCharacteristicProperty,
+                    const BleUuid &, const BleUuid &) {}
+  BleCharacteristic(const char *, BleCharacteristicProperty,
+                    const BleUuid &, const BleUuid &,
+                    void (*)(const uint8_t *, size_t, const BlePeerDevice &, void *), void *) {}
+
+  int setValue(const uint8_t *, size_t length) { return length; }
+  int setValue(const char *text) { return strlen(text); }
+  int setValue(const String &text) { return text.length(); }
+};
+
+struct BleAdvertisingData {
+  void appendServiceUUID(const BleUuid &) {}
+};
+
+struct BLEClass {
+  void on() {}
+  void addCharacteristic(BleCharacteristic &) {}
+  void advertise(BleAdvertisingData *) {}
+  bool connected() { return false; }
+};
+extern BLEClass BLE;
+
+// EEPROM is plain memory, erased (0xFF) to start with
+
+#define HOST_EEPROM_SIZE 4096
+
+struct EEPROMClass {
+  uint8_t bytes[HOST_EEPROM_SIZE];
+
+  EEPROMClass() { memset(bytes, 0xFF, sizeof(bytes)); }
+
+  template <class T> T &get(int address, T &value) {
+    memcpy(&value, &bytes[address], sizeof(T));
+    return value;
+  }
+
+  template <class T> const T &put(int address, const T &value) {
+    memcpy(&bytes[address], &value, sizeof(T));
+    return value;
+  }
+};
+extern EEPROMClass EEPROM;
+
+// Pins.. a test sets what digitalRead() and analogRead() return, and can see
+// what was written and which interrupts are attached.
+
+typedef uint16_t pin_t;
+
+enum { D0, D1, D2, D3, D4, D5, D6, D7, D8, D9, D10, D11, D12, D13,
+       A0, A1, A2, A3, A4, A5, TX, RX, HOST_PIN_COUNT };
+
+enum PinMode { INPUT, OUTPUT, INPUT_PULLUP, INPUT_PULLDOWN };
+enum InterruptMode { RISING, FALLING, CHANGE };
+
+#define HIGH 1
+#define LOW 0
+#define MSBFIRST 1
+
+struct HostPin {
+  int32_t level = LOW;
+  int32_t analogLevel = 0;
+
+  // If set, analogRead() asks this instead of using analogLevel
+  int32_t (*analogSource)() = nullptr;
+
+  // If set, digitalRead() asks this instead of using level
+  int32_t (*digitalSource)() = nullptr;
+
+  // If set, told about every write to the pin (for simulating what's on the other end)
+  void (*onWrite)(int32_t level) = nullptr;
+
+  void (*interruptHandler)() = nullptr;
+  int attachCount = 0;
+};
+extern HostPin hostPins[HOST_PIN_COUNT];
+
+void pinMode(pin_t pin, PinMode mode);
+void digitalWrite(pin_t pin, uint8_t level);
+int32_t digitalRead(pin_t pin);
+int32_t analogRead(pin_t pin);
+void pinSetFast(pin_t pin);
+void pinResetFast(pin_t pin);
+int32_t pinReadFast(pin_t pin);
+uint8_t shiftIn(pin_t dataPin, pin_t clockPin, uint8_t bitOrder);
+
+bool attachInterrupt(pin_t pin, void (*handler)(), InterruptMode mode, int8_t priority = -1, uint8_t subpriority = 0);
+bool detachInterrupt(pin_t pin);
+
+typedef int IRQn_Type;
+bool attachInterruptDirect(IRQn_Type irq, void (*handler)(void), bool enable = true);
+
+// Nothing preempts anything on the host unless a test starts its own threads
+#define ATOMIC_BLOCK()
+#define SINGLE_THREADED_BLOCK()
+
+// Timers and threads don't run by themselves.. a test calls the callback
+// when it wants the timer to go off.
+
+class Timer {
+public:
+  void (*callback)();
+  unsigned int periodMillis;
+  bool active = false;
+
+  Timer(unsigned int period, void (*timerCallback)(), bool = false)
+    : callback(timerCallback), periodMillis(period) {}
+
+  void start() { active = true; }
+  void stop() { active = false; }
+  void changePeriod(unsigned int period) { periodMillis = period; }
+  bool isActive() { return active; }
+};
+
+typedef uint8_t os_thread_prio_t;
+#define OS_THREAD_PRIORITY_DEFAULT 2
+#define OS_THREAD_STACK_SIZE_DEFAULT 3072
+
+inline void os_thread_yield() {}
+
+class Thread {
+public:
+  void (*function)(void *);
+  void *context;
+
+  Thread(const char *, void (*threadFunction)(void *), void *threadContext = nullptr,
+         os_thread_prio_t = OS_THREAD_PRIORITY_DEFAULT,
+         size_t = OS_THREAD_STACK_SIZE_DEFAULT)
+    : function(threadFunction), context(threadContext) {}
+};
+
+// I2C.. each address can have a simulated device on it (see HostI2CDevice),
+// anything else doesn't ACK.
+
+class HostI2CDevice {
+public:
+  virtual ~HostI2CDevice() {}
+
+  // Everything written in one transaction
+  virtual void receive(const uint8_t *bytes, size_t length) = 0;
+
+  // Fill in what the device sends back for a read
+  virtual void send(uint8_t *bytes, size_t length) = 0;
+};
+
+#define HOST_I2C_BUFFER_SIZE 32
+
+class TwoWire {
+public:
+  HostI2CDevice *devices[128] = { nullptr };
+  uint32_t clockHz = 100000;
+
+  // If set, host time moves on by how long each transfer would hold the bus at
+  // clockHz, plus transferOverheadMicros (for profiling, see ScaleBusBench)
+  bool clockBusTime = false;
+  uint32_t transferOverheadMicros = 0;
+
+  // Every write (endTransmission()) and read (requestFrom()), and the bytes
+  // clocked for them, address included
+  uint32_t transferCount = 0;
+  uint32_t bytesClocked = 0;
+
+  void attachDevice(uint8_t address, HostI2CDevice *device) { devices[address] = device; }
+
+  void begin() {}
+  void setClock(uint32_t hz) { clockHz = hz; }
+
+  void beginTransmission(uint8_t address);
+  size_t write(uint8_t value);
+  uint8_t endTransmission(bool stop = true);
+  uint8_t requestFrom(uint8_t address, uint8_t length);
+  int available();
+  int read();
+
+private:
+  void clockTransfer(size_t bytes, bool stop);
+
+  uint8_t transmitAddress = 0;
+  uint8_t transmitBuffer[HOST_I2C_BUFFER_SIZE];
+  size_t transmitLength = 0;
+
+  uint8_t receiveBuffer[HOST_I2C_BUFFER_SIZE];
+  size_t receiveLength = 0;
+  size_t receiveIndex = 0;
+};
+extern TwoWire Wire;
+
+#endif
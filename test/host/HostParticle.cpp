@@ -0,0 +1,279 @@
+#include "Arduino.h"
+#include "nrf.h"
+
+// The globals and functions behind Arduino.h, for the host tests
+
+uint64_t hostMicros = 0;
+
+void advanceHostMicros(uint64_t micros) {
+  hostMicros += micros;
+}
+
+unsigned long millis() {
+  return (unsigned long) (hostMicros / 1000);
+}
+
+unsigned long micros() {
+  return (unsigned long) hostMicros;
+}
+
+void delay(unsigned long millis) {
+  advanceHostMicros(millis * 1000ULL);
+}
+
+void delayMicroseconds(unsigned int micros) {
+  advanceHostMicros(micros);
+}
+
+int hostAllocationCount = 0;
+int hostFreeCount = 0;
+
+void *operator new(size_t size) {
+  hostAllocationCount++;
+  void *p = malloc(size ? size : 1);
+  if (!p) {
+    abort();
+  }
+  return p;
+}
+
+void *operator new[](size_t size) {
+  return operator new(size);
+}
+
+void operator delete(void *p) noexcept {
+  if (p) {
+    hostFreeCount++;
+  }
+  free(p);
+}
+
+void operator delete[](void *p) noexcept {
+  operator delete(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+  operator delete(p);
+}
+
+void operator delete[](void *p, size_t) noexcept {
+  operator delete(p);
+}
+
+TimeClass Time;
+
+bool TimeClass::isValid() {
+  return true;
+}
+
+uint32_t TimeClass::now() {
+  return 1700000000 + (uint32_t) (hostMicros / 1000000);
+}
+
+Logger Log;
+
+void printLog(bool print, const char *level, const char *format, va_list args) {
+  if (!print) {
+    return;
+  }
+
+  printf("%s: ", level);
+  vprintf(format, args);
+  printf("\n");
+}
+
+void Logger::error(const char *format, ...) {
+  errorCount++;
+  va_list args;
+  va_start(args, format);
+  printLog(print, "ERROR", format, args);
+  va_end(args);
+}
+
+void Logger::warn(const char *format, ...) {
+  warnCount++;
+  va_list args;
+  va_start(args, format);
+  printLog(print, "WARN", format, args);
+  va_end(args);
+}
+
+void Logger::info(const char *format, ...) {
+  infoCount++;
+  va_list args;
+  va_start(args, format);
+  printLog(print, "INFO", format, args);
+  va_end(args);
+}
+
+void Logger::trace(const char *format, ...) {
+  traceCount++;
+  va_list args;
+  va_start(args, format);
+  printLog(print, "TRACE", format, args);
+  va_end(args);
+}
+
+ParticleClass Particle;
+SystemClass System;
+WiFiClass WiFi;
+BLEClass BLE;
+EEPROMClass EEPROM;
+
+int HAL_Core_Runtime_Info(runtime_info_t *, void *) {
+  return 0;
+}
+
+SerialClass Serial;
+
+void SerialClass::printlnf(const char *format, ...) {
+  if (!capture) {
+    return;
+  }
+
+  char line[256];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(line, sizeof(line), format, args);
+  va_end(args);
+
+  println(line);
+}
+
+HostPin hostPins[HOST_PIN_COUNT];
+
+void pinMode(pin_t, PinMode) {
+}
+
+void writeHostPin(pin_t pin, int32_t level) {
+  hostPins[pin].level = level;
+
+  if (hostPins[pin].onWrite != nullptr) {
+    hostPins[pin].onWrite(level);
+  }
+}
+
+int32_t readHostPin(pin_t pin) {
+  if (hostPins[pin].digitalSource != nullptr) {
+    return hostPins[pin].digitalSource();
+  }
+  return hostPins[pin].level;
+}
+
+void digitalWrite(pin_t pin, uint8_t level) {
+  writeHostPin(pin, level);
+}
+
+int32_t digitalRead(pin_t pin) {
+  return readHostPin(pin);
+}
+
+int32_t analogRead(pin_t pin) {
+  if (hostPins[pin].analogSource != nullptr) {
+    return hostPins[pin].analogSource();
+  }
+  return hostPins[pin].analogLevel;
+}
+
+void pinSetFast(pin_t pin) {
+  writeHostPin(pin, HIGH);
+}
+
+void pinResetFast(pin_t pin) {
+  writeHostPin(pin, LOW);
+}
+
+int32_t pinReadFast(pin_t pin) {
+  return readHostPin(pin);
+}
+
+uint8_t shiftIn(pin_t, pin_t, uint8_t) {
+  return 0;
+}
+
+bool attachInterrupt(pin_t pin, void (*handler)(), InterruptMode, int8_t, uint8_t) {
+  hostPins[pin].interruptHandler = handler;
+  hostPins[pin].attachCount++;
+  return true;
+}
+
+bool detachInterrupt(pin_t pin) {
+  hostPins[pin].interruptHandler = nullptr;
+  return true;
+}
+
+bool attachInterruptDirect(IRQn_Type, void (*)(void), bool) {
+  return true;
+}
+
+NRF_TIMER_Type hostTimer4;
+NRF_TIMER_Type *NRF_TIMER4 = &hostTimer4;
+
+TwoWire Wire;
+
+void TwoWire::beginTransmission(uint8_t address) {
+  transmitAddress = address;
+  transmitLength = 0;
+}
+
+size_t TwoWire::write(uint8_t value) {
+  if (transmitLength >= sizeof(transmitBuffer)) {
+    return 0;
+  }
+  transmitBuffer[transmitLength++] = value;
+  return 1;
+}
+
+// 9 clocks a byte (with the ACK), a start, and a stop unless it's a repeated start
+void TwoWire::clockTransfer(size_t bytes, bool stop) {
+  transferCount++;
+  bytesClocked += bytes;
+
+  if (clockBusTime) {
+    uint32_t clocks = bytes * 9 + 1 + (stop ? 1 : 0);
+    advanceHostMicros((clocks * 1000000ULL + clockHz - 1) / clockHz + transferOverheadMicros);
+  }
+}
+
+// 0 is an ACK, 2 is a NACK on the address (as on the Argon)
+uint8_t TwoWire::endTransmission(bool stop) {
+  HostI2CDevice *device = devices[transmitAddress & 0x7F];
+  if (device == nullptr) {
+    clockTransfer(1, true);
+    return 2;
+  }
+
+  clockTransfer(1 + transmitLength, stop);
+
+  if (transmitLength > 0) {
+    device->receive(transmitBuffer, transmitLength);
+  }
+  return 0;
+}
+
+uint8_t TwoWire::requestFrom(uint8_t address, uint8_t length) {
+  receiveLength = 0;
+  receiveIndex = 0;
+
+  HostI2CDevice *device = devices[address & 0x7F];
+  if (device == nullptr) {
+    clockTransfer(1, true);
+    return 0;
+  }
+
+  receiveLength = min((size_t) length, sizeof(receiveBuffer));
+  clockTransfer(1 + receiveLength, true);
+  device->send(receiveBuffer, receiveLength);
+  return receiveLength;
+}
+
+int TwoWire::available() {
+  return receiveLength - receiveIndex;
+}
+
+int TwoWire::read() {
+  if (receiveIndex >= receiveLength) {
+    return -1;
+  }
+  return receiveBuffer[receiveIndex++];
+}
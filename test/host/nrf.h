@@ -0,0 +1,34 @@
+#ifndef HOST_NRF_H
+#define HOST_NRF_H
+
+#include <stdint.h>
+
+// The one nRF52 peripheral the firmware drives directly (see WaterPump.cpp)
+
+struct NRF_TIMER_Type {
+  volatile uint32_t TASKS_START;
+  volatile uint32_t TASKS_STOP;
+  volatile uint32_t TASKS_COUNT;
+  volatile uint32_t TASKS_CLEAR;
+  volatile uint32_t TASKS_SHUTDOWN;
+  volatile uint32_t TASKS_CAPTURE[6];
+  volatile uint32_t EVENTS_COMPARE[6];
+  volatile uint32_t SHORTS;
+  volatile uint32_t INTENSET;
+  volatile uint32_t INTENCLR;
+  volatile uint32_t MODE;
+  volatile uint32_t BITMODE;
+  volatile uint32_t PRESCALER;
+  volatile uint32_t CC[6];
+};
+
+extern NRF_TIMER_Type *NRF_TIMER4;
+
+#define TIMER4_IRQn 42
+#define TIMER_MODE_MODE_Timer 0
+#define TIMER_BITMODE_BITMODE_32Bit 3
+#define TIMER_SHORTS_COMPARE0_CLEAR_Msk 1
+#define TIMER_SHORTS_COMPARE0_STOP_Msk 0x100
+#define TIMER_INTENSET_COMPARE0_Msk 0x10000
+
+#endif
@@ -0,0 +1,85 @@
+#!/usr/bin/env python3
+#
+# Turns a capture of the Gaggia's binary event trace (see src/components/Trace.h)
+# into CSV.  The capture can be a raw serial log.. anything that isn't a
+# 'T:' trace line is ignored.  Each line carries one or more 24 hex digit records.
+#
+#   particle serial monitor > capture.txt
+#   python3 tools/decodeTrace.py capture.txt > trace.csv
+#
+# Times are in seconds from the first record, and values are scaled back from
+# the integers the firmware packs them into.
+
+import csv
+import re
+import sys
+
+TRACE_LINE = re.compile(r'T:((?:[0-9A-Fa-f]{24})+)')
+RECORD_HEX_DIGITS = 24
+
+# id: (name, a column, a scale, b column, b scale).. must match TraceEventId
+EVENTS = {
+    1: ('dropped', '', 1, 'droppedCount', 1),
+    2: ('pumpCycle', 'on', 1, 'epochPattern', 1),
+    3: ('pumpFire', 'dutyCycle', 1, 'delayMicros', 1),
+    4: ('pressurePID', 'pressureBars', 0.01, 'pumpDutyCycle', 0.01),
+    5: ('flowPID', 'flowRateGPS', 0.01, 'targetPressureBars', 0.01),
+    6: ('heaterPID', 'measuredTempC', 0.1, 'heaterDutyCycle', 0.01),
+    7: ('heaterWindow', 'on', 1, 'onMillis', 1),
+}
+
+
+def signed(value, bits):
+    if value >= 1 << (bits - 1):
+        value -= 1 << bits
+    return value
+
+
+def decode(lines):
+    firstMicros = None
+    lastMicros = None
+    elapsedMicros = 0
+
+    for line in lines:
+        match = TRACE_LINE.search(line)
+        if not match:
+            continue
+
+        records = match.group(1)
+        for start in range(0, len(records), RECORD_HEX_DIGITS):
+            record = records[start:start + RECORD_HEX_DIGITS]
+            timeMicros = int(record[0:8], 16)
+            eventId = int(record[8:12], 16)
+            a = signed(int(record[12:16], 16), 16)
+            b = signed(int(record[16:24], 16), 32)
+
+            # micros() wraps every ~71 minutes.  'dropped' records are stamped when
+            # they're sent, so can be out of order with the records around them.
+            if firstMicros is None:
+                firstMicros = timeMicros
+            else:
+                elapsedMicros += signed((timeMicros - lastMicros) & 0xFFFFFFFF, 32)
+            lastMicros = timeMicros
+
+            name, aName, aScale, bName, bScale = EVENTS.get(
+                eventId, ('event' + str(eventId), 'a', 1, 'b', 1))
+
+            yield [
+                '%.6f' % (elapsedMicros / 1e6),
+                name,
+                aName, round(a * aScale, 3),
+                bName, round(b * bScale, 3),
+            ]
+
+
+def main():
+    source = open(sys.argv[1]) if len(sys.argv) > 1 else sys.stdin
+
+    writer = csv.writer(sys.stdout)
+    writer.writerow(['timeSeconds', 'event', 'aName', 'a', 'bName', 'b'])
+    for row in decode(source):
+        writer.writerow(row)
+
+
+if __name__ == '__main__':
+    main()